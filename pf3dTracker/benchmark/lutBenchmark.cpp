@@ -0,0 +1,146 @@
+/**
+*
+* Benchmark of the ways of mapping RGB colours to the YUV bins of the 3d position tracker.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+// usage: pf3dTrackerLutBenchmark [nParticles] [nFrames]
+// for each look up table it reports:
+// - the time needed to build it, paid once at startup;
+// - the time spent per frame transforming the colours sampled along the contours of nParticles
+//   particles (2*50 points each, at random positions of a 320x240 image), as with colorTransfPolicy 1;
+// - the time spent per frame transforming the whole image with the table.
+// - whether the histograms of the image are the same when it is binned as the template, as with
+//   colorTransfPolicy 0 (the whole image) and as with colorTransfPolicy 1 (colour by colour).
+// then it reports the time spent per frame by the vectorized binning of the whole image, used
+// by colorTransfPolicy 0 with the direct table, at 320x240 and 640x480.
+// it returns 1 when the histograms differ.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <iCub/pf3dTrackerSupport.hpp>
+
+using namespace std;
+
+static double elapsedMs(const chrono::steady_clock::time_point &start)
+{
+    return chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    int nParticles=(argc>1)?atoi(argv[1]):900;
+    int nFrames=(argc>2)?atoi(argv[2]):100;
+    const int width=320;
+    const int height=240;
+    const int samples=nParticles*100;
+
+    cv::Mat image(height,width,CV_8UC3);
+    cv::Mat transformedImage(height,width,CV_8UC3);
+    cv::Mat binImage(height,width,CV_8UC1);
+    cv::randu(image,cv::Scalar::all(0),cv::Scalar::all(256));
+
+    //the positions sampled along the contours: random, as particles scattered on the image.
+    vector<int> offsets(samples);
+    srand(0);
+    for(int count=0;count<samples;count++)
+    {
+        offsets[count]=(rand()%height)*(int)image.step+(rand()%width)*3;
+    }
+    vector<unsigned char> R(samples), G(samples), B(samples), bins(samples);
+
+    const char* names[3]={"packed","quantized","direct"};
+    const int types[3]={LUT_PACKED,LUT_QUANTIZED,LUT_DIRECT};
+
+    printf("%d particles, %d samples per frame, %d frames\n",nParticles,samples,nFrames);
+    printf("%-10s %14s %18s %18s %14s\n","lut","startup [ms]","contours [ms/fr]","image [ms/fr]","histograms");
+    bool consistent=true;
+    for(int t=0;t<3;t++)
+    {
+        Lut lut;
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        if(!createLut(&lut,types[t]))
+        {
+            printf("%-10s unable to allocate the table\n",names[t]);
+            continue;
+        }
+        double startupTime=elapsedMs(start);
+
+        unsigned int checksum=0;
+        start=chrono::steady_clock::now();
+        for(int frame=0;frame<nFrames;frame++)
+        {
+            for(int count=0;count<samples;count++)
+            {
+                const unsigned char* pixel=image.data+offsets[count];
+                R[count]=pixel[0];
+                G[count]=pixel[1];
+                B[count]=pixel[2];
+            }
+            lutBins(&lut,&R[0],&G[0],&B[0],samples,&bins[0]);
+            checksum+=bins[frame%samples];
+        }
+        double contoursTime=elapsedMs(start)/nFrames;
+
+        start=chrono::steady_clock::now();
+        for(int frame=0;frame<nFrames;frame++)
+        {
+            rgbToYuvBinMatLut(image,transformedImage,&lut);
+        }
+        double imageTime=elapsedMs(start)/nFrames;
+
+        //the histograms of the whole image: binned as the template (rgbToYuvBinMatLut), as colorTransfPolicy 0
+        //(rgbToBinImage) and as colorTransfPolicy 1 (lutBins, row by row).
+        rgbToBinImage(&lut,image.data,(int)image.step,image.cols,0,image.rows,binImage.data,(int)binImage.step);
+        vector<int> templateHistogram(256,0), policy0Histogram(256,0), policy1Histogram(256,0);
+        vector<unsigned char> rowR(width), rowG(width), rowB(width), rowBins(width);
+        for(int row=0;row<height;row++)
+        {
+            const unsigned char* pixel=image.ptr<unsigned char>(row);
+            const unsigned char* transformedPixel=transformedImage.ptr<unsigned char>(row);
+            for(int column=0;column<width;column++)
+            {
+                templateHistogram[binIndex(transformedPixel[column*3+0],transformedPixel[column*3+1],transformedPixel[column*3+2])]++;
+                policy0Histogram[binImage.ptr<unsigned char>(row)[column]]++;
+                rowR[column]=pixel[column*3+0];
+                rowG[column]=pixel[column*3+1];
+                rowB[column]=pixel[column*3+2];
+            }
+            lutBins(&lut,&rowR[0],&rowG[0],&rowB[0],width,&rowBins[0]);
+            for(int column=0;column<width;column++)
+                policy1Histogram[rowBins[column]]++;
+        }
+        bool same=(templateHistogram==policy0Histogram && templateHistogram==policy1Histogram);
+        consistent=consistent && same;
+
+        printf("%-10s %14.2f %18.3f %18.3f %14s (%u)\n",names[t],startupTime,contoursTime,imageTime,same ? "identical" : "DIFFERENT",checksum);
+        releaseLut(&lut);
+    }
+
+    Lut direct={LUT_DIRECT,NULL};
+    for(int scale=1;scale<=2;scale++)
+    {
+        cv::Mat scaledImage(height*scale,width*scale,CV_8UC3);
+        cv::Mat binImage(height*scale,width*scale,CV_8UC1);
+        cv::randu(scaledImage,cv::Scalar::all(0),cv::Scalar::all(256));
+
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        for(int frame=0;frame<nFrames;frame++)
+        {
+            rgbToBinImage(&direct,scaledImage.data,(int)scaledImage.step,scaledImage.cols,0,scaledImage.rows,binImage.data,(int)binImage.step);
+        }
+        printf("binning a %dx%d image: %.3f ms/frame\n",scaledImage.cols,scaledImage.rows,elapsedMs(start)/nFrames);
+    }
+
+    return consistent ? 0 : 1;
+}
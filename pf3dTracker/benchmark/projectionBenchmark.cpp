@@ -0,0 +1,131 @@
+/**
+*
+* Benchmark of the projection of the contours of the 3d position tracker.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+// usage: pf3dTrackerProjectionBenchmark [nParticles] [nFrames]
+// for 25, 50 and 100 points per contour it reports the time spent per particle projecting the two
+// contours of a sphere (the model of generate_shape_model.py, radius 36mm, 20 percent), at random
+// positions in front of the camera:
+// - from the 3D points of the model, projectModelPoints();
+// - from the tables of the unit circle, projectSphereContours();
+// and the largest distance between the points given by the two, in pixels.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <iCub/pf3dTrackerKernels.hpp>
+
+using namespace std;
+
+static double elapsedMs(const chrono::steady_clock::time_point &start)
+{
+    return chrono::duration<double,milli>(chrono::steady_clock::now()-start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    int nParticles=(argc>1)?atoi(argv[1]):1000;
+    int nFrames=(argc>2)?atoi(argv[2]):100;
+    const float fx=257.34F, fy=257.34F, cx=160.0F, cy=120.0F;
+    const float radius=36.0F, innerRadius=0.8F*radius, outerRadius=1.2F*radius;
+    const double pi=3.14159265358979323846; //M_PI is not standard, MSVC lacks it.
+    if(nParticles<1 || nFrames<1)
+    {
+        printf("usage: pf3dTrackerProjectionBenchmark [nParticles] [nFrames]\n");
+        return 1;
+    }
+
+    //the particles: in front of the camera, between 0.3 and 1.5 meters, within its field of view.
+    vector<float> x(nParticles), y(nParticles), z(nParticles);
+    srand(0);
+    for(int count=0;count<nParticles;count++)
+    {
+        z[count]=300.0F+1200.0F*rand()/RAND_MAX;
+        x[count]=(2.0F*rand()/RAND_MAX-1.0F)*z[count]*cx/fx;
+        y[count]=(2.0F*rand()/RAND_MAX-1.0F)*z[count]*cy/fy;
+    }
+
+    printf("%d particles, %d frames\n",nParticles,nFrames);
+    printf("%-8s %18s %18s %10s %14s\n","points","3D points [ns/p]","circles [ns/p]","speed-up","max diff [px]");
+    const int pointCounts[3]={25,50,100};
+    for(int p=0;p<3;p++)
+    {
+        const int nPixels=pointCounts[p];
+        const int stride=((2*nPixels+15)/16)*16;
+
+        //the model, as written by generate_shape_model.py, and the tables of the unit circle.
+        vector<float> modelX(2*nPixels,0.0F), modelY(2*nPixels), modelZ(2*nPixels);
+        vector<float> circleCos(nPixels), circleSin(nPixels);
+        for(int count=0;count<nPixels;count++)
+        {
+            const double t=2.0*pi*count/nPixels;
+            circleCos[count]=(float)sin(t);
+            circleSin[count]=(float)cos(t);
+            modelY[count]=innerRadius*circleCos[count];
+            modelZ[count]=innerRadius*circleSin[count];
+            modelY[nPixels+count]=outerRadius*circleCos[count];
+            modelZ[nPixels+count]=outerRadius*circleSin[count];
+        }
+
+        vector<float> u(ProjectionBatch*stride), v(ProjectionBatch*stride);
+        vector<float> sphereU(ProjectionBatch*stride), sphereV(ProjectionBatch*stride);
+        float checksum=0;
+
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        for(int frame=0;frame<nFrames;frame++)
+        {
+            for(int begin=0;begin<nParticles;begin+=ProjectionBatch)
+            {
+                int n=min(ProjectionBatch,nParticles-begin);
+                projectModelPoints(&modelX[0],&modelY[0],&modelZ[0],2*nPixels,&x[begin],&y[begin],&z[begin],n,
+                                   fx,fy,cx,cy,&u[0],&v[0],stride);
+                checksum+=u[frame%nPixels];
+            }
+        }
+        double pointsTime=elapsedMs(start)*1e6/((double)nFrames*nParticles);
+
+        start=chrono::steady_clock::now();
+        for(int frame=0;frame<nFrames;frame++)
+        {
+            for(int begin=0;begin<nParticles;begin+=ProjectionBatch)
+            {
+                int n=min(ProjectionBatch,nParticles-begin);
+                projectSphereContours(&circleCos[0],&circleSin[0],nPixels,innerRadius,outerRadius,&x[begin],&y[begin],&z[begin],n,
+                                      fx,fy,cx,cy,&sphereU[0],&sphereV[0],stride);
+                checksum+=sphereU[frame%nPixels];
+            }
+        }
+        double circlesTime=elapsedMs(start)*1e6/((double)nFrames*nParticles);
+
+        //the two paths must give the same contours, up to the rounding.
+        float maxDifference=0;
+        for(int begin=0;begin<nParticles;begin+=ProjectionBatch)
+        {
+            int n=min(ProjectionBatch,nParticles-begin);
+            projectModelPoints(&modelX[0],&modelY[0],&modelZ[0],2*nPixels,&x[begin],&y[begin],&z[begin],n,
+                               fx,fy,cx,cy,&u[0],&v[0],stride);
+            projectSphereContours(&circleCos[0],&circleSin[0],nPixels,innerRadius,outerRadius,&x[begin],&y[begin],&z[begin],n,
+                                  fx,fy,cx,cy,&sphereU[0],&sphereV[0],stride);
+            for(int k=0;k<n;k++)
+                for(int count=0;count<2*nPixels;count++)
+                {
+                    maxDifference=max(maxDifference,fabs(u[k*stride+count]-sphereU[k*stride+count]));
+                    maxDifference=max(maxDifference,fabs(v[k*stride+count]-sphereV[k*stride+count]));
+                }
+        }
+
+        printf("%-8d %18.1f %18.1f %9.2fx %14.5f (%.0f)\n",nPixels,pointsTime,circlesTime,pointsTime/circlesTime,maxDifference,checksum);
+    }
+
+    return 0;
+}
@@ -0,0 +1,522 @@
+/**
+*
+* Offline replay of recorded frames through the filter of the 3d position tracker.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+// usage: pf3dTrackerReplayBenchmark <framesDir> [options]
+// the frames are the images of framesDir (bmp, png, ppm, jpg), replayed in the order of their names.
+// framesDir can also be a raw container written by the tracker (saveImagesEncoding raw), a .pf3draw file.
+// framesDir, or the directory of the container, can hold a groundtruth.txt file: one line per frame,
+// "X Y Z" in meters, as written on the data:o port of the tracker. frames whose line doesn't hold three
+// numbers are not scored.
+// options:
+//   --models dir              directory of the models, default: the app/conf/models of the sources
+//   --template file           colour template in the models directory, default red_ball_iit.bmp
+//   --shape file              shape model in the models directory, default initial_ball_points_36mm_20percent.csv
+//   --motion file             motion model in the models directory, default motion_model_matrix.csv
+//   --particles n1,n2,...     particle counts to replay the frames with, default 250,500,1000,2000,4000
+//   --colorTransfPolicy p     0 or 1, default 1
+//   --colorLut l              packed, quantized or direct, default packed
+//   --nThreads n              default 1, 0 means one per core
+//   --accelStDev s            default 30
+//   --insideOutsideDiffWeight w  default 1.5
+//   --likelihoodThreshold t   default 0.005
+//   --camera fx fy cx cy      intrinsics at the resolution of the frames, default the ones of the
+//                             tracker (257.34 257.34 160 120 at 320x240) scaled to the frames
+//   --initial X Y Z           initial position [m], default the first ground truth or 0 0 0.5
+//   --seed s                  default 1
+//   --minParticles m          KLD-sampling between m and each particle count, default no adaptation
+//   --kldError e              default 0.05
+//   --kldBinSize s            [mm], default 20
+//   --resamplingScheme s      systematic, stratified or residual, default systematic
+//   --coarsePixels n          contour points of the first stage of the coarse to fine evaluation, default 0 (off)
+//   --fineFraction f          fraction of the particles scored with all the points, default 0.25
+//   --scoringMode m           0 colour histograms of the contours, 1 score image, default 0
+//   --genericProjection       project the 3D points of the shape model even when it is a sphere
+//   --templateAdaptation r g  adaptive template with rate r, from the particles whose normalized likelihood exceeds g, default off, not with scoringMode 1
+//   --nPixels n               points on each contour, the shape file must hold 6*n values, default 50
+//   --bins y u v              colour bins of the histograms, at most 4 8 8, default 4 8 8
+//   --wholeImage              with colorTransfPolicy 0 transform the whole frames, not only the region around the particles
+//   --framePeriod t           [s] move the particles by the time between the timestamps of a raw container, in
+//                             periods of t, as the framePeriod of the tracker. default 0: one period per frame
+// for each particle count it reports the frames per second, the median time of each stage, the
+// mean number of particles used and the mean and RMS distance between the estimates and the ground truth.
+// the filter runs the same cycle as PF3DTracker::updateModule(), without the particles:i input.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <yarp/os/Time.h>
+
+#include <iCub/pf3dTrackerSupport.hpp>
+#include <iCub/pf3dTrackerFilter.hpp>
+#include <iCub/pf3dTrackerStats.hpp>
+#include <iCub/pf3dTrackerRecorder.hpp>
+
+#ifndef PF3DTRACKER_MODELS_DIR
+#define PF3DTRACKER_MODELS_DIR "models"
+#endif
+
+using namespace std;
+
+struct GroundTruth
+{
+    bool valid;
+    double x, y, z; //meters
+};
+
+static bool isImage(const string &fileName)
+{
+    size_t dot=fileName.rfind('.');
+    if(dot==string::npos)
+        return false;
+    string extension=fileName.substr(dot+1);
+    for(size_t count=0;count<extension.size();count++)
+        extension[count]=(char)tolower(extension[count]);
+    return extension=="bmp" || extension=="png" || extension=="ppm" || extension=="jpg" || extension=="jpeg";
+}
+
+static void readGroundTruth(const string &fileName, int nFrames, vector<GroundTruth> &groundTruth)
+{
+    GroundTruth none={false,0,0,0};
+    groundTruth.assign(nFrames,none);
+
+    ifstream fin(fileName.c_str());
+    string line;
+    for(int frame=0;frame<nFrames && getline(fin,line);frame++)
+    {
+        istringstream values(line);
+        GroundTruth &truth=groundTruth[frame];
+        truth.valid=(bool)(values>>truth.x>>truth.y>>truth.z);
+    }
+}
+
+static vector<int> parseCounts(const string &list)
+{
+    vector<int> counts;
+    istringstream values(list);
+    string value;
+    while(getline(values,value,','))
+    {
+        if(atoi(value.c_str())>0)
+            counts.push_back(atoi(value.c_str()));
+    }
+    return counts;
+}
+
+static double median(const StageStats &stats, StageStats::Stage stage)
+{
+    double p50, p95, p99;
+    int samples;
+    stats.percentiles(stage,p50,p95,p99,samples);
+    return p50*1000; //seconds to milliseconds
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc<2)
+    {
+        printf("usage: %s <framesDir> [options], see the source for the options\n",argv[0]);
+        return 1;
+    }
+
+    string framesDir=argv[1];
+    string modelsDir=PF3DTRACKER_MODELS_DIR;
+    string templateFile="red_ball_iit.bmp";
+    string shapeFile="initial_ball_points_36mm_20percent.csv";
+    string motionFile="motion_model_matrix.csv";
+    vector<int> particleCounts=parseCounts("250,500,1000,2000,4000");
+    int colorTransfPolicy=1;
+    string colorLut="packed";
+    int nThreads=1;
+    float accelStDev=30;
+    float insideOutsideDiffWeight=1.5;
+    float likelihoodThreshold=0.005F;
+    bool customCamera=false;
+    float fx=257.34F, fy=257.34F, cx=160.0F, cy=120.0F;
+    bool customInitial=false;
+    double initialX=0, initialY=0, initialZ=0.5;
+    unsigned int seed=1;
+    int minParticles=0;
+    float kldError=0.05F;
+    float kldBinSize=20;
+    string resamplingScheme="systematic";
+    int coarsePixels=0;
+    float fineFraction=0.25F;
+    int scoringMode=0;
+    bool genericProjection=false;
+    float adaptationRate=0, adaptationGate=0.1F;
+    int nPixels=50;
+    bool wholeImage=false;
+    double framePeriod=0;
+    int yBins=YBins, uBins=UBins, vBins=VBins;
+
+    for(int arg=2;arg<argc;arg++)
+    {
+        string option=argv[arg];
+        int left=argc-arg-1;
+        if(option=="--models" && left>=1)
+            modelsDir=argv[++arg];
+        else if(option=="--template" && left>=1)
+            templateFile=argv[++arg];
+        else if(option=="--shape" && left>=1)
+            shapeFile=argv[++arg];
+        else if(option=="--motion" && left>=1)
+            motionFile=argv[++arg];
+        else if(option=="--particles" && left>=1)
+            particleCounts=parseCounts(argv[++arg]);
+        else if(option=="--colorTransfPolicy" && left>=1)
+            colorTransfPolicy=atoi(argv[++arg]);
+        else if(option=="--colorLut" && left>=1)
+            colorLut=argv[++arg];
+        else if(option=="--nThreads" && left>=1)
+            nThreads=atoi(argv[++arg]);
+        else if(option=="--accelStDev" && left>=1)
+            accelStDev=(float)atof(argv[++arg]);
+        else if(option=="--insideOutsideDiffWeight" && left>=1)
+            insideOutsideDiffWeight=(float)atof(argv[++arg]);
+        else if(option=="--likelihoodThreshold" && left>=1)
+            likelihoodThreshold=(float)atof(argv[++arg]);
+        else if(option=="--camera" && left>=4)
+        {
+            fx=(float)atof(argv[++arg]);
+            fy=(float)atof(argv[++arg]);
+            cx=(float)atof(argv[++arg]);
+            cy=(float)atof(argv[++arg]);
+            customCamera=true;
+        }
+        else if(option=="--initial" && left>=3)
+        {
+            initialX=atof(argv[++arg]);
+            initialY=atof(argv[++arg]);
+            initialZ=atof(argv[++arg]);
+            customInitial=true;
+        }
+        else if(option=="--seed" && left>=1)
+            seed=(unsigned int)atoi(argv[++arg]);
+        else if(option=="--minParticles" && left>=1)
+            minParticles=atoi(argv[++arg]);
+        else if(option=="--kldError" && left>=1)
+            kldError=(float)atof(argv[++arg]);
+        else if(option=="--kldBinSize" && left>=1)
+            kldBinSize=(float)atof(argv[++arg]);
+        else if(option=="--resamplingScheme" && left>=1)
+            resamplingScheme=argv[++arg];
+        else if(option=="--coarsePixels" && left>=1)
+            coarsePixels=atoi(argv[++arg]);
+        else if(option=="--fineFraction" && left>=1)
+            fineFraction=(float)atof(argv[++arg]);
+        else if(option=="--scoringMode" && left>=1)
+            scoringMode=atoi(argv[++arg]);
+        else if(option=="--genericProjection")
+            genericProjection=true;
+        else if(option=="--templateAdaptation" && left>=2)
+        {
+            adaptationRate=(float)atof(argv[++arg]);
+            adaptationGate=(float)atof(argv[++arg]);
+        }
+        else if(option=="--wholeImage")
+            wholeImage=true;
+        else if(option=="--framePeriod" && left>=1)
+            framePeriod=atof(argv[++arg]);
+        else if(option=="--nPixels" && left>=1)
+            nPixels=atoi(argv[++arg]);
+        else if(option=="--bins" && left>=3)
+        {
+            yBins=atoi(argv[++arg]);
+            uBins=atoi(argv[++arg]);
+            vBins=atoi(argv[++arg]);
+        }
+        else
+        {
+            printf("unknown option, or missing values: %s\n",option.c_str());
+            return 1;
+        }
+    }
+
+    if(colorTransfPolicy!=0 && colorTransfPolicy!=1)
+    {
+        printf("colorTransfPolicy must be 0 or 1\n");
+        return 1;
+    }
+    if(coarsePixels<0 || fineFraction<=0 || fineFraction>1)
+    {
+        printf("coarsePixels must be positive or 0, fineFraction in (0,1]\n");
+        return 1;
+    }
+    if(scoringMode!=0 && scoringMode!=1)
+    {
+        printf("scoringMode must be 0 or 1\n");
+        return 1;
+    }
+    int lutType;
+    if(colorLut=="packed")
+        lutType=LUT_PACKED;
+    else if(colorLut=="quantized")
+        lutType=LUT_QUANTIZED;
+    else if(colorLut=="direct")
+        lutType=LUT_DIRECT;
+    else
+    {
+        printf("unknown look up table: %s\n",colorLut.c_str());
+        return 1;
+    }
+    Resampler::Scheme scheme;
+    if(resamplingScheme=="systematic")
+        scheme=Resampler::Systematic;
+    else if(resamplingScheme=="stratified")
+        scheme=Resampler::Stratified;
+    else if(resamplingScheme=="residual")
+        scheme=Resampler::Residual;
+    else
+    {
+        printf("unknown resampling scheme: %s\n",resamplingScheme.c_str());
+        return 1;
+    }
+
+    //***************************************************************
+    //load all the frames up front: the replay must not wait for disk.
+    //***************************************************************
+    vector<cv::String> fileNames;
+    vector<cv::Mat> frames;
+    vector<double> timestamps; //only the raw containers have them.
+    string groundTruthDir=framesDir;
+    const string rawExtension=".pf3draw";
+    if(framesDir.size()>rawExtension.size() && framesDir.compare(framesDir.size()-rawExtension.size(),rawExtension.size(),rawExtension)==0)
+    {
+        if(!readRawFrames(framesDir,frames,timestamps))
+            printf("%s is not a raw container or is truncated, %d frames read\n",framesDir.c_str(),(int)frames.size());
+        size_t slash=framesDir.find_last_of("/\\");
+        groundTruthDir=(slash==string::npos) ? string(".") : framesDir.substr(0,slash);
+        for(size_t count=1;count<frames.size();count++)
+        {
+            if(frames[count].cols!=frames[0].cols || frames[count].rows!=frames[0].rows)
+            {
+                printf("frame %d has a different size from the first frame, the replay stops there\n",(int)count);
+                frames.resize(count);
+                timestamps.resize(count);
+                break;
+            }
+        }
+    }
+    else
+    {
+        cv::glob(framesDir+"/*",fileNames,false);
+    }
+    for(size_t count=0;count<fileNames.size();count++)
+    {
+        if(!isImage(fileNames[count]))
+            continue;
+        cv::Mat frame=cv::imread(fileNames[count]); //BGR, as the images of the tracker after toCvMat().
+        if(frame.empty() || frame.type()!=CV_8UC3)
+            continue;
+        if(!frames.empty() && (frame.cols!=frames[0].cols || frame.rows!=frames[0].rows))
+        {
+            printf("%s has a different size from the first frame, skipped\n",fileNames[count].c_str());
+            continue;
+        }
+        frames.push_back(frame);
+    }
+    if(frames.empty())
+    {
+        printf("no frames in %s\n",framesDir.c_str());
+        return 1;
+    }
+    const int nFrames=(int)frames.size();
+    const int width=frames[0].cols;
+    const int height=frames[0].rows;
+
+    vector<GroundTruth> groundTruth;
+    readGroundTruth(groundTruthDir+"/groundtruth.txt",nFrames,groundTruth);
+    int nGroundTruth=0;
+    for(int frame=0;frame<nFrames;frame++)
+    {
+        if(groundTruth[frame].valid)
+            nGroundTruth++;
+    }
+    if(!customInitial && groundTruth[0].valid)
+    {
+        initialX=groundTruth[0].x;
+        initialY=groundTruth[0].y;
+        initialZ=groundTruth[0].z;
+    }
+    if(!customCamera)
+    {
+        //the calibration of the tracker refers to 320x240 images.
+        fx*=width/320.0F;
+        cx*=width/320.0F;
+        fy*=height/240.0F;
+        cy*=height/240.0F;
+    }
+
+    //the images seen by the filter: headers on the frames and one image of bins.
+    IplImage* rawImage=cvCreateImageHeader(cvSize(width,height),IPL_DEPTH_8U,3);
+    IplImage* transformedImage=cvCreateImage(cvSize(width,height),IPL_DEPTH_8U,1);
+
+    Lut lut;
+    if(!createLut(&lut,lutType))
+    {
+        printf("unable to allocate the look up table\n");
+        return 1;
+    }
+    WorkerPool workers;
+    workers.start(nThreads);
+
+    printf("%d frames %dx%d, %d with ground truth, colorTransfPolicy %d, %s look up table, %d thread(s)\n",
+           nFrames,width,height,nGroundTruth,colorTransfPolicy,colorLut.c_str(),workers.size());
+    printf("%9s %8s %10s %10s %10s %10s %10s %10s %8s %10s %8s\n","particles","fps","cycle p50","cycle p95",
+           "colour","likelihood","resample","motion","mean n","error [mm]","rms [mm]");
+
+    const string histogramFile="pf3dTrackerReplayHistogram.csv";
+    for(size_t test=0;test<particleCounts.size();test++)
+    {
+        const int nParticles=particleCounts[test];
+        ParticleFilter filter;
+        if(filter.setResolution(nPixels,yBins,uBins,vBins))
+            return 1;
+        if(!filter.allocate(nParticles,&lut,&workers))
+        {
+            printf("%9d unable to allocate the filter\n",nParticles);
+            continue;
+        }
+        if(filter.computeTemplateHistogram(modelsDir+"/"+templateFile,histogramFile,false) ||
+           filter.readModelHistogram(histogramFile.c_str()) ||
+           filter.readModel3dPoints(modelsDir+"/"+shapeFile) ||
+           filter.readMotionModelMatrix(modelsDir+"/"+motionFile))
+        {
+            printf("unable to read the models in %s\n",modelsDir.c_str());
+            return 1;
+        }
+        filter.setCamera(fx,fy,cx,cy);
+        filter.setColorTransfPolicy(colorTransfPolicy);
+        filter.setAccelStDev(accelStDev);
+        filter.setInsideOutsideWeight(insideOutsideDiffWeight);
+        filter.setInitialPosition(initialX*1000,initialY*1000,initialZ*1000); //meters to millimeters
+        filter.setSeed(seed);
+        if(minParticles>0 && minParticles<nParticles)
+            filter.setAdaptive(minParticles,kldError,kldBinSize);
+        filter.setResamplingScheme(scheme);
+        filter.setCoarseToFine(coarsePixels,fineFraction);
+        filter.setScoringMode(scoringMode);
+        filter.setTemplateAdaptation(adaptationRate,adaptationGate);
+        filter.setSphereFastPath(!genericProjection);
+        filter.initializeParticles();
+
+        StageStats stats(nFrames);
+        int framesNotTracking=0;
+        double errorSum=0, squaredErrorSum=0;
+        double particleSum=0;
+        double stageStart;
+        double start=yarp::os::Time::now();
+        for(int frame=0;frame<nFrames;frame++)
+        {
+            double cycleStart=yarp::os::Time::now();
+            particleSum+=filter.nParticles();
+            cvSetData(rawImage,frames[frame].data,(int)frames[frame].step);
+
+            if(colorTransfPolicy==0)
+            {
+                stageStart=yarp::os::Time::now();
+                if(wholeImage)
+                    filter.transformImage(rawImage,transformedImage);
+                else
+                    filter.transformImageAroundParticles(rawImage,transformedImage);
+                stats.add(StageStats::ColourTransform,yarp::os::Time::now()-stageStart);
+            }
+
+            float sumLikelihood, maxLikelihood;
+            int maxIndex;
+            stageStart=yarp::os::Time::now();
+            filter.evaluate(rawImage,transformedImage,sumLikelihood,maxLikelihood,maxIndex);
+            stats.add(StageStats::Likelihood,yarp::os::Time::now()-stageStart);
+
+            if(maxLikelihood/exp((float)20.0)>likelihoodThreshold) //normalizing likelihood
+                framesNotTracking=0;
+            else
+                framesNotTracking+=1;
+            if(adaptationRate>0)
+                filter.adaptTemplate();
+
+            float meanX, meanY, meanZ;
+            if(framesNotTracking==5 || sumLikelihood==0.0)
+            {
+                filter.initializeParticles();
+                framesNotTracking=0;
+                filter.mean(meanX,meanY,meanZ);
+            }
+            else
+            {
+                filter.weightedMean(sumLikelihood,meanX,meanY,meanZ);
+                if(maxLikelihood>10) //see updateModule().
+                {
+                    stageStart=yarp::os::Time::now();
+                    filter.resample(0,framesNotTracking>0);
+                    stats.add(StageStats::Resample,yarp::os::Time::now()-stageStart);
+                }
+                else if(framesNotTracking>0)
+                {
+                    filter.grow();
+                }
+                stageStart=yarp::os::Time::now();
+                float periods=1;
+                if(framePeriod>0 && frame+1<(int)timestamps.size())
+                {
+                    //the time to the next frame, clamped as in PF3DTracker::framePeriods().
+                    periods=(float)((timestamps[frame+1]-timestamps[frame])/framePeriod);
+                    if(periods<0)
+                        periods=0;
+                    if(periods>maxFramePeriods)
+                        periods=maxFramePeriods;
+                }
+                filter.applyMotionModel(periods);
+                stats.add(StageStats::MotionModel,yarp::os::Time::now()-stageStart);
+            }
+            stats.add(StageStats::Cycle,yarp::os::Time::now()-cycleStart);
+
+            if(groundTruth[frame].valid)
+            {
+                double dx=meanX-groundTruth[frame].x*1000; //meters to millimeters
+                double dy=meanY-groundTruth[frame].y*1000;
+                double dz=meanZ-groundTruth[frame].z*1000;
+                double squaredError=dx*dx+dy*dy+dz*dz;
+                errorSum+=sqrt(squaredError);
+                squaredErrorSum+=squaredError;
+            }
+        }
+        double elapsed=yarp::os::Time::now()-start;
+
+        double p50, p95, p99;
+        int samples;
+        stats.percentiles(StageStats::Cycle,p50,p95,p99,samples);
+        printf("%9d %8.1f %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f",nParticles,nFrames/elapsed,p50*1000,p95*1000,
+               median(stats,StageStats::ColourTransform),median(stats,StageStats::Likelihood),
+               median(stats,StageStats::Resample),median(stats,StageStats::MotionModel));
+        printf(" %8.0f",particleSum/nFrames);
+        if(nGroundTruth>0)
+            printf(" %10.1f %8.1f\n",errorSum/nGroundTruth,sqrt(squaredErrorSum/nGroundTruth));
+        else
+            printf(" %10s %8s\n","-","-");
+    }
+    remove(histogramFile.c_str());
+
+    workers.stop();
+    releaseLut(&lut);
+    cvReleaseImageHeader(&rawImage);
+    cvReleaseImage(&transformedImage);
+
+    return 0;
+}
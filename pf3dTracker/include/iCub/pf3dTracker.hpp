@@ -13,13 +13,17 @@
 #ifndef _PF3DTRACKER_
 #define _PF3DTRACKER_
 
+#include <atomic>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <yarp/os/BufferedPort.h>
 #include <yarp/os/LogStream.h>
 #include <yarp/os/Network.h>
+#include <yarp/os/Port.h>
 #include <yarp/os/RFModule.h>
 #include <yarp/os/Stamp.h>
 #include <yarp/os/Time.h>
@@ -39,6 +43,12 @@
 #endif
 
 #include <iCub/pf3dTrackerSupport.hpp>
+#include <iCub/pf3dTrackerCache.hpp>
+#include <iCub/pf3dTrackerFilter.hpp>
+#include <iCub/pf3dTrackerFrames.hpp>
+#include <iCub/pf3dTrackerParticleMessage.hpp>
+#include <iCub/pf3dTrackerRecorder.hpp>
+#include <iCub/pf3dTrackerStats.hpp>
 
 //for tracking in the iCub: 1000 particles and an stDev of 80 work well with slow movements of the ball. the localization is quite stable. the shape model has a 20% difference wrt the real radius.
 //#define _nParticles 5000
@@ -50,18 +60,35 @@
 //1: only transform the color of the pixels that you need
 //0: transform the whole image.
 
-#define nPixels 50
+//with colorTransfPolicy 2 the whole image is transformed when it has fewer pixels than
+//binnedPixelsPerSample times the points of all the contours: the vectorized binning of the
+//whole image is this much cheaper, per pixel, than looking up scattered contour points.
+#define binnedPixelsPerSample 4
 
-#define YBins 4
-#define UBins 8 
-#define VBins 8
+//a frame prepared by the capture stage, when the acquisition is pipelined.
+struct FrameSlot
+{
+    FrameSlot() : rawImage(NULL), transformedImage(NULL) {}
+    yarp::sig::ImageOf<yarp::sig::PixelRgb> image; //a copy of the image read from the port, it's drawn on.
+    yarp::os::Stamp stamp;
+    IplImage* rawImage;         //see _rawImage.
+    IplImage* transformedImage; //see _transformedImage, only filled with colorTransfPolicy 0.
+};
 
-//should be 1.5 or 1.0 !!! ???
-//#define inside_outside_difference_weight 1.5
-//if I set it to 1.5, when the ball goes towards the camera, the tracker lags behind.
-//this happens because the particles with "ball color" on both sides of the contour
-//are still quite likely. the opposite is not true: when the ball goes away from the
-// camera, the tracker follows it quite readily.
+//an object tracked besides the main one, with its own colour template and particles: it shares
+//the images, their colour transformation and the worker pool with the main one.
+struct TrackedTarget
+{
+    TrackedTarget() : framesNotTracking(0), seeingObject(0), predict(false), x(0), y(0), z(1000), likelihood(0), u(0), v(0) {}
+    ParticleFilter filter;
+    int framesNotTracking;
+    int seeingObject; //0 means false, 1 means true.
+    bool predict;     //apply the motion model with the next image.
+    float x, y, z;    //estimated position [mm].
+    float likelihood; //normalized.
+    float u, v;       //projection of the estimated position.
+    std::string adaptedTemplateFile; //where the adapted template is saved, see templateAdaptationRate.
+};
 
 class PF3DTracker : public yarp::os::RFModule
 {
@@ -73,6 +100,8 @@ int _numParticlesReceived;
 //parameters set during initialization.
 std::string _inputVideoPortName;
 yarp::os::BufferedPort<yarp::sig::ImageOf<yarp::sig::PixelRgb> > _inputVideoPort;
+std::string _inputVideoPortRightName;
+yarp::os::BufferedPort<yarp::sig::ImageOf<yarp::sig::PixelRgb> > _inputVideoPortRight; //stereo only.
 std::string _outputVideoPortName;
 yarp::os::BufferedPort<yarp::sig::ImageOf<yarp::sig::PixelRgb> > _outputVideoPort;
 std::string _outputDataPortName;
@@ -81,11 +110,20 @@ std::string _inputParticlePortName;
 yarp::os::BufferedPort<yarp::os::Bottle> _inputParticlePort;
 std::string _outputParticlePortName;
 yarp::os::BufferedPort<yarp::os::Bottle> _outputParticlePort;
+int _particleDecimation; //particles:o sends one particle every _particleDecimation.
+std::vector<float> _particleBuffer; //the rows of the particles sent, see writeParticleMessage().
 std::string _outputAttentionPortName;
 yarp::os::BufferedPort<yarp::sig::Vector> _outputAttentionPort;
 std::string _outputUVDataPortName;
 yarp::os::BufferedPort<yarp::os::Bottle> _outputUVDataPort;
 bool supplyUVdata;
+std::string _outputStatsPortName;
+yarp::os::BufferedPort<yarp::os::Bottle> _outputStatsPort;
+std::string _outputTargetsPortName;
+yarp::os::BufferedPort<yarp::os::Bottle> _outputTargetsPort;
+std::string _rpcPortName;
+yarp::os::Port _rpcPort;
+StageStats _stats; //latency of the stages of updateModule().
 
 std::string _projectionModel;
 float _perspectiveFx;
@@ -94,7 +132,20 @@ float _perspectiveCx;
 float _perspectiveCy;
 int _calibrationImageWidth;
 int _calibrationImageHeight;
+bool _stereo; //weight the particles with the images of both cameras.
+float _rightFx; //intrinsics of the right camera, in stereo.
+float _rightFy;
+float _rightCx;
+float _rightCy;
+int _rightCalibrationImageWidth;
+int _rightCalibrationImageHeight;
+double _rightRotation[9];    //from the frame of the left camera to the one of the right camera, row major.
+double _rightTranslation[3]; //[mm].
 float _likelihoodThreshold;
+float _templateAdaptationRate; //adaptive template: weight of the best particles, 0 disables it.
+float _templateAdaptationGate; //the normalized likelihood a particle needs to adapt the template.
+std::string _adaptedTemplateFile; //written on close, and read on startup with resumeAdaptedTemplate.
+bool _resumeAdaptedTemplate;
 
 int _seeingObject; //0 means false, 1 means true.
 int _circleVisualizationMode;
@@ -102,76 +153,61 @@ std::string _initializationMethod;
 std::string _trackedObjectType;
 bool _saveImagesWithOpencv;
 std::string _saveImagesWithOpencvDir;
-double _initialX;
-double _initialY;
-double _initialZ;
+ImageRecorder _recorder; //writes the images in the background.
+bool _saveInputImages;   //save the images as they are received, not the elaborated ones: they can be replayed.
 double _attentionOutput;
 double _attentionOutputMax;
 double _attentionOutputDecrease;
-CvRNG rngState; //something needed by the random number generator
 bool _doneInitializing;
 
-Lut*   _lut;
-CvMat* _A;
+Lut _lut;
+int _colorLut; //LUT_PACKED, LUT_QUANTIZED or LUT_DIRECT.
+MappedFile _lutFile;   //the cached look up table, when it is mapped.
+std::string _cacheDir; //where the look up table and the template histograms are cached, empty without the cache.
 int _nParticles;
-float _accelStDev;
-float _inside_outside_difference_weight;
-int _colorTransfPolicy;
+int _nPixels; //points on each contour of the shape model.
+int _yBins;   //colour bins of the histograms.
+int _uBins;
+int _vBins;
+int _minParticles; //KLD-sampling picks between _minParticles and _nParticles particles.
+float _kldError;
+float _kldBinSize;
+Resampler::Scheme _resamplingScheme;
+long long _seed; //seed of the random numbers of the filter.
+int _coarsePixels; //coarse to fine evaluation: contour points of the first stage, 0 disables it.
+float _fineFraction; //fraction of the particles scored again with all the points.
+int _scoringMode; //0: colour histograms of the contours, 1: score image.
+bool _sphereFastPath; //project the contours of a sphere from the unit circle.
+std::atomic<int> _activeParticles; //particles used in the last cycle, read by the rpc port too.
+int _colorTransfPolicy; //0: transform the whole image, 1: only the pixels that are needed, 2 (config only): choose one at startup.
+int _nThreads; //number of threads used to evaluate the particles.
+bool _zeroCopy; //read the images from the buffer of the input port and draw on the buffer of the output port.
+int _pipelineDepth; //frames the capture stage can prepare in advance, 0 means that the images are read by updateModule().
 
-//float _modelHistogram[YBins][UBins][VBins]; //data
-CvMatND* _modelHistogramMat; //OpenCV Matrix
-CvMatND* _innerHistogramMat;//[YBins][UBins][VBins];
-CvMatND* _outerHistogramMat;//[YBins][UBins][VBins];
-
-CvMat* _model3dPointsMat; //shape model
 CvMat* _visualization3dPointsMat; //visualization model for the sphere (when _circleVisualizationMode==1). should have less points, but it was easier to make it like this.
 
-//not sure which of these are really used.
-CvMat* _rzMat;      //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _ryMat;      //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _points2Mat; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _p2Mat1;     //pointer to the first row of _points2Mat
-CvMat* _p2Mat3;     //pointer to the third row of _points2Mat
-CvMat* _tempMat;    //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _tempMat1;   //pointer to the first row of _tempMat
-CvMat* _tempMat2;   //pointer to the first row of _tempMat
-CvMat* _tempMat3;   //pointer to the first row of _tempMat
-CvMat* _drawingMat; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _projectionMat; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _xyzMat1; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _xyzMat2; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _xyzMat3; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles1; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles2; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles3; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles4; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles5; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles6; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles7; //this is used during some operations... it is defined here to avoid repeated instantiations
-CvMat* _particles1to6;
-CvMat* _newParticles1to6;
-CvMat* _uv;
-
-//resampling-related stuff
-CvMat* _nChildren;
-CvMat* _label;
-CvMat* _u;
-CvMat* _ramp;
-
-//new resampling-related stuff
-CvMat* _cumWeight;
-
-//variables
-CvMat* _particles;
-CvMat* _newParticles;
-CvMat* _noise;
-CvMat* _noise1; //lines from 0 to 2
-CvMat* _noise2; //lines from 3 to 5
+//the particles, the models, the likelihood, the resampling and the motion model.
+ParticleFilter _filter;
+WorkerPool _workers; //evaluates the particles and transforms the images.
+std::vector<TrackedTarget*> _targets; //the other objects, see extraColorTemplates.
+
+//pipelined acquisition: the capture thread fills the slots, updateModule() processes them in order.
+std::vector<FrameSlot> _frameSlots;
+FrameQueue _frames;
+int _currentFrame;
+std::thread _captureThread;
 
 yarp::os::Stamp _yarpTimestamp;
 yarp::sig::ImageOf<yarp::sig::PixelRgb> *_yarpImage;
-IplImage *_rawImage;
-IplImage* _transformedImage;//_yuvBinsImage[image_width][image_height][3];
+IplImage *_rawImage; //a copy of the input image, BGR, or a header on the input port buffer, RGB, with _zeroCopy.
+IplImage* _transformedImage;//_yuvBinsImage[image_width][image_height], the YUV bin of each pixel.
+yarp::sig::ImageOf<yarp::sig::PixelRgb> *_yarpImageRight; //the same, for the right camera in stereo.
+IplImage *_rawImageRight;
+IplImage* _transformedImageRight;
+double _stereoStampTolerance; //largest distance between the timestamps of the left and right images [s], 0: no check.
+bool _rightImageInSync;       //the last right image is close enough to the left one to be used.
+double _framePeriod;   //the period of the motion model [s], 0: one period per image.
+double _lastStampTime; //timestamp of the last image [s].
 double _initialTime;
 double _finalTime;
 
@@ -186,26 +222,26 @@ bool _firstFrame; //when processing the first frame do not write the fps values,
 //MEMBERS THAT "WORK":/
 ///////////////////////
 bool testOpenCv();
-bool readModelHistogram(CvMatND* histogram,const char fileName[]);
-bool readInitialmodel3dPoints(CvMat* points,std::string fileName);
-bool readMotionModelMatrix(CvMat* points, std::string fileName);
-bool computeTemplateHistogram(std::string imageFileName,std::string dataFileName); //I checked the output, it seems to work, but it seems as if in the old version the normalization didn't take effect.
-bool computeHistogram(CvMat* uv, IplImage* transformedImage,  CvMatND* innerHistogramMat, float &usedInnerPoints, CvMatND* outerHistogramMat, float &usedOuterPoints);
-bool computeHistogramFromRgbImage(CvMat* uv, IplImage *image,  CvMatND* innerHistogramMat, float &usedInnerPoints, CvMatND* outerHistogramMat, float &usedOuterPoints);
-bool calculateLikelihood(CvMatND* templateHistogramMat, CvMatND* innerHistogramMat, CvMatND* outerHistogramMat, float inside_outside, float &likelihood);
-bool place3dPointsPerspective(CvMat* points, float x, float y, float z);
-int perspective_projection(CvMat* xyz, float fx, float fy, float cx, float cy, CvMat* uv);
 void drawContourPerspectiveYARP(CvMat* model3dPointsMat,float x, float y, float z, yarp::sig::ImageOf<yarp::sig::PixelRgb> *image,float _perspectiveFx,float  _perspectiveFy ,float _perspectiveCx,float  _perspectiveCy ,int R, int G, int B, float &meanU, float &meanV);
 void drawSampledLinesPerspectiveYARP(CvMat* model3dPointsMat,float x, float y, float z, yarp::sig::ImageOf<yarp::sig::PixelRgb> *image,float _perspectiveFx,float  _perspectiveFy ,float _perspectiveCx,float  _perspectiveCy ,int R, int G, int B, float &meanU, float &meanV);
-bool evaluateHypothesisPerspective(CvMat* model3dPointsMat, float x, float y, float z, CvMatND* modelHistogramMat, IplImage* transformedImage, float fx, float fy, float u0, float v0, float, float &likelihood);
-
-//////////////////////////////////////////////
-//MEMBERS THAT SHOULD BE CHANGED AND CHECKED:/
-//////////////////////////////////////////////
-bool evaluateHypothesisPerspectiveFromRgbImage(CvMat* model3dPoints,float x, float y, float z, CvMatND* modelHistogramMat, IplImage *image,  float fx, float fy, float u0, float v0, float inside_outside, float &likelihood);
-
-bool systematicR(CvMat* inState, CvMat* weights, CvMat* outState);
-bool systematic_resampling(CvMat* oldParticlesState, CvMat* oldParticlesWeights, CvMat* newParticlesState, CvMat* cumWeight);
+void acquireImage(yarp::sig::ImageOf<yarp::sig::PixelRgb> &image, IplImage *rawImage);
+void allocateFrameSlot(FrameSlot &frame, int width, int height);
+void releaseFrameSlot(FrameSlot &frame);
+void prepareFrame(FrameSlot &frame, yarp::sig::ImageOf<yarp::sig::PixelRgb> &image, const yarp::os::Stamp &stamp);
+void useFrame(int slot);
+void captureLoop();
+void transformImage();
+bool acquireRightImage();
+//the right images the filter weighs the particles with: NULL when they are out of sync with the left one.
+IplImage* rightRawImage() const { return _rightImageInSync ? _rawImageRight : NULL; }
+IplImage* rightTransformedImage() const { return _rightImageInSync ? _transformedImageRight : NULL; }
+float framePeriods();
+void resumeAdaptedTemplate(ParticleFilter &filter, const std::string &fileName);
+bool loadColorTemplate(ParticleFilter &filter, const std::string &colorTemplate, const std::string &dataFileName);
+bool addTarget(const std::string &colorTemplate, const std::string &dataFileName, const std::string &shapeTemplate, const std::string &motionModelMatrix);
+void trackTarget(TrackedTarget &target);
+yarp::sig::PixelRgb drawingColour(int R, int G, int B);
+void writeStats(yarp::os::Bottle &bottle);
 
 public:
 
@@ -217,6 +253,7 @@ virtual bool close();                  //member to close the object.
 virtual bool interruptModule();        //member to close the object.
 virtual bool updateModule();           //member that is repeatedly called by YARP, to give this object a chance to do something.
 virtual double getPeriod();
+virtual bool respond(const yarp::os::Bottle &command, yarp::os::Bottle &reply); //member that answers the rpc commands.
 
 };
 
@@ -0,0 +1,61 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERCACHE_
+#define _PF3DTRACKERCACHE_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <iCub/pf3dTrackerSupport.hpp>
+
+//the cache files start with an 8 character magic and a version: a file written by another version is
+//computed again. bump the version when the bins or the histograms are computed differently.
+#define LutCacheMagic "pf3dlut1"
+#define HistogramCacheMagic "pf3dhis1"
+#define CacheVersion 1
+
+//a file mapped in memory, read only. where mapping is not available (Windows) it is read in a buffer.
+class MappedFile
+{
+public:
+
+MappedFile();
+~MappedFile();
+
+bool open(const std::string &fileName); //true on success.
+void close();
+bool isOpen() const { return _data!=NULL; }
+const unsigned char* data() const { return _data; }
+size_t size() const { return _size; }
+
+private:
+
+MappedFile(const MappedFile&);            //not copyable
+MappedFile& operator=(const MappedFile&); //not copyable
+
+const unsigned char* _data;
+size_t _size;
+bool _mapped; //_data is a mapping, not a buffer.
+};
+
+//the look up table of the given type, mapped from its cache file in directory. when the file is missing,
+//was written by another version or doesn't give the bins of this build, the table is computed and the file
+//written again. an empty directory disables the cache. true on success, like createLut().
+//release the table with releaseCachedLut().
+bool createCachedLut(Lut *lut, int type, const std::string &directory, MappedFile &file);
+void releaseCachedLut(Lut *lut, MappedFile &file);
+
+//the key of the template histogram of a colour template: a checksum of the bytes of the image file, of the bins
+//of the histogram, of the look up table that bins it and of the colour order. 0 if the image can't be read.
+unsigned long long histogramCacheKey(const std::string &imageFileName, int yBins, int uBins, int vBins, int lutType, bool rgbImages);
+
+//the template histogram with the given key, nValues values in the order of the csv files.
+//these return true on failure, like the loaders: a missing entry is a failure.
+bool readCachedHistogram(const std::string &directory, unsigned long long key, int nValues, std::vector<float> &values);
+bool writeCachedHistogram(const std::string &directory, unsigned long long key, const std::vector<float> &values);
+
+#endif /* _PF3DTRACKERCACHE_ */
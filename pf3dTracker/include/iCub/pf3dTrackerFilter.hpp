@@ -0,0 +1,285 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERFILTER_
+#define _PF3DTRACKERFILTER_
+
+#include <string>
+#include <vector>
+
+#ifdef _CH_
+#pragma package <opencv>
+#endif
+#ifndef _EiC
+#include <opencv2/opencv.hpp>
+#include <opencv2/core/types_c.h>
+#endif
+
+#include <iCub/pf3dTrackerSupport.hpp>
+#include <iCub/pf3dTrackerParticles.hpp>
+#include <iCub/pf3dTrackerKernels.hpp>
+#include <iCub/pf3dTrackerWorkers.hpp>
+#include <iCub/pf3dTrackerResampling.hpp>
+
+//KLD-sampling: upper 1-delta quantile of the standard normal distribution, delta=0.01.
+#define kldQuantile 2.326
+
+//the motion model moves the particles by at most this many frame periods, see applyMotionModel().
+#define maxFramePeriods 10
+
+//adaptive template: the template follows the inner histograms of at most this many particles, see adaptTemplate().
+#define adaptationParticles 5
+
+//should be 1.5 or 1.0 !!! ???
+//#define inside_outside_difference_weight 1.5
+//if I set it to 1.5, when the ball goes towards the camera, the tracker lags behind.
+//this happens because the particles with "ball color" on both sides of the contour
+//are still quite likely. the opposite is not true: when the ball goes away from the
+// camera, the tracker follows it quite readily.
+
+//scratch memory used while evaluating one hypothesis.
+//each worker thread owns one of these, so that hypotheses can be evaluated in parallel.
+struct HypothesisWorkspace
+{
+    float* u; //projected contours of a batch of particles, ProjectionBatch rows of _uvStride elements.
+    float* v;
+    unsigned char* colours; //colours sampled along the contours, three planes (R, G, B) of _uvStride elements.
+    unsigned char* bins;    //their YUV bins, first the ones of the inner contour, then the ones of the outer contour.
+    int usedPoints;         //number of bins.
+    float* innerHistogram;  //bin counts, HistogramBins elements. they are emptied after each hypothesis.
+    float* outerHistogram;
+    unsigned char* hitBins; //the bins hit by the inner contour.
+    int nHitBins;
+    float* hitCounts;       //inner counts, outer counts and sqrt of the template of the hit bins, three rows of _uvStride elements.
+
+    //adaptive template, see setTemplateAdaptation(). the inner histograms of the batch being evaluated, kept
+    //sparse as calculateLikelihood() builds them: 2*ProjectionBatch rows (first camera, then second camera)
+    //of _uvStride bins and counts.
+    int keepRow;            //the row the current hypothesis is kept in, -1: not kept.
+    unsigned char* keptBins;
+    float* keptCounts;
+    int nKeptBins[2*ProjectionBatch];
+    //the best particles this worker has weighted, sorted by likelihood, with their normalized inner histograms.
+    int nCandidates;
+    int candidateIndex[adaptationParticles];
+    float candidateWeight[adaptationParticles];
+    int candidateRow[adaptationParticles];  //rows of candidateHistograms.
+    float* candidateHistograms;             //adaptationParticles rows of HistogramBins elements.
+};
+
+//the core of the tracker: the particles, the colour and shape models, the likelihood, the
+//resampling and the motion model. it knows nothing about ports, so it can be driven by the
+//module as well as by an offline replay of recorded frames.
+//the look up table and the worker pool belong to the caller, that can share them.
+class ParticleFilter
+{
+public:
+
+ParticleFilter();
+~ParticleFilter();
+
+//the points on each contour of the shape model and the colour bins of the histograms, at most
+//YBins x UBins x VBins. call it before allocate(). true on failure, like the loaders.
+bool setResolution(int nPixels, int yBins, int uBins, int vBins);
+
+//allocate the particles, the models and one workspace per worker. true on success.
+bool allocate(int nParticles, const Lut *lut, WorkerPool *workers);
+void release();
+
+//the models. these return true on failure, like the rest of the tracker.
+bool computeTemplateHistogram(std::string imageFileName, std::string dataFileName, bool rgbImages); //rgbImages: the tracked images are RGB, not BGR.
+bool readModelHistogram(const char fileName[]);
+//the template histogram as yBins*uBins*vBins values, in the order of the csv files.
+void modelHistogram(std::vector<float> &values) const;
+bool setModelHistogram(const std::vector<float> &values);
+bool writeModelHistogram(const char fileName[]) const; //the csv file of readModelHistogram().
+bool readInitialmodel3dPoints(CvMat* points, std::string fileName);
+bool readModel3dPoints(std::string fileName); //it also tells if the model is a sphere, see setSphereFastPath().
+bool readMotionModelMatrix(std::string fileName); //the transition over one frame period, with the velocity in mm per period.
+
+void setCamera(float fx, float fy, float cx, float cy);
+//stereo: the particles are seen by a second camera too, with intrinsics fx, fy, cx, cy. a point p of the
+//frame of the first camera is rotation*p+translation in the frame of the second one (rotation is row major,
+//translation in millimeters). the likelihood of a particle is the product of the ones in the two images.
+void setSecondCamera(float fx, float fy, float cx, float cy, const double rotation[9], const double translation[3]);
+bool stereo() const { return _stereo; }
+void setColorTransfPolicy(int policy) { _colorTransfPolicy=policy; }
+void setInsideOutsideWeight(float weight) { _inside_outside_difference_weight=weight; }
+void setAccelStDev(float stDev) { _accelStDev=stDev; }
+void setInitialPosition(double x, double y, double z); //millimeters.
+//coarse to fine evaluation: the particles are scored with about coarsePixels points per contour first,
+//then the best fineFraction of them with all the nPixels points. coarsePixels 0 or fineFraction 1 disable it.
+void setCoarseToFine(int coarsePixels, float fineFraction);
+//0: each particle builds the colour histograms of its contours (the default). 1: the score of each pixel, the
+//probability that its colour belongs to the template rather than to the region around the particles, is
+//computed once per image, then each particle only averages the scores along its contours.
+void setScoringMode(int mode) { _scoringMode=mode; }
+//when the shape model is a sphere, two concentric circles with their points at the same angles (see
+//generate_shape_model.py), its contours are projected from tables of the unit circle instead of the 3D points.
+void setSphereFastPath(bool enabled) { _sphereFastPath=enabled; }
+//adaptive template: evaluate() keeps the inner histograms the best particles were weighted with, at most
+//adaptationParticles of them with a normalized likelihood above gate, and adaptTemplate() blends them in the
+//template. rate 0 disables it. scoring mode 1 builds no histograms: there the template stays fixed.
+void setTemplateAdaptation(float rate, float gate);
+bool sphereModel() const { return _sphereModel; } //the shape model is a sphere.
+void setSeed(unsigned long long seed); //the same seed gives the same particles, whatever the number of workers.
+void setResamplingScheme(Resampler::Scheme scheme) { _resamplingScheme=scheme; }
+//the camera, the colour transformation policy, the scoring mode, the template adaptation, the likelihood and motion
+//parameters and the initial position of another filter: the filters of several objects tracked on the same images share them.
+void copyParameters(const ParticleFilter &other);
+
+//KLD-sampling: the resampling picks between minParticles and the allocated particles, so that the
+//KL distance between the particles and the posterior stays under kldError, counting the particles
+//in the cubes of a 3D grid of side kldBinSize [mm]. minParticles equal to the allocated particles disables it.
+void setAdaptive(int minParticles, float kldError, float kldBinSize);
+
+int nPixels() const { return _nPixels; }
+int nParticles() const { return _nParticles; } //the particles in use, the allocated ones without KLD-sampling.
+ParticleSet& particles() { return _particles; }
+CvMat* model3dPoints() { return _model3dPointsMat; }
+
+//one cycle of the filter, in this order.
+//the likelihood of each particle, written in its weight. rawImage is used with colorTransfPolicy 1,
+//transformedImage, the YUV bin of each pixel, with colorTransfPolicy 0. the images of the second
+//camera are only used in stereo, see setSecondCamera(): when they are NULL the particles are weighted
+//with the first camera only, on the same scale.
+void evaluate(IplImage *rawImage, IplImage *transformedImage, float &sumLikelihood, float &maxLikelihood, int &maxIndex,
+              IplImage *secondRawImage=NULL, IplImage *secondTransformedImage=NULL);
+void mean(float &x, float &y, float &z) const;                                  //right after initializeParticles().
+void weightedMean(float sumLikelihood, float &x, float &y, float &z);           //normalizes the weights too.
+void resample(int nParticlesReceived, bool grow); //the last nParticlesReceived are left to the caller (see the particles:i port). grow: use all the particles.
+void grow();                                       //use all the particles again, when there is no resampling.
+void applyMotionModel(float periods=1); //move the particles by periods frame periods, see readMotionModelMatrix().
+void initializeParticles();
+
+//adaptive template: blend the inner histograms kept by the last evaluate() in the template, weighted by the
+//likelihoods of their particles: template=(1-rate)*template+rate*histogram. with coarse to fine only the refined
+//particles are kept, in stereo the histograms of the two cameras are averaged. call it before resample().
+void adaptTemplate();
+
+//fill transformedImage with the YUV bin of each pixel of rawImage, the rows are split among the workers.
+void transformImage(IplImage *rawImage, IplImage *transformedImage);
+
+//the same, restricted to the rectangle the contours of the current particles can fall in: call it right
+//before evaluate(), the pixels outside keep stale bins. the whole image is transformed after initializeParticles().
+void transformImageAroundParticles(IplImage *rawImage, IplImage *transformedImage);
+
+//the score image of the last evaluate() of the given camera (0 or 1) with scoring mode 1, NULL before:
+//the score of each pixel in [0,255], valid in the region around the particles.
+const IplImage* scoreImage(int camera) const { return _scoreImages[camera]; }
+
+//the contour of a model placed in (x,y,z), 2*nPixels() points, valid until the next call.
+//it uses the workspace of the first worker, so it can't run together with evaluate().
+void projectContour(CvMat* model3dPointsMat, float x, float y, float z, const float* &u, const float* &v);
+
+private:
+
+ParticleFilter(const ParticleFilter&);            //not copyable
+ParticleFilter& operator=(const ParticleFilter&); //not copyable
+
+bool allocateWorkspace(HypothesisWorkspace &workspace);
+void releaseWorkspace(HypothesisWorkspace &workspace);
+void evaluateParticles(const int* indices, int begin, int end, IplImage *image, IplImage *secondImage, int step, bool keep, HypothesisWorkspace &workspace); //indices NULL: the particles [begin,end).
+void keepCandidates(const int* batchIndex, int n, bool stereo, HypothesisWorkspace &workspace); //keep: see setTemplateAdaptation().
+void projectContours(CvMat* model3dPointsMat, const float* x, const float* y, const float* z, int n, HypothesisWorkspace &workspace);
+void projectContours(CvMat* model3dPointsMat, const float* x, const float* y, const float* z, int n, const float camera[4], HypothesisWorkspace &workspace); //camera: fx, fy, cx, cy.
+//the likelihood of one hypothesis. NPixels is the number of contour points, 0 for any number,
+//RemapBins tells if the bins of the look up table have to be mapped to coarser ones.
+typedef bool (ParticleFilter::*HypothesisEvaluator)(const float* u, const float* v, IplImage* image, int step, float &likelihood, HypothesisWorkspace &workspace);
+HypothesisEvaluator hypothesisEvaluator() const; //the instance for the current resolution and colour transformation policy.
+template<int NPixels> HypothesisEvaluator evaluatorFor() const;
+template<int NPixels, bool RemapBins>
+bool evaluateHypothesisPerspective(const float* u, const float* v, IplImage* transformedImage, int step, float &likelihood, HypothesisWorkspace &workspace);
+template<int NPixels, bool RemapBins>
+bool evaluateHypothesisPerspectiveFromRgbImage(const float* u, const float* v, IplImage *image, int step, float &likelihood, HypothesisWorkspace &workspace);
+template<int NPixels>
+bool evaluateHypothesisScore(const float* u, const float* v, IplImage* scoreImage, int step, float &likelihood, HypothesisWorkspace &workspace);
+template<int NPixels, bool RemapBins>
+bool computeHistogram(const float* contourU, const float* contourV, IplImage* transformedImage, int step, float &usedInnerPoints, float &usedOuterPoints, HypothesisWorkspace &workspace);
+template<int NPixels, bool RemapBins>
+bool computeHistogramFromRgbImage(const float* contourU, const float* contourV, IplImage *image, int step, float &usedInnerPoints, float &usedOuterPoints, HypothesisWorkspace &workspace);
+void accumulateHistograms(int usedInnerPoints, int usedPoints, HypothesisWorkspace &workspace);
+bool calculateLikelihood(float usedInnerPoints, float usedOuterPoints, float &likelihood, HypothesisWorkspace &workspace);
+int kldParticles();
+void buildScoreImage(IplImage *rawImage, IplImage *transformedImage, int camera); //scoring mode 1.
+bool contourBounds(int width, int height, int &u0, int &v0, int &u1, int &v1); //false if a particle is too close to the camera.
+
+const Lut* _lut;
+WorkerPool* _workers;
+unsigned long long _seed; //key of the random numbers.
+unsigned int _draw;       //number of draws so far, part of the counter of the random numbers.
+
+int _nParticles;    //in use.
+int _maxParticles;  //allocated.
+int _minParticles;
+float _kldError;
+float _kldBinSize;
+float _accelStDev;
+float _inside_outside_difference_weight;
+int _colorTransfPolicy; //0: transform the whole image, 1: only the pixels that are needed.
+int _nPixels;           //points on each contour.
+int _yBins;             //bins of the histograms.
+int _uBins;
+int _vBins;
+bool _remapBins;        //the bins are coarser than the ones of the look up table.
+unsigned char _binMap[HistogramBins]; //from the bins of the look up table to the ones of the histograms.
+float _perspectiveFx;
+float _perspectiveFy;
+float _perspectiveCx;
+float _perspectiveCy;
+bool _stereo;
+float _secondCamera[4];          //fx, fy, cx, cy of the second camera.
+float _secondRotation[9];        //from the frame of the first camera to the one of the second camera.
+float _secondTranslation[3];     //[mm].
+double _initialX;
+double _initialY;
+double _initialZ;
+
+CvMat* _A;
+CvMatND* _modelHistogramMat; //OpenCV Matrix
+float* _sqrtModelHistogram;  //square root of the template histogram, HistogramBins elements.
+CvMat* _model3dPointsMat;    //shape model
+
+//coarse to fine evaluation.
+int _coarseStep;                      //one contour point every _coarseStep in the first stage.
+float _fineFraction;                  //fraction of the particles scored again with all the points.
+std::vector<float> _coarseLikelihood; //scratch copy of the coarse likelihoods, to find the threshold.
+std::vector<int> _fineIndices;        //the particles of the second stage.
+
+bool _wholeImage; //the next transformImageAroundParticles() transforms the whole image.
+
+//the sphere fast path.
+bool _sphereFastPath;
+bool _sphereModel;                    //the shape model is a sphere, described by the following.
+std::vector<float> _circleCos;        //the angles of the points of the unit circle, _nPixels each.
+std::vector<float> _circleSin;
+float _innerRadius;                   //[mm].
+float _outerRadius;
+
+float _adaptationRate; //adaptive template, see setTemplateAdaptation().
+float _adaptationGate; //the likelihood a particle needs to be kept, not normalized.
+
+//scoring mode 1.
+int _scoringMode;
+IplImage* _scoreImages[2];                //the score of each pixel, one image per camera.
+unsigned char _scoreTable[HistogramBins]; //from the bins of the look up table to the scores.
+std::vector<float> _regionCounts;         //bin counts of the region around the particles, one histogram per worker.
+
+//one workspace per worker thread.
+std::vector<HypothesisWorkspace> _workspaces;
+int _uvStride; //2*_nPixels, rounded up to keep the rows of the projected contours aligned.
+
+//resampling-related stuff
+Resampler _resampler;
+Resampler::Scheme _resamplingScheme;
+float* _uniforms; //offsets of the points of the resampling.
+std::vector<long long> _kldKeys; //grid cells of the particles picked by the resampling.
+
+//variables
+ParticleSet _particles;    //the current particles.
+ParticleSet _newParticles; //the other buffer: resampling and the motion model write here, then the two are swapped.
+};
+
+#endif /* _PF3DTRACKERFILTER_ */
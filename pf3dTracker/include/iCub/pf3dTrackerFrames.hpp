@@ -0,0 +1,48 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERFRAMES_
+#define _PF3DTRACKERFRAMES_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+//hands frames over from the capture stage to the filter through a fixed pool of slots.
+//the queue only moves slot indices around: the slots themselves are owned by the caller.
+//with a pool of capacity+2 slots the capture stage never waits: one slot is being processed,
+//capacity are ready and one is being filled. when the ready queue is full the oldest frame is
+//dropped, so the filter always gets the most recent frames.
+class FrameQueue
+{
+public:
+
+FrameQueue();
+
+void reset(int nSlots, int capacity); //all the slots are free.
+void stop();                          //wake up everybody, acquire() and pop() return -1 from now on.
+void close();                         //no more frames: pop() returns the ready ones, then -1.
+
+int acquire();         //a free slot, to be filled.
+void push(int slot);   //the slot is ready. the oldest ready slot is freed if the queue is full.
+int pop();             //the oldest ready slot, waits until there is one.
+void release(int slot);//the slot has been processed, it is free again.
+
+int dropped() const;   //number of frames dropped since reset().
+
+private:
+
+mutable std::mutex _mutex;
+std::condition_variable _changed;
+std::deque<int> _ready;
+std::vector<int> _free;
+int _capacity;
+int _dropped;
+bool _stopped;
+bool _closed;
+};
+
+#endif /* _PF3DTRACKERFRAMES_ */
@@ -0,0 +1,45 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERKERNELS_
+#define _PF3DTRACKERKERNELS_
+
+//number of particles whose contours are projected in one call of projectModelPoints().
+#define ProjectionBatch 16
+
+//place the 3D model points (three rows of nPoints coordinates, the model is centred in the origin
+//and lies in the X=0 plane) in front of the camera at each of the nCentres particle centres,
+//so that the model faces the camera, and project them with a perspective camera.
+//this is place3dPointsPerspective() followed by perspective_projection() in closed form:
+//the two rotations collapse in a single 3x3 matrix whose translation is the centre itself.
+//the contour of centre k is written to u[k*stride+i], v[k*stride+i].
+//built with AVX2 the points are processed 8 at a time, otherwise a scalar loop is used.
+//50, 100 and 200 points (the two contours of 25, 50 and 100 points each) have instances with fixed loop lengths.
+void projectModelPoints(const float* modelX, const float* modelY, const float* modelZ, int nPoints,
+                        const float* x, const float* y, const float* z, int nCentres,
+                        float fx, float fy, float cx, float cy,
+                        float* u, float* v, int stride);
+
+//the same for a sphere model: two concentric circles of radius innerRadius and outerRadius, whose nPoints
+//points each lie at the same angles, (0, cosTable[i], sinTable[i]) on the unit circle. the placement is
+//computed once per angle for both circles, and each point needs one reciprocal instead of two divisions.
+//the inner contour of centre k is written to u[k*stride+i], the outer one to u[k*stride+nPoints+i].
+//25, 50 and 100 points have instances with fixed loop lengths.
+void projectSphereContours(const float* cosTable, const float* sinTable, int nPoints, float innerRadius, float outerRadius,
+                           const float* x, const float* y, const float* z, int nCentres,
+                           float fx, float fy, float cx, float cy,
+                           float* u, float* v, int stride);
+
+//the colour part of the likelihood, restricted to the n bins hit by the inner contour:
+//sum over i of sqrt(inner[i])*(innerScale*sqrtTemplate[i] - outerScale*sqrt(outer[i])),
+//where inner and outer are bin counts and sqrtTemplate the square root of the normalized template.
+//with innerScale=1/sqrt(innerPoints) and outerScale=weight/sqrt(innerPoints*outerPoints) this is
+//the Bhattacharyya coefficient of the inner and template histograms minus weight times the one of the
+//inner and outer histograms: the bins not hit by the inner contour contribute nothing to either.
+//built with SSE2 or AVX2 the bins are processed 4 or 8 at a time.
+float histogramScore(const float* inner, const float* outer, const float* sqrtTemplate, int n,
+                     float innerScale, float outerScale);
+
+#endif /* _PF3DTRACKERKERNELS_ */
@@ -0,0 +1,33 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERPARTICLEMESSAGE_
+#define _PF3DTRACKERPARTICLEMESSAGE_
+
+#include <vector>
+
+#include <yarp/os/Bottle.h>
+
+#include <iCub/pf3dTrackerParticles.hpp>
+
+//the particle clouds of the particles:o and particles:i ports, in binary form: a Bottle with the tag
+//ParticleMessageTag, the number of particles n, the number of rows r, the decimation d (one particle
+//every d was sent) and a blob of r*n floats, one row after the other: all the X, then all the Y...
+//the rows are the ones of ParticleSet (X Y Z VX VY VZ W) [mm, mm/frame], the floats are in the byte
+//order of the sender. a message with the particles to inject needs at least the rows X, Y and Z.
+#define ParticleMessageTag "pf3dParticles"
+
+//the particles [0,n) of particles, one every decimation, all the rows. buffer is scratch memory.
+void writeParticleMessage(yarp::os::Bottle &message, const ParticleSet &particles, int n, int decimation,
+                          std::vector<float> &buffer);
+
+//the number of particles in a message, or -1 if it is malformed. the old text messages of
+//pf3dBottomup, n followed by X Y Z of each particle [mm], are understood too.
+int particleMessageSize(const yarp::os::Bottle &message);
+
+//copy the positions of the first n particles of a message to x, y and z. n must not exceed particleMessageSize().
+void readParticleMessage(const yarp::os::Bottle &message, int n, float* x, float* y, float* z);
+
+#endif /* _PF3DTRACKERPARTICLEMESSAGE_ */
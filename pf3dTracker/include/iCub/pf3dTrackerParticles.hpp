@@ -0,0 +1,47 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERPARTICLES_
+#define _PF3DTRACKERPARTICLES_
+
+//particle set stored as a structure of arrays.
+//each component (x, y, z, vx, vy, vz, weight) is a contiguous float array starting on a
+//64-byte boundary, so that the per-particle passes of the filter are plain streaming loops.
+//the tracker keeps two sets and swaps them after resampling and after applying the motion model.
+class ParticleSet
+{
+public:
+
+enum Row { X=0, Y, Z, VX, VY, VZ, W, NRows };
+
+ParticleSet();
+~ParticleSet();
+
+bool allocate(int capacity);
+void release();
+
+int capacity() const { return _capacity; }
+int size() const     { return _size; }
+void setSize(int size);
+
+float* row(int r)             { return _data+r*_stride; }
+const float* row(int r) const { return _data+r*_stride; }
+
+void setZero();
+void copyFrom(const ParticleSet &other);
+void swap(ParticleSet &other);
+
+private:
+
+ParticleSet(const ParticleSet&);            //not copyable
+ParticleSet& operator=(const ParticleSet&); //not copyable
+
+float* _data;
+int _capacity;
+int _size;
+int _stride; //number of floats between two rows, multiple of 16 to keep every row aligned.
+};
+
+#endif /* _PF3DTRACKERPARTICLES_ */
@@ -0,0 +1,36 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERRANDOM_
+#define _PF3DTRACKERRANDOM_
+
+//Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3", 2011), a counter-based
+//generator: each block of four 32 bit numbers is a function of a 64 bit key and a 128 bit counter only.
+//the tracker keys it with its seed and builds the counter from the index of the particle, the stream
+//(what is drawn: the noise on one axis, the offsets of the resampling...) and the number of the draw,
+//so the numbers don't depend on the order the particles are processed in, nor on the number of threads.
+//element i of a stream comes from the block of counter {i/4, stream, draw, 0}.
+
+//number of blocks generated together: the rounds are written lane by lane, so that they vectorize.
+#define PhiloxLanes 8
+
+//the blocks of counters {first+lane, stream, draw, 0}, lane=0..PhiloxLanes-1: out[k][lane] is word k of block lane.
+void philox4x32(unsigned long long key, unsigned int first, unsigned int stream, unsigned int draw,
+                unsigned int out[4][PhiloxLanes]);
+
+//uniform numbers in [0,1) for the elements [begin,end) of a stream, written to out[begin..end-1].
+void randomUniform(unsigned long long key, unsigned int stream, unsigned int draw, int begin, int end, float* out);
+
+//normal numbers (Box-Muller) for the elements [begin,end) of a stream, written to out[begin..end-1].
+void randomNormal(unsigned long long key, unsigned int stream, unsigned int draw, int begin, int end,
+                  float mean, float stDev, float* out);
+
+//the acceleration noise of the motion model for the particles [begin,end), drawn and applied in one pass:
+//a normal acceleration of standard deviation stDev on each axis, from the streams firstStream+axis, acts
+//for the given number of frame periods: periods times it is added to the velocity, periods^2/2 times to the position.
+void addAccelerationNoise(unsigned long long key, unsigned int firstStream, unsigned int draw, int begin, int end,
+                          float stDev, float periods, float* const position[3], float* const velocity[3]);
+
+#endif /* _PF3DTRACKERRANDOM_ */
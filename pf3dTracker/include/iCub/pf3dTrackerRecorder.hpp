@@ -0,0 +1,75 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERRECORDER_
+#define _PF3DTRACKERRECORDER_
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+#include <iCub/pf3dTrackerFrames.hpp>
+
+//the raw container of the recorder: the 8 characters RawFramesMagic, then one record per frame:
+//frame number, width, height and a zero (int32), the timestamp (float64) and the BGR pixels,
+//row after row without padding. the numbers are in the byte order of the writer.
+#define RawFramesMagic "pf3draw1"
+
+//writes the images of the tracker to disk from a thread of its own, so that the tracking loop only
+//pays for one copy of each image. the images wait in a queue of fixed length: when the disk can't
+//keep up the oldest one is dropped, the tracker never waits.
+class ImageRecorder
+{
+public:
+
+//Raw: all the frames in one file, prefix+"frames.pf3draw", lossless and fast to write, see readRawFrames().
+//Png, Jpeg: one file per frame, prefix+frame number.
+enum Encoding { Raw=0, Png, Jpeg };
+
+ImageRecorder();
+~ImageRecorder();
+
+//start the writer thread. queueLength images can wait to be written. true on success.
+bool start(const std::string &prefix, Encoding encoding, int jpegQuality, int queueLength);
+void stop(); //write the images still in the queue, then stop the thread.
+
+//copy an image to the queue. rgb: the image is RGB, not BGR.
+void push(const cv::Mat &image, bool rgb, int frameNumber, double timestamp);
+
+int dropped() const { return _queue.dropped(); } //images not written since start().
+
+private:
+
+ImageRecorder(const ImageRecorder&);            //not copyable
+ImageRecorder& operator=(const ImageRecorder&); //not copyable
+
+struct Slot
+{
+    cv::Mat image;
+    bool rgb;
+    int frameNumber;
+    double timestamp;
+};
+
+void writeLoop();
+void write(Slot &slot);
+
+std::string _prefix;
+Encoding _encoding;
+int _jpegQuality;
+FILE* _rawFile;
+std::vector<Slot> _slots;
+FrameQueue _queue;
+std::thread _thread;
+};
+
+//read all the frames of a raw container, BGR. false if the file can't be read, is not a raw container or
+//is truncated: the frames before the error are kept.
+bool readRawFrames(const std::string &fileName, std::vector<cv::Mat> &frames, std::vector<double> &timestamps);
+
+#endif /* _PF3DTRACKERRECORDER_ */
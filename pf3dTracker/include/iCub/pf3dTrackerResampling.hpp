@@ -0,0 +1,62 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERRESAMPLING_
+#define _PF3DTRACKERRESAMPLING_
+
+#include <vector>
+
+#include <iCub/pf3dTrackerParticles.hpp>
+#include <iCub/pf3dTrackerWorkers.hpp>
+
+//particles per block of the parallel prefix sum of the weights.
+#define ResamplingBlock 1024
+
+//resampling in three passes: the cumulative weights, the index of the ancestor of each new
+//particle, then one gather per state row. each pass is split among the workers, and its result
+//doesn't depend on their number: the prefix sum works on blocks of ResamplingBlock particles,
+//the ancestors of the new particles are found independently of each other.
+//the weights don't need to be normalized.
+class Resampler
+{
+public:
+
+enum Scheme { Systematic=0, Stratified, Residual };
+
+Resampler();
+~Resampler();
+
+bool allocate(int capacity); //true on success.
+void release();
+
+//fill ancestors() with the ancestors of nNew particles drawn from the n particles of weight weight.
+//uniforms are values in [0,1): nNew of them with Stratified, one with the other schemes.
+void resample(Scheme scheme, const float* weight, int n, int nNew, const float* uniforms, WorkerPool &workers);
+
+//newParticles[j]=oldParticles[ancestors()[j]] for the first nNew new particles, their weights are set to zero.
+void gather(const ParticleSet &oldParticles, ParticleSet &newParticles, int nNew, WorkerPool &workers) const;
+
+const int* ancestors() const { return _ancestors; }
+
+private:
+
+Resampler(const Resampler&);            //not copyable
+Resampler& operator=(const Resampler&); //not copyable
+
+//cumWeight[i]=weight[0]+...+weight[i]. returns the sum of the weights.
+float cumulate(const float* weight, int n, WorkerPool &workers);
+
+//nNew ancestors from the cumulative weights of n particles: the point (j+offset)*sum/nNew picks the
+//first particle whose cumulative weight reaches it. the offsets are uniforms[j], or uniforms[0] for all.
+void draw(int n, int nNew, const float* uniforms, bool stratified, int* ancestors, WorkerPool &workers);
+
+float* _cumWeight;
+float* _residual; //residual weights of the Residual scheme.
+int* _ancestors;
+std::vector<float> _blockSums;
+int _capacity;
+};
+
+#endif /* _PF3DTRACKERRESAMPLING_ */
@@ -0,0 +1,46 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERSTATS_
+#define _PF3DTRACKERSTATS_
+
+#include <mutex>
+#include <vector>
+
+#include <yarp/os/Bottle.h>
+
+//rolling latency statistics of the stages of one tracker cycle.
+//each stage keeps the last window durations in a ring buffer, so adding a sample costs a store.
+//the percentiles are only computed when they are asked for. the samples can be added and the
+//statistics read from different threads (the capture stage and the rpc port, for instance).
+class StageStats
+{
+public:
+
+enum Stage{Acquire,ColourTransform,Likelihood,Resample,MotionModel,Drawing,Publish,Cycle,NStages};
+
+StageStats(int window=500);
+
+void add(Stage stage, double seconds);
+void reset();
+
+//false if the stage has no samples yet. the percentiles are in seconds.
+bool percentiles(Stage stage, double &p50, double &p95, double &p99, int &samples) const;
+
+//one list per stage: (name samples p50 p95 p99), the percentiles in milliseconds.
+void write(yarp::os::Bottle &bottle) const;
+
+static const char* name(int stage);
+
+private:
+
+mutable std::mutex _mutex;
+std::vector<double> _samples[NStages];
+int _next[NStages];
+int _count[NStages];
+int _window;
+};
+
+#endif /* _PF3DTRACKERSTATS_ */
@@ -25,22 +25,65 @@
 #include <opencv2/core/types_c.h>
 #endif
 
+//the colour space is divided in 4x8x8 YUV bins.
+//a bin is identified by a single byte: YBin*64+UBin*8+VBin.
+#define binIndex(YBin,UBin,VBin) (((YBin)<<6)|((UBin)<<3)|(VBin))
+#define binY(index) ((index)>>6)
+#define binU(index) (((index)>>3)&7)
+#define binV(index) ((index)&7)
+
+//the finest colour bins, the ones of the look up table. the histograms of the filter can use coarser ones,
+//see ParticleFilter::setResolution().
+#define YBins 4
+#define UBins 8
+#define VBins 8
+#define HistogramBins (YBins*UBins*VBins) //the bins are indexed with binIndex().
+
+//ways of mapping an RGB triplet to its bin.
+#define LUT_PACKED    0 //one byte for each of the 256*256*256 colours (16 MB).
+#define LUT_QUANTIZED 1 //one byte for each 5-6-5 quantized colour (64 KB, fits in the L2 cache).
+#define LUT_DIRECT    2 //no table: the bin is computed with (vectorized) arithmetic.
+
 struct Lut
 {
-    int y;
-    int u;
-    int v;
+    int type;
+    unsigned char* table;
 };
 
 void rgbToYuvBin(int &R, int &G, int &B, int &YBin, int &UBin, int &VBin);
+unsigned char rgbToBin(int R, int G, int B);
 
 void rgbToYuvBinImage(IplImage *image,IplImage *yuvBinsImage);
 
-void rgbToYuvBinMatLut(const cv::Mat& image, cv::Mat& yuvBinsImage, Lut *lut);
-void rgbToYuvBinImageLut(IplImage *image,IplImage *yuvBinsImage, Lut *lut);
+void rgbToYuvBinMatLut(const cv::Mat& image, cv::Mat& yuvBinsImage, const Lut *lut);
+void rgbToYuvBinImageLut(IplImage *image,IplImage *yuvBinsImage, const Lut *lut);
 
 void setPixel(int u, int v, int r, int g, int b, IplImage *image);
 
+bool createLut(Lut *lut, int type);
+void releaseLut(Lut *lut);
 void fillLut(Lut *lut);
 
+//the bin of one colour.
+inline unsigned char lutBin(const Lut *lut, int R, int G, int B)
+{
+    if(lut->type==LUT_PACKED)
+        return lut->table[(R<<16)|(G<<8)|B];
+    if(lut->type==LUT_QUANTIZED)
+        return lut->table[((R>>3)<<11)|((G>>2)<<5)|(B>>3)];
+    return rgbToBin(R,G,B);
+}
+
+//the bins of n colours, given as three planes.
+void lutBins(const Lut *lut, const unsigned char* R, const unsigned char* G, const unsigned char* B, int n, unsigned char* bins);
+
+//the bins of the rows [rowBegin,rowEnd) of an RGB image, written to a single channel image of bins.
+//the bins come from the given look up table, as with lutBins(), so they match the ones of the template and of
+//colorTransfPolicy 1. different row ranges can be processed in parallel.
+void rgbToBinImage(const Lut *lut, const unsigned char* image, int imageStep, int width, int rowBegin, int rowEnd, unsigned char* bins, int binsStep);
+
+//aligned allocation, used for the buffers that are streamed through in the hot loops.
+void* alignedMalloc(size_t size, size_t alignment=64);
+void alignedFree(void* ptr);
+
 #endif /* _PF3DTRACKERSUPPORT_ */
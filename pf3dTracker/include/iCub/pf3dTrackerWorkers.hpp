@@ -0,0 +1,52 @@
+/**
+* Copyright: (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*/
+
+#ifndef _PF3DTRACKERWORKERS_
+#define _PF3DTRACKERWORKERS_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//a small pool of persistent threads used to split the per-particle work of the tracker.
+//the thread calling run() takes part in the work as worker 0, so a pool of size 1 never
+//spawns a thread and behaves exactly like a plain loop.
+class WorkerPool
+{
+public:
+
+typedef std::function<void(int worker, int begin, int end)> Job;
+
+WorkerPool();
+~WorkerPool();
+
+void start(int nWorkers); //nWorkers<=0 means one worker per hardware thread.
+void stop();
+int size() const;
+
+//split [0,nItems) in size() contiguous chunks and process them in parallel.
+//returns when every chunk has been processed.
+void run(int nItems, const Job &job);
+
+private:
+
+void loop(int worker, unsigned int seenGeneration);
+void chunk(int worker, int nItems, int &begin, int &end) const;
+
+std::vector<std::thread> _threads;
+std::mutex _mutex;
+std::condition_variable _wakeUp;
+std::condition_variable _allDone;
+const Job *_job;
+int _nItems;
+int _nWorkers;
+int _pending;
+unsigned int _generation;
+bool _quit;
+};
+
+#endif /* _PF3DTRACKERWORKERS_ */
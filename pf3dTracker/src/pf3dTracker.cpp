@@ -66,10 +66,12 @@
 
 #include <cmath>
 #include <ctime>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <utility>
 
 #include <opencv2/highgui/highgui.hpp>
@@ -77,6 +79,7 @@
 
 #include <yarp/os/Log.h>
 #include <yarp/os/LogStream.h>
+#include <yarp/os/Os.h>
 #include <yarp/os/ResourceFinder.h>
 #include <yarp/cv/Cv.h>
 
@@ -87,11 +90,36 @@ using namespace yarp::os;
 using namespace yarp::sig;
 using namespace yarp::cv;
 
+//colours of the other tracked objects, the main one is white (or green).
+static const int targetColours[][3]={{255,0,255},{0,255,255},{255,128,0},{0,128,255},{128,255,0},{255,0,128}};
+static const int nTargetColours=(int)(sizeof(targetColours)/sizeof(targetColours[0]));
+
 void printMat(CvMat* A);
 
+//fileName with suffix before the extension: the files of the other tracked objects.
+static string withSuffix(const string &fileName, const string &suffix)
+{
+    string result=fileName;
+    size_t extension=result.find_last_of('.');
+    size_t directory=result.find_last_of("/\\");
+    if(extension==string::npos || (directory!=string::npos && extension<directory))
+        extension=result.size();
+    result.insert(extension,suffix);
+    return result;
+}
+
 //constructor
 PF3DTracker::PF3DTracker()
 {
+    _lut.type=LUT_DIRECT;
+    _lut.table=NULL;
+    _visualization3dPointsMat=NULL;
+    _stereo=false;
+    _yarpImageRight=NULL;
+    _rawImageRight=NULL;
+    _transformedImageRight=NULL;
+    _stereoStampTolerance=0;
+    _rightImageInSync=true;
 }
 
 //destructor
@@ -111,62 +139,12 @@ bool PF3DTracker::configure(ResourceFinder &rf)
     string trackedObjectShapeTemplate;
     string motionModelMatrix;
     string temp;
-    int row, column;
+    int row, column, count;
     double widthRatio, heightRatio;
 
     quit=false;
     _saveImagesWithOpencv=false;
-
-    _lut = new Lut[256*256*256];
-    //create the look up table lut
-    //this shouldn't be done every time
-    //TOBEDONE: write the lut on a file and read it back.
-    fillLut(_lut);
-
-    srand((unsigned int)time(0)); //make sure random numbers are really random.
-    rngState = cvRNG(rand());
-
-    //allocate some memory and initialize some data structures for colour histograms.
-    int dimensions;
-    dimensions=3;
-    int sizes[3]={YBins,UBins,VBins};
-    _modelHistogramMat=cvCreateMatND(dimensions, sizes, CV_32FC1);
-    if(_modelHistogramMat==0)
-    {
-        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for _modelHistogramMat.");
-        quit =true;
-    }
-    _innerHistogramMat=cvCreateMatND(dimensions, sizes, CV_32FC1);
-    if(_innerHistogramMat==0)
-    {
-        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for _innerHistogramMat.");
-        quit =true;
-    }
-    _outerHistogramMat=cvCreateMatND(dimensions, sizes, CV_32FC1);
-    if(_outerHistogramMat==0)
-    {
-        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for _outerHistogramMat.");
-        quit =true;
-    }
-
-    _model3dPointsMat=cvCreateMat(3, 2*nPixels, CV_32FC1);
-    if(_model3dPointsMat==0)
-    {
-        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for _model3dPointsMat.");
-        quit =true;
-    }
-    _points2Mat=cvCreateMat(3, 2*nPixels, CV_32FC1);
-    if(_points2Mat==0)
-    {
-        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for _points2Mat.");
-        quit =true;
-    }
-    _tempMat=cvCreateMat(3, 2*nPixels, CV_32FC1);
-    if(_tempMat==0)
-    {
-        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for _tempMat.");
-        quit =true;
-    }
+    _saveInputImages=false;
 
     //***********************************
     //Read options from the command line.
@@ -211,16 +189,57 @@ bool PF3DTracker::configure(ResourceFinder &rf)
                                        Value("/pf3dTracker/particles:o"),
                                        "Output particle port (string)").asString();
     _outputParticlePort.open(_outputParticlePortName);
+    _particleDecimation = botConfig.check("particleDecimation",
+                                       Value(1),
+                                       "Send one particle every particleDecimation on the output particle port (int)").asInt32();
+    if(_particleDecimation<1)
+    {
+        _particleDecimation=1;
+    }
 
     _outputAttentionPortName = botConfig.check("outputAttentionPort",
                                        Value("/pf3dTracker/attention:o"),
                                        "Output attention port (string)").asString();
     _outputAttentionPort.open(_outputAttentionPortName);
 
+    _outputStatsPortName = botConfig.check("outputStatsPort",
+                                       Value("/pf3dTracker/stats:o"),
+                                       "Output latency statistics port (string)").asString();
+    _outputStatsPort.open(_outputStatsPortName);
+
+    _outputTargetsPortName = botConfig.check("outputTargetsPort",
+                                       Value("/pf3dTracker/targets:o"),
+                                       "Output port of the other tracked objects (string)").asString();
+    _outputTargetsPort.open(_outputTargetsPortName);
+
+    _rpcPortName = botConfig.check("rpcPort",
+                                       Value("/pf3dTracker/rpc"),
+                                       "RPC port (string)").asString();
+    _rpcPort.open(_rpcPortName);
+    attach(_rpcPort);
+
     _likelihoodThreshold = (float)botConfig.check("likelihoodThreshold",
                                                   Value(1.0),
                                                   "Likelihood threshold value (double)").asFloat64();
 
+    _templateAdaptationRate = (float)botConfig.check("templateAdaptationRate",
+                                                  Value(0.0),
+                                                  "Adaptive template: weight of the inner histograms of the best particles, weighted by their likelihoods, blended in the template at each image; 0 disables it, scoringMode 1 ignores it (double)").asFloat64();
+    _templateAdaptationGate = (float)botConfig.check("templateAdaptationGate",
+                                                  Value(0.1),
+                                                  "Adaptive template: normalized likelihood a particle needs to adapt the template (double)").asFloat64();
+    _adaptedTemplateFile = botConfig.check("adaptedTemplateFile",
+                                                  Value(rf.getHomeContextPath()+"/adapted_histogram.csv"),
+                                                  "Adaptive template: the adapted template is written here on close (string)").asString();
+    _resumeAdaptedTemplate = botConfig.check("resumeAdaptedTemplate",
+                                                  Value(0),
+                                                  "Adaptive template: start from the template written by the last run (int)").asInt32()!=0;
+    if(_templateAdaptationRate<0 || _templateAdaptationRate>1)
+    {
+        yWarning("templateAdaptationRate must be in [0,1].");
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+
     _attentionOutputMax = botConfig.check("attentionOutputMax",
                                         Value(257),
                                         "attentionOutputMax (double)").asFloat64();
@@ -246,18 +265,197 @@ bool PF3DTracker::configure(ResourceFinder &rf)
                                     Value("1000"),
                                     "Number of particles used in the tracker (int)").asInt32();
 
+    _nPixels = botConfig.check("nPixels",
+                                    Value(50),
+                                    "Points on each contour of the shape model, the shape file holds 6*nPixels values (int)").asInt32();
+    _yBins = botConfig.check("yBins",
+                                    Value(YBins),
+                                    "Colour bins of the histograms along Y, at most 4 (int)").asInt32();
+    _uBins = botConfig.check("uBins",
+                                    Value(UBins),
+                                    "Colour bins of the histograms along U, at most 8 (int)").asInt32();
+    _vBins = botConfig.check("vBins",
+                                    Value(VBins),
+                                    "Colour bins of the histograms along V, at most 8 (int)").asInt32();
+
+    _minParticles = botConfig.check("minParticles",
+                                    Value(_nParticles),
+                                    "Fewest particles used by KLD-sampling, nParticles disables it (int)").asInt32();
+    _kldError = (float)botConfig.check("kldError",
+                                    Value(0.05),
+                                    "KLD-sampling: bound on the KL distance between the particles and the posterior (double)").asFloat64();
+    _kldBinSize = (float)botConfig.check("kldBinSize",
+                                    Value(20.0),
+                                    "KLD-sampling: side of the cells of the grid the particles are counted in [mm] (double)").asFloat64();
+    if(_minParticles<_nParticles && (_kldError<=0 || _kldBinSize<=0))
+    {
+        yWarning("kldError and kldBinSize must be positive.");
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+
+    temp = botConfig.check("resamplingScheme",
+                                    Value("systematic"),
+                                    "Resampling scheme: systematic, stratified or residual (string)").asString();
+    if(temp=="systematic")
+        _resamplingScheme=Resampler::Systematic;
+    else if(temp=="stratified")
+        _resamplingScheme=Resampler::Stratified;
+    else if(temp=="residual")
+        _resamplingScheme=Resampler::Residual;
+    else
+    {
+        yWarning() << "Resampling scheme "<<temp<<" is not yet implemented.";
+        _resamplingScheme=Resampler::Systematic;
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+
+    _coarsePixels = botConfig.check("coarsePixels",
+                                    Value(0),
+                                    "Coarse to fine evaluation: contour points per particle in the first stage, 0 disables it (int)").asInt32();
+    _fineFraction = (float)botConfig.check("fineFraction",
+                                    Value(0.25),
+                                    "Coarse to fine evaluation: fraction of the particles scored again with all the contour points (double)").asFloat64();
+    if(_coarsePixels<0 || _fineFraction<=0 || _fineFraction>1)
+    {
+        yWarning("coarsePixels must be positive or 0, fineFraction in (0,1].");
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+
+    _scoringMode = botConfig.check("scoringMode",
+                                    Value(0),
+                                    "Scoring of the particles: 0 colour histograms of the contours, 1 a score image computed once per image (int)").asInt32();
+    if(_scoringMode!=0 && _scoringMode!=1)
+    {
+        yWarning() << "Scoring mode "<<_scoringMode<<" is not yet implemented.";
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+    if(_scoringMode==1 && _templateAdaptationRate>0)
+    {
+        yWarning("Scoring mode 1 builds no histograms of the particles: the template is not adapted.");
+        _templateAdaptationRate=0;
+    }
+
+    _seed = botConfig.check("seed",
+                                    Value((int)time(0)),
+                                    "Seed of the random numbers, the same seed replays the same particles; by default it comes from the clock (int)").asInt64();
+
     _colorTransfPolicy = botConfig.check("colorTransfPolicy",
                                     Value("1"),
                                     "Color transformation policy (int)").asInt32();
-    if(_colorTransfPolicy!=0 && _colorTransfPolicy!=1)
+    if(_colorTransfPolicy!=0 && _colorTransfPolicy!=1 && _colorTransfPolicy!=2)
     {
         yWarning() << "Color trasformation policy "<<_colorTransfPolicy<<" is not yet implemented.";
         quit=true; //stop the execution, after checking all the parameters.
     }
 
-    _inside_outside_difference_weight = (float)botConfig.check("insideOutsideDiffWeight",
+    temp = botConfig.check("colorLut",
+                                    Value("packed"),
+                                    "Mapping from RGB to the YUV bins: packed, quantized or direct (string)").asString();
+    if(temp=="packed")
+        _colorLut=LUT_PACKED;
+    else if(temp=="quantized")
+        _colorLut=LUT_QUANTIZED;
+    else if(temp=="direct")
+        _colorLut=LUT_DIRECT;
+    else
+    {
+        yWarning() << "Color look up table "<<temp<<" is not yet implemented.";
+        _colorLut=LUT_DIRECT;
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+    //the look up table and the template histograms are kept on disk, so that a restart doesn't compute them again.
+    _cacheDir.clear();
+    if(botConfig.check("useCache",Value(1),"Cache the color look up table and the template histograms on disk (int)").asInt32()!=0)
+    {
+        _cacheDir = botConfig.check("cacheDir",
+                                    Value(rf.getHomeContextPath()),
+                                    "Directory of the cache; by default the writable directory of the context (string)").asString();
+        if(!_cacheDir.empty() && yarp::os::mkdir_p(_cacheDir.c_str())!=0)
+        {
+            yWarning() << "I wasn't able to create the cache directory "<<_cacheDir<<": the cache is not used.";
+            _cacheDir.clear();
+        }
+    }
+
+    //create the look up table, or map it from the cache: the template histogram needs it.
+    if(!createCachedLut(&_lut,_colorLut,_cacheDir,_lutFile))
+    {
+        yWarning("I wasn\'t able to allocate memory for the color look up table.");
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+
+    _pipelineDepth = botConfig.check("pipelineDepth",
+                                    Value("0"),
+                                    "Frames the capture stage can prepare in advance, 0 means no capture stage (int)").asInt32();
+    if(_pipelineDepth<0)
+    {
+        _pipelineDepth=0;
+    }
+
+    _zeroCopy=false;
+    temp = botConfig.check("zeroCopy",
+                                    Value("false"),
+                                    "Read the images straight from the input port buffer? (string)").asString();
+    if(temp=="true")
+    {
+        _zeroCopy=true;
+    }
+
+    _stereo=false;
+    temp = botConfig.check("stereo",
+                                    Value("false"),
+                                    "Weight the particles with the images of both cameras? (string)").asString();
+    if(temp=="true")
+    {
+        _stereo=true;
+        if(_pipelineDepth>0)
+        {
+            yWarning() << "The capture stage only reads the left camera: pipelineDepth "<<_pipelineDepth<<" is ignored in stereo, the images are read by updateModule().";
+            _pipelineDepth=0;
+        }
+        _stereoStampTolerance = botConfig.check("stereoStampTolerance",
+                                    Value(0.02),
+                                    "Largest difference between the timestamps of the left and right images [s], a right image further away is not used; 0 disables the check (double)").asFloat64();
+
+        _inputVideoPortRightName = botConfig.check("inputVideoPortRight",
+                                          Value("/pf3dTracker/videoRight:i"),
+                                          "Input video port of the right camera, in stereo (string)").asString();
+        _inputVideoPortRight.open(_inputVideoPortRightName);
+
+        //the pose of the right camera wrt the left one, [R T] row major, T in meters.
+        //by default the cameras are parallel, 68mm apart like the eyes of the iCub.
+        for(count=0;count<9;count++)
+            _rightRotation[count]=(count%4==0) ? 1.0 : 0.0;
+        _rightTranslation[0]=-68.0;
+        _rightTranslation[1]=0.0;
+        _rightTranslation[2]=0.0;
+        Bottle* rightCameraTransform=botConfig.find("rightCameraTransform").asList();
+        if(rightCameraTransform!=NULL)
+        {
+            if(rightCameraTransform->size()!=12)
+            {
+                yWarning("rightCameraTransform must hold 12 values: the rows of [R T].");
+                quit=true; //stop the execution, after checking all the parameters.
+            }
+            else
+            {
+                for(row=0;row<3;row++)
+                {
+                    for(column=0;column<3;column++)
+                        _rightRotation[3*row+column]=rightCameraTransform->get(4*row+column).asFloat64();
+                    _rightTranslation[row]=rightCameraTransform->get(4*row+3).asFloat64()*1000; //meters to millimeters
+                }
+            }
+        }
+    }
+
+    _nThreads = botConfig.check("nThreads",
+                                    Value("1"),
+                                    "Number of threads used to evaluate the particles, 0 means one per core (int)").asInt32();
+
+    _filter.setInsideOutsideWeight((float)botConfig.check("insideOutsideDiffWeight",
                                     Value("1.5"),
-                                    "Inside-outside difference weight in the likelihood function (double)").asFloat64();
+                                    "Inside-outside difference weight in the likelihood function (double)").asFloat64());
 
     _projectionModel = botConfig.check("projectionModel",
                                        Value("perspective"),
@@ -301,6 +499,41 @@ bool PF3DTracker::configure(ResourceFinder &rf)
         cout<<"fy="<<_perspectiveFy<<endl;
         cout<<"cx="<<_perspectiveCx<<endl;
         cout<<"cy="<<_perspectiveCy<<endl;
+
+        if(_stereo)
+        {
+            //the right camera: its own group of the calibration file, or the intrinsics of the left one.
+            _rightCalibrationImageWidth =_calibrationImageWidth;
+            _rightCalibrationImageHeight=_calibrationImageHeight;
+            _rightFx=_perspectiveFx;
+            _rightFy=_perspectiveFy;
+            _rightCx=_perspectiveCx;
+            _rightCy=_perspectiveCy;
+            if (botConfig.check("cameraContext") && botConfig.check("cameraFile"))
+            {
+                ResourceFinder camera_rf;
+                camera_rf.setDefaultContext(botConfig.find("cameraContext").asString().c_str());
+                camera_rf.setDefaultConfigFile(botConfig.find("cameraFile").asString().c_str());
+                camera_rf.configure(0,NULL);
+                Bottle &params=camera_rf.findGroup(botConfig.check("cameraGroupRight",
+                                                   Value("CAMERA_CALIBRATION_RIGHT"),
+                                                   "Calibration group of the right camera, in stereo (string)").asString());
+                if (!params.isNull())
+                {
+                    _rightCalibrationImageWidth =params.check("w",Value(320)).asInt32();
+                    _rightCalibrationImageHeight=params.check("h",Value(240)).asInt32();
+                    _rightFx                    =(float)params.check("fx",Value(257.34)).asFloat64();
+                    _rightFy                    =(float)params.check("fy",Value(257.34)).asFloat64();
+                    _rightCx                    =(float)params.check("cx",Value(160.0)).asFloat64();
+                    _rightCy                    =(float)params.check("cy",Value(120.0)).asFloat64();
+                }
+            }
+
+            cout<<"right fx="<<_rightFx<<endl;
+            cout<<"right fy="<<_rightFy<<endl;
+            cout<<"right cx="<<_rightCx<<endl;
+            cout<<"right cy="<<_rightCy<<endl;
+        }
     }
     else
     {
@@ -322,15 +555,15 @@ bool PF3DTracker::configure(ResourceFinder &rf)
 
     if(_initializationMethod=="3dEstimate")
     {
-        _initialX = botConfig.check("initialX",
+        _filter.setInitialPosition(botConfig.check("initialX",
                                     Value("0"),
-                                    "Estimated initial X position [m] (double)").asFloat64()*1000; //meters to millimeters
-        _initialY = botConfig.check("initialY",
+                                    "Estimated initial X position [m] (double)").asFloat64()*1000, //meters to millimeters
+                                   botConfig.check("initialY",
                                     Value("0"),
-                                    "Estimated initial Y position [m] (double)").asFloat64()*1000; //meters to millimeters
-        _initialZ = botConfig.check("initialZ",
+                                    "Estimated initial Y position [m] (double)").asFloat64()*1000, //meters to millimeters
+                                   botConfig.check("initialZ",
                                     Value("1000"),
-                                    "Estimated initial Z position [m] (double)").asFloat64()*1000; //meters to millimeters
+                                    "Estimated initial Z position [m] (double)").asFloat64()*1000); //meters to millimeters
     }
     else
     {
@@ -356,6 +589,9 @@ bool PF3DTracker::configure(ResourceFinder &rf)
     _circleVisualizationMode = botConfig.check("circleVisualizationMode",
                                     Value("0"),
                                     "Visualization mode for the sphere (int)").asInt32();
+    _sphereFastPath = botConfig.check("sphereFastPath",
+                                    Value(1),
+                                    "Project the contours of a sphere shape model from tables of the unit circle, not from its 3D points (int)").asInt32()!=0;
     }
     else
     {
@@ -371,6 +607,36 @@ bool PF3DTracker::configure(ResourceFinder &rf)
         }
     }
 
+    //****************************************************************
+    //Allocate the filter: the particles, the models and the workspaces
+    //****************************************************************
+    //every worker thread gets its own scratch matrices, so that hypotheses can be evaluated in parallel.
+    _workers.start(_nThreads);
+    if(_filter.setResolution(_nPixels,_yBins,_uBins,_vBins))
+    {
+        yWarning("nPixels must be positive, yBins in [1,4], uBins and vBins in [1,8].");
+        quit=true; //stop the execution, after checking all the parameters.
+    }
+    if(!_filter.allocate(_nParticles,&_lut,&_workers))
+    {
+        yWarning("PF3DTracker::open - I wasn\'t able to allocate memory for the filter.");
+        _filter.release();
+        return false;
+    }
+    cout<<"Evaluating the particles with "<<_workers.size()<<" thread(s)."<<endl;
+    if(_minParticles<_nParticles)
+    {
+        _filter.setAdaptive(_minParticles,_kldError,_kldBinSize);
+        cout<<"Using between "<<_minParticles<<" and "<<_nParticles<<" particles (KLD-sampling)."<<endl;
+    }
+    _filter.setResamplingScheme(_resamplingScheme);
+    _filter.setSeed((unsigned long long)_seed);
+    _filter.setCoarseToFine(_coarsePixels,_fineFraction);
+    _filter.setScoringMode(_scoringMode);
+    _filter.setTemplateAdaptation(_templateAdaptationRate,_templateAdaptationGate);
+    _filter.setSphereFastPath(_trackedObjectType=="sphere" && _sphereFastPath);
+    _activeParticles=_nParticles;
+
     //*****************************************************
     //Build and read the color model for the tracked object
     //*****************************************************
@@ -379,42 +645,61 @@ bool PF3DTracker::configure(ResourceFinder &rf)
     dataFileName = rf.findFile("trackedObjectTemp");
     //cout<<"$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$$"<<trackedObjectColorTemplate<<endl;
   
-    failure=computeTemplateHistogram(trackedObjectColorTemplate,dataFileName);
+    failure=loadColorTemplate(_filter,trackedObjectColorTemplate,dataFileName);
     if(failure)
     {
         yWarning("I had troubles computing the template histogram.");
         quit=true;
     }
+    else if(_resumeAdaptedTemplate)
+    {
+        resumeAdaptedTemplate(_filter,_adaptedTemplateFile);
+    }
 
-    failure=readModelHistogram(_modelHistogramMat,dataFileName.c_str());
-    if(failure)
+    //the colour templates of the other objects: they are tracked on the same images, with the same shape.
+    vector<string> extraColorTemplates;
+    Bottle* extraTemplatesList=botConfig.find("extraColorTemplates").asList();
+    if(extraTemplatesList!=NULL)
     {
-        yWarning("I had troubles reading the template histogram.");
-        quit=true;
+        for(count=0;count<(int)extraTemplatesList->size();count++)
+        {
+            temp=rf.findFile(extraTemplatesList->get(count).asString());
+            if(temp=="")
+            {
+                yWarning() << "I couldn't find the colour template "<<extraTemplatesList->get(count).asString()<<".";
+                quit=true;
+            }
+            extraColorTemplates.push_back(temp);
+        }
     }
 
     //*******************************************
     //Read the shape model for the tracked object
     //*******************************************
     trackedObjectShapeTemplate = rf.findFile("trackedObjectShapeTemplate");
-    failure=readInitialmodel3dPoints(_model3dPointsMat,trackedObjectShapeTemplate);
+    failure=_filter.readModel3dPoints(trackedObjectShapeTemplate);
     if(failure)
     {
         yWarning("I had troubles reading the model 3D points.");
         quit=true;
     }
+    else if(_trackedObjectType=="sphere" && _sphereFastPath && !_filter.sphereModel())
+    {
+        yWarning("The shape model is not made of two concentric circles: its 3D points are projected.");
+    }
 
     if((_trackedObjectType=="sphere") && (_circleVisualizationMode==1))
     {
         //create _visualization3dPointsMat and fill it with the average between outer and inner 3D points.
-        _visualization3dPointsMat=cvCreateMat( 3, 2*nPixels, CV_32FC1 );
+        CvMat* model3dPointsMat=_filter.model3dPoints();
+        _visualization3dPointsMat=cvCreateMat( 3, 2*_nPixels, CV_32FC1 );
         //only the first half of this matrix is used. the second part can be full of rubbish (not zeros, I guess).
         cvSet(_visualization3dPointsMat,(cvScalar(1)));
         for(row=0;row<3;row++)
         {
-            for(column=0;column<nPixels;column++)
+            for(column=0;column<_nPixels;column++)
             {
-                ((float*)(_visualization3dPointsMat->data.ptr + _visualization3dPointsMat->step*row))[column]=(((float*)(_model3dPointsMat->data.ptr + _model3dPointsMat->step*row))[column]+((float*)(_model3dPointsMat->data.ptr + _model3dPointsMat->step*row))[column+nPixels])/2;
+                ((float*)(_visualization3dPointsMat->data.ptr + _visualization3dPointsMat->step*row))[column]=(((float*)(model3dPointsMat->data.ptr + model3dPointsMat->step*row))[column]+((float*)(model3dPointsMat->data.ptr + model3dPointsMat->step*row))[column+_nPixels])/2;
             }
         }
     }
@@ -423,73 +708,23 @@ bool PF3DTracker::configure(ResourceFinder &rf)
     //Read the motion model matrix for the tracked object
     //***************************************************
 
-    _accelStDev = (float)botConfig.check("accelStDev",
+    _filter.setAccelStDev((float)botConfig.check("accelStDev",
                                         Value(150.0),
-                                        "StDev of acceleration noise (double)").asFloat64();
+                                        "StDev of acceleration noise (double)").asFloat64());
+    _framePeriod = botConfig.check("framePeriod",
+                                        Value(0.0),
+                                        "Frame period the motion model and accelStDev refer to [s], the particles are moved by the time between the timestamps of the images; 0 means one period per image (double)").asFloat64();
+    _lastStampTime=0;
 
     motionModelMatrix = rf.findFile("motionModelMatrix");
 
-    //allocate space for the _A matrix. 32bit floats, one channel.
-    _A=cvCreateMat(7,7,CV_32FC1);
-    failure=readMotionModelMatrix(_A, motionModelMatrix);
+    failure=_filter.readMotionModelMatrix(motionModelMatrix);
     if(failure)
     {
         yWarning("I had troubles reading the motion model matrix.");
         quit=true;
     }
 
-    //allocate memory for the particles;
-    _particles=cvCreateMat(7,_nParticles,CV_32FC1);
-    //fill the memory with zeros, so that valgrind won't complain.
-    cvSetZero(_particles);
-
-    //define ways of accessing the particles:
-    _particles1 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles1, 1, _nParticles, CV_32FC1, _particles->data.ptr, _particles->step );
-    _particles2 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles2, 1, _nParticles, CV_32FC1, _particles->data.ptr + _particles->step*1, _particles->step );
-    _particles3 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles3, 1, _nParticles, CV_32FC1, _particles->data.ptr + _particles->step*2, _particles->step );
-    _particles4 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles4, 1, _nParticles, CV_32FC1, _particles->data.ptr + _particles->step*3, _particles->step );
-    _particles5 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles5, 1, _nParticles, CV_32FC1, _particles->data.ptr + _particles->step*4, _particles->step );
-    _particles6 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles6, 1, _nParticles, CV_32FC1, _particles->data.ptr + _particles->step*5, _particles->step );
-    _particles7 = cvCreateMatHeader( 1,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles7, 1, _nParticles, CV_32FC1, _particles->data.ptr + _particles->step*6, _particles->step );
-    _particles1to6 = cvCreateMatHeader( 6,_nParticles, CV_32FC1);
-    cvInitMatHeader( _particles1to6, 6, _nParticles, CV_32FC1, _particles->data.ptr, _particles->step );
-
-    //allocate memory for the "new" particles;
-    _newParticles=cvCreateMat(7,_nParticles,CV_32FC1);
-    _newParticles1to6 = cvCreateMatHeader( 6,_nParticles, CV_32FC1);
-    cvInitMatHeader( _newParticles1to6, 6, _nParticles, CV_32FC1, _newParticles->data.ptr, _newParticles->step );
-
-    //allocate memory for "noise"
-    _noise=cvCreateMat(6,_nParticles,CV_32FC1);
-    cvSetZero(_noise);
-    _noise1 = cvCreateMatHeader( 3,_nParticles, CV_32FC1);
-    cvInitMatHeader( _noise1, 3, _nParticles, CV_32FC1, _noise->data.ptr, _noise->step );
-    cvSetZero(_noise1);
-    _noise2 = cvCreateMatHeader( 3,_nParticles, CV_32FC1);
-    cvInitMatHeader( _noise2, 3, _nParticles, CV_32FC1, _noise->data.ptr + _noise->step*3, _noise->step );
-    cvSetZero(_noise2);
-
-    //resampling-related stuff.
-    _nChildren = cvCreateMat(1,_nParticles,CV_32FC1);
-    _label     = cvCreateMat(1,_nParticles,CV_32FC1);
-    _ramp      = cvCreateMat(1,_nParticles,CV_32FC1);
-    _u         = cvCreateMat(1,_nParticles,CV_32FC1);
-
-    _cumWeight =cvCreateMat(1,_nParticles+1,CV_32FC1);
-
-    int count;
-    for(count=0;count<_nParticles;count++)
-    {
-        ((float*)(_ramp->data.ptr))[count]=(float)count+1.0F;
-    }
-
     temp = botConfig.check("saveImagesWithOpencv",
                                       Value("false"),
                                       "Save elaborated images with OpenCV? (string)").asString();
@@ -503,65 +738,47 @@ bool PF3DTracker::configure(ResourceFinder &rf)
         _saveImagesWithOpencvDir = botConfig.check("saveImagesWithOpencvDir",
                                       Value(""),
                                       "Directory where to save the elaborated images (string)").asString();
+
+        ImageRecorder::Encoding encoding=ImageRecorder::Jpeg;
+        temp = botConfig.check("saveImagesEncoding",
+                                      Value("jpeg"),
+                                      "Format of the saved images: raw, png or jpeg (string)").asString();
+        if(temp=="raw")
+            encoding=ImageRecorder::Raw;
+        else if(temp=="png")
+            encoding=ImageRecorder::Png;
+        else if(temp!="jpeg")
+        {
+            yWarning() << "Image encoding "<<temp<<" is not yet implemented.";
+            quit=true; //stop the execution, after checking all the parameters.
+        }
+        temp = botConfig.check("saveImagesSource",
+                                      Value("elaborated"),
+                                      "Images to save: elaborated (with the contours) or input (string)").asString();
+        _saveInputImages=(temp=="input");
+        int jpegQuality = botConfig.check("saveImagesJpegQuality",
+                                      Value(95),
+                                      "Quality of the saved jpeg images, 0-100 (int)").asInt32();
+        int queueLength = botConfig.check("saveImagesQueue",
+                                      Value(8),
+                                      "Images that can wait to be saved, the oldest is dropped when the disk is too slow (int)").asInt32();
+        if(!_recorder.start(_saveImagesWithOpencvDir,encoding,jpegQuality,queueLength))
+        {
+            quit=true;
+        }
     }
 
-    if(_initializationMethod=="3dEstimate")
+    if(_initializationMethod=="3dEstimate" && !quit)
     {
         //cout<<"Initialization method = 3dEstimate."<<endl;
         //*************************************************************************
         //generate a set of random particles near the estimated initial 3D position
         //*************************************************************************
-
-        float mean,velocityStDev;
-        velocityStDev=0; //warning ??? !!! I'm setting parameters for the dynamic model here.
-
-        //initialize X
-        mean=(float)_initialX;
-        cvRandArr( &rngState, _particles1, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-        //initialize Y
-        mean=(float)_initialY;
-        cvRandArr( &rngState, _particles2, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-        //initialize Z
-        mean=(float)_initialZ;
-        cvRandArr( &rngState, _particles3, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-        //initialize VX
-        mean=0;
-        cvRandArr( &rngState, _particles4, CV_RAND_NORMAL, cvScalar(mean), cvScalar(velocityStDev));
-        //initialize VY
-        cvRandArr( &rngState, _particles5, CV_RAND_NORMAL, cvScalar(mean), cvScalar(velocityStDev));
-        //initialize VZ
-        cvRandArr( &rngState, _particles6, CV_RAND_NORMAL, cvScalar(mean), cvScalar(velocityStDev));
+        _filter.initializeParticles();
     }
 
     downsampler=0; //this thing is used to send less data to the plotter
 
-    //Matrices-related stuff.
-    //connect headers to data, allocate space...
-    _rzMat = cvCreateMat(3, 3, CV_32FC1);
-    _ryMat = cvCreateMat(3, 3, CV_32FC1);
-    _uv = cvCreateMat(2,2*nPixels, CV_32FC1);
-
-    _tempMat1 = cvCreateMatHeader( 1,2*nPixels, CV_32FC1);
-    cvInitMatHeader( _tempMat1, 1, 2*nPixels, CV_32FC1,_tempMat->data.ptr, _tempMat->step ); 
-
-    _tempMat2 = cvCreateMatHeader( 1,2*nPixels, CV_32FC1);
-    cvInitMatHeader( _tempMat2, 1, 2*nPixels, CV_32FC1, _tempMat->data.ptr+_tempMat->step*1, _tempMat->step ); //FUNZIONA? ??? !!!
-
-    _tempMat3 = cvCreateMatHeader( 1,2*nPixels, CV_32FC1);
-    cvInitMatHeader( _tempMat3, 1, 2*nPixels, CV_32FC1, _tempMat->data.ptr+_tempMat->step*2, _tempMat->step ); //FUNZIONA? ??? !!!
-
-    _p2Mat1 = cvCreateMatHeader( 1,2*nPixels, CV_32FC1);
-    cvInitMatHeader( _p2Mat1, 1, 2*nPixels, CV_32FC1, _points2Mat->data.ptr ); //FUNZIONA? ??? !!!
-    _p2Mat3 = cvCreateMatHeader( 1,2*nPixels, CV_32FC1);
-    cvInitMatHeader( _p2Mat3, 1, 2*nPixels, CV_32FC1, _points2Mat->data.ptr+_points2Mat->step*2, _points2Mat->step ); //FUNZIONA? ??? !!!
-
-    _drawingMat=cvCreateMat(3, 2*nPixels, CV_32FC1);
-    _projectionMat=cvCreateMat(2, 3, CV_32FC1);
-
-    _xyzMat1 = cvCreateMatHeader(1,2*nPixels,CV_32FC1);
-    _xyzMat2 = cvCreateMatHeader(1,2*nPixels,CV_32FC1);
-    _xyzMat3 = cvCreateMatHeader(1,2*nPixels,CV_32FC1);
-
     //testOpenCv(); //Used to test stuff.
 
     //**********************************
@@ -603,17 +820,64 @@ bool PF3DTracker::configure(ResourceFinder &rf)
         _perspectiveCx=_perspectiveCx*(float)widthRatio;
         _perspectiveCy=_perspectiveCy*(float)heightRatio;
 
-        _rawImage = cvCreateImage(cvSize(_yarpImage->width(),_yarpImage->height()),IPL_DEPTH_8U, 3); //This allocates space for the image.
-        _transformedImage = cvCreateImage(cvSize(_yarpImage->width(),_yarpImage->height()),IPL_DEPTH_8U, 3); //This allocates space for the image.
-        toCvMat(*_yarpImage).copyTo(cv::cvarrToMat(_rawImage));        
+        if(_colorTransfPolicy==2)
+        {
+            //transforming the whole image pays off when it has fewer pixels than the contours have points.
+            if((int)(_yarpImage->width()*_yarpImage->height()) < (1+(int)extraColorTemplates.size())*_nParticles*2*_nPixels*binnedPixelsPerSample)
+                _colorTransfPolicy=0;
+            else
+                _colorTransfPolicy=1;
+            yInfo() << "Using color transformation policy "<<_colorTransfPolicy<<" with "<<_nParticles<<" particles on "<<(int)_yarpImage->width()<<"x"<<(int)_yarpImage->height()<<" images.";
+        }
+
+        if(_pipelineDepth>0)
+        {
+            //the capture stage fills the slots, the filter processes them.
+            _frameSlots.resize(_pipelineDepth+2);
+            for(size_t count=0;count<_frameSlots.size();count++)
+            {
+                allocateFrameSlot(_frameSlots[count],(int)_yarpImage->width(),(int)_yarpImage->height());
+            }
+            _frames.reset((int)_frameSlots.size(),_pipelineDepth);
+
+            int slot=_frames.acquire();
+            prepareFrame(_frameSlots[slot],*_yarpImage,_yarpTimestamp);
+            useFrame(slot);
+        }
+        else
+        {
+            if(_zeroCopy)
+            {
+                //only a header: it points to the buffer of the input port, RGB.
+                _rawImage = cvCreateImageHeader(cvSize(_yarpImage->width(),_yarpImage->height()),IPL_DEPTH_8U, 3);
+            }
+            else
+            {
+                _rawImage = cvCreateImage(cvSize(_yarpImage->width(),_yarpImage->height()),IPL_DEPTH_8U, 3); //This allocates space for the image.
+            }
+            //allocate space for the transformed image: one channel, holding the YUV bin of each pixel.
+            _transformedImage = cvCreateImage(cvSize(_yarpImage->width(),_yarpImage->height()),IPL_DEPTH_8U, 1);
+            acquireImage(*_yarpImage,_rawImage);
 
-        rgbToYuvBinImageLut(_rawImage,_transformedImage,_lut);
+            if(_colorTransfPolicy==0)
+            {
+                transformImage();
+            }
 
-        //allocate space for the transformed image.
-        _transformedImage = cvCreateImage(cvSize(_yarpImage->width(),_yarpImage->height()),IPL_DEPTH_8U,3);
+            if(_stereo && acquireRightImage())
+            {
+                widthRatio=(double)_yarpImageRight->width()/(double)_rightCalibrationImageWidth;
+                heightRatio=(double)_yarpImageRight->height()/(double)_rightCalibrationImageHeight;
+                _rightFx=_rightFx*(float)widthRatio;
+                _rightFy=_rightFy*(float)heightRatio;
+                _rightCx=_rightCx*(float)widthRatio;
+                _rightCy=_rightCy*(float)heightRatio;
+            }
+        }
 
         _framesNotTracking=0;
         _frameCounter=1;
+        _lastStampTime=_yarpTimestamp.getTime();
         _attentionOutput=0;
 
         _lastU=_yarpImage->width()/2.0F;
@@ -624,6 +888,47 @@ bool PF3DTracker::configure(ResourceFinder &rf)
         _firstFrame=true;
     }
 
+    if(_colorTransfPolicy==2)
+    {
+        _colorTransfPolicy=1; //no image to look at.
+    }
+    _filter.setColorTransfPolicy(_colorTransfPolicy);
+    _filter.setCamera(_perspectiveFx,_perspectiveFy,_perspectiveCx,_perspectiveCy);
+    if(_stereo)
+    {
+        if(_rawImageRight==NULL)
+        {
+            yWarning("No image from the right camera.");
+            quit=true;
+        }
+        _filter.setSecondCamera(_rightFx,_rightFy,_rightCx,_rightCy,_rightRotation,_rightTranslation);
+    }
+
+    //the other objects get the parameters of the main one, now that the camera is known.
+    if(_initializationMethod=="3dEstimate" && !quit)
+    {
+        for(count=0;count<(int)extraColorTemplates.size();count++)
+        {
+            //each object writes its template histogram to its own file: trackedObjectTemp with a suffix.
+            stringstream suffix;
+            suffix<<"_target"<<count+1;
+            string targetDataFileName=withSuffix(dataFileName,suffix.str());
+
+            if(addTarget(extraColorTemplates[count],targetDataFileName,trackedObjectShapeTemplate,motionModelMatrix))
+            {
+                quit=true;
+                break;
+            }
+            _targets.back()->adaptedTemplateFile=withSuffix(_adaptedTemplateFile,suffix.str());
+            if(_resumeAdaptedTemplate)
+                resumeAdaptedTemplate(_targets.back()->filter,_targets.back()->adaptedTemplateFile);
+        }
+        if(!_targets.empty())
+        {
+            cout<<"Tracking "<<_targets.size()+1<<" objects."<<endl;
+        }
+    }
+
     if(quit==true)
     {
         yWarning("There were problems initializing the object: the execution was interrupted.");
@@ -631,6 +936,10 @@ bool PF3DTracker::configure(ResourceFinder &rf)
     }
     else
     {
+        if(!_frameSlots.empty())
+        {
+            _captureThread=std::thread(&PF3DTracker::captureLoop,this);
+        }
         _doneInitializing=true;
         return true;  //the object was set up successfully.
     }
@@ -639,22 +948,65 @@ bool PF3DTracker::configure(ResourceFinder &rf)
 //member that closes the object.
 bool PF3DTracker::close()
 {
+    //stop the capture stage before closing the port it reads from.
+    _frames.stop();
+    _inputVideoPort.interrupt();
+    _inputVideoPortRight.interrupt();
+    if(_captureThread.joinable())
+        _captureThread.join();
+    for(size_t count=0;count<_frameSlots.size();count++)
+    {
+        releaseFrameSlot(_frameSlots[count]);
+    }
+    _frameSlots.clear();
+
     _inputVideoPort.close();
+    _inputVideoPortRight.close();
     _outputVideoPort.close();
     _outputDataPort.close();
     _outputUVDataPort.close();
     _inputParticlePort.close();
     _outputParticlePort.close();
     _outputAttentionPort.close();
+    _outputStatsPort.close();
+    _outputTargetsPort.close();
+    _rpcPort.close();
 
-    if (_A != NULL)
-        cvReleaseMat(&_A);
+    _recorder.stop(); //the images still in the queue are written.
 
-    if (_particles != NULL)
-        cvReleaseMat(&_particles);
+    //the adapted templates outlive the run.
+    if(_doneInitializing && _templateAdaptationRate>0)
+    {
+        if(_filter.writeModelHistogram(_adaptedTemplateFile.c_str()))
+            yWarning() << "I wasn't able to save the adapted template to "<<_adaptedTemplateFile<<".";
+        for(size_t count=0;count<_targets.size();count++)
+        {
+            if(_targets[count]->filter.writeModelHistogram(_targets[count]->adaptedTemplateFile.c_str()))
+                yWarning() << "I wasn't able to save the adapted template to "<<_targets[count]->adaptedTemplateFile<<".";
+        }
+    }
+
+    _workers.stop();
+    _filter.release();
+    for(size_t count=0;count<_targets.size();count++)
+    {
+        delete _targets[count];
+    }
+    _targets.clear();
+
+    if (_visualization3dPointsMat != NULL)
+        cvReleaseMat(&_visualization3dPointsMat);
+    if (_rawImageRight != NULL)
+    {
+        if(_zeroCopy)
+            cvReleaseImageHeader(&_rawImageRight);
+        else
+            cvReleaseImage(&_rawImageRight);
+    }
+    if (_transformedImageRight != NULL)
+        cvReleaseImage(&_transformedImageRight);
 
-    if (_newParticles != NULL)
-        cvReleaseMat(&_newParticles);
+    releaseCachedLut(&_lut,_lutFile);
 
     return true;
 }
@@ -662,13 +1014,18 @@ bool PF3DTracker::close()
 //member that closes the object.
 bool PF3DTracker::interruptModule()
 {
+    _frames.stop();
     _inputVideoPort.interrupt();
+    _inputVideoPortRight.interrupt();
     _outputVideoPort.interrupt();
     _outputDataPort.interrupt();
     _outputUVDataPort.interrupt();
     _inputParticlePort.interrupt();
     _outputParticlePort.interrupt();
     _outputAttentionPort.interrupt();
+    _outputStatsPort.interrupt();
+    _outputTargetsPort.interrupt();
+    _rpcPort.interrupt();
 
     return true;
 }
@@ -681,20 +1038,29 @@ bool PF3DTracker::updateModule()
     if(_doneInitializing)
     {
         int count;
-        unsigned int seed;
-        float likelihood, mean, maxX, maxY, maxZ;
+        float maxX, maxY, maxZ;
         float weightedMeanX, weightedMeanY, weightedMeanZ;
         float meanU;
         float meanV;
         float wholeCycle;
-        string outputFileName;
-        stringstream out;
+        Bottle *particleInput=NULL;
+        bool predict=false; //the particles survived this image: move them to the next one.
 
-        seed=rand();
+        double stageStart;
 
         _finalTime=yarp::os::Time::now();
         wholeCycle=(float)(_finalTime-_initialTime);
         _initialTime=yarp::os::Time::now();
+        if(_firstFrame==false)
+        {
+            _stats.add(StageStats::Cycle,wholeCycle);
+        }
+
+        if(_saveImagesWithOpencv && _saveInputImages)
+        {
+            //the image before anything is drawn on it.
+            _recorder.push(cv::cvarrToMat(_rawImage),_zeroCopy,_frameCounter,_yarpTimestamp.getTime());
+        }
 
         //*****************************************
         //calculate the likelihood of each particle
@@ -702,40 +1068,22 @@ bool PF3DTracker::updateModule()
         float sumLikelihood=0.0;
         float maxLikelihood=0.0;
         int   maxIndex=-1;
-        for(count=0;count< _nParticles;count++)
+        if(_colorTransfPolicy!=0 && _colorTransfPolicy!=1)
         {
-            if(_colorTransfPolicy==0)
-            {
-                evaluateHypothesisPerspective(_model3dPointsMat,(float)cvmGet(_particles,0,count),(float)cvmGet(_particles,1,count),(float)cvmGet(_particles,2,count),_modelHistogramMat,_transformedImage,_perspectiveFx,_perspectiveFy, _perspectiveCx,_perspectiveCy,_inside_outside_difference_weight,likelihood);
-            }
-            else
-            {
-                if(_colorTransfPolicy==1)
-                {
-                  evaluateHypothesisPerspectiveFromRgbImage(_model3dPointsMat,(float)cvmGet(_particles,0,count),(float)cvmGet(_particles,1,count),(float)cvmGet(_particles,2,count),_modelHistogramMat,_rawImage,_perspectiveFx,_perspectiveFy, _perspectiveCx,_perspectiveCy,_inside_outside_difference_weight,likelihood);
-                }
-                else
-                {
-                    yWarning() << "Wrong ID for color transformation policy:"<<_colorTransfPolicy<<". Quitting.";
-                    return false;
-                }
-            }
-    
-            cvmSet(_particles,6,count,likelihood);
-            sumLikelihood+=likelihood;
-            if(likelihood>maxLikelihood)
-            {
-                maxLikelihood=likelihood;
-                maxIndex=count;
-            }
+            yWarning() << "Wrong ID for color transformation policy:"<<_colorTransfPolicy<<". Quitting.";
+            return false;
         }
+
+        stageStart=yarp::os::Time::now();
+        _filter.evaluate(_rawImage,_transformedImage,sumLikelihood,maxLikelihood,maxIndex,rightRawImage(),rightTransformedImage());
+        _stats.add(StageStats::Likelihood,yarp::os::Time::now()-stageStart);
     
-    
+        ParticleSet &particles=_filter.particles();
         if(maxIndex!=-1)
         {
-            maxX=(float)cvmGet(_particles,0,maxIndex);
-            maxY=(float)cvmGet(_particles,1,maxIndex);
-            maxZ=(float)cvmGet(_particles,2,maxIndex);
+            maxX=particles.row(ParticleSet::X)[maxIndex];
+            maxY=particles.row(ParticleSet::Y)[maxIndex];
+            maxZ=particles.row(ParticleSet::Z)[maxIndex];
         }
         else
         {
@@ -756,65 +1104,35 @@ bool PF3DTracker::updateModule()
           _seeingObject=0;
           _framesNotTracking+=1;
         }
+
+        //adaptive template: only confident particles change the template, before the resampling moves them.
+        if(_templateAdaptationRate>0)
+        {
+            _filter.adaptTemplate();
+        }
     
-        //******************************************************
-        //     //send data to the plotter. COMMENTED FOR EFFICENCY
-        //******************************************************
-        //     if(downsampler % 3 ==0)
-        //     {
-        //         //these values might be a mix of the ones before and after the resampling took place. ??? WARNING
-        //         Bottle& particleOutput=_outputParticlePort.prepare();
-        //         particleOutput.clear();
-        //         for(count=0;count<_nParticles;count++)
-        //         {
-        //             particleOutput.addFloat64((double)(_particles[0][count]));
-        //             particleOutput.addFloat64((double)(_particles[1][count]));
-        //             particleOutput.addFloat64((double)(_particles[2][count]));
-        //             particleOutput.addFloat64((double)(_particles[3][count]));
-        //             particleOutput.addFloat64((double)(_particles[4][count]));
-        //             particleOutput.addFloat64((double)(_particles[5][count]));
-        //             particleOutput.addFloat64((double)(_particles[6][count]));
-        //         }
-        //         _outputParticlePort.write();
-        //     }
-        //     downsampler+=1;
+        //*********************************************************
+        //send the particles, with their likelihoods, to the plotter
+        //*********************************************************
+        //one binary block, only when somebody listens.
+        if(_outputParticlePort.getOutputCount()>0)
+        {
+            Bottle& particleOutput=_outputParticlePort.prepare();
+            writeParticleMessage(particleOutput,particles,_filter.nParticles(),_particleDecimation,_particleBuffer);
+            _outputParticlePort.setEnvelope(_yarpTimestamp);
+            _outputParticlePort.write();
+        }
     
         //If the likelihood has been under the threshold for 5 frames, reinitialize the tracker.
         //This just works for the sphere.
         if(_framesNotTracking==5 || sumLikelihood==0.0)
         {
             cout<<"**********************************************************************Reset\n";
-            float mean,velocityStDev;
-            velocityStDev=0; //warning ??? !!! I'm setting parameters for the dynamic model here.
-    
-            mean=(float)_initialX;
-            cvRandArr( &rngState, _particles1, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-            //initialize Y
-            mean=(float)_initialY;
-            cvRandArr( &rngState, _particles2, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-            //initialize Z
-            mean=(float)_initialZ;
-            cvRandArr( &rngState, _particles3, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-            //initialize VX
-            mean=0;
-            cvRandArr( &rngState, _particles4, CV_RAND_NORMAL, cvScalar(mean), cvScalar(velocityStDev));
-            //initialize VY
-            cvRandArr( &rngState, _particles5, CV_RAND_NORMAL, cvScalar(mean), cvScalar(velocityStDev));
-            //initialize VZ
-            cvRandArr( &rngState, _particles6, CV_RAND_NORMAL, cvScalar(mean), cvScalar(velocityStDev));
+            _filter.initializeParticles();
 
             _framesNotTracking=0;
 
-            weightedMeanX=weightedMeanY=weightedMeanZ=0.0;    // UGO: they should be zeroed before accumulation
-            for(count=0;count<_nParticles;count++)
-            {
-                weightedMeanX+=(float)cvmGet(_particles,0,count);
-                weightedMeanY+=(float)cvmGet(_particles,1,count);
-                weightedMeanZ+=(float)cvmGet(_particles,2,count);
-            }
-            weightedMeanX/=_nParticles;
-            weightedMeanY/=_nParticles;
-            weightedMeanZ/=_nParticles;
+            _filter.mean(weightedMeanX,weightedMeanY,weightedMeanZ);
             //this mean is not weighted as there is no weight to use: the particles have just been generated.
 
             //*****************************************
@@ -833,16 +1151,7 @@ bool PF3DTracker::updateModule()
             //*********************************************
             //Compute the mean and normalize the likelihood
             //*********************************************
-            weightedMeanX=0.0;
-            weightedMeanY=0.0;
-            weightedMeanZ=0.0;
-            for(count=0;count<_nParticles;count++)
-            {
-                cvmSet(_particles,6,count,(cvmGet(_particles,6,count)/sumLikelihood));
-                weightedMeanX+=(float)(cvmGet(_particles,0,count)*cvmGet(_particles,6,count));
-                weightedMeanY+=(float)(cvmGet(_particles,1,count)*cvmGet(_particles,6,count));
-                weightedMeanZ+=(float)(cvmGet(_particles,2,count)*cvmGet(_particles,6,count));
-            }
+            _filter.weightedMean(sumLikelihood,weightedMeanX,weightedMeanY,weightedMeanZ);
 
             //*****************************************
             //WRITE ESTIMATES TO THE SCREEN, FIRST PART
@@ -862,11 +1171,16 @@ bool PF3DTracker::updateModule()
             cout<<"  "<<setw(5)<<_seeingObject;
 
             //------------------------------------------------------------martim
-            Bottle *particleInput = _inputParticlePort.read(false);
+            particleInput = _inputParticlePort.read(false);
             if (particleInput==NULL)
                 _numParticlesReceived=0;
             else
-                _numParticlesReceived=(particleInput->get(0)).asInt32();
+                _numParticlesReceived=particleMessageSize(*particleInput);
+            if(_numParticlesReceived < 0)
+            {
+                _numParticlesReceived=0;
+                yWarning("PROBLEM: Malformed message on the input particle port.");
+            }
             if(_numParticlesReceived > _nParticles)
             {
                 _numParticlesReceived=0;
@@ -881,77 +1195,69 @@ bool PF3DTracker::updateModule()
                                      //this is intended to prevent that the particles collapse on the origin when you start the tracker.
             if(maxLikelihood>minimum_likelihood)
             {
-                //TODO non funziona ancora, credo: nelle particelle resamplate ci sono dei not-a-number.
-                //systematicR(_particles1to6,_particles7,_newParticles);   //SOMETHING'S WRONG HERE: sometimes the new particles look like being messed up ??? !!!
-                systematic_resampling(_particles1to6,_particles7,_newParticles,_cumWeight);
+                stageStart=yarp::os::Time::now();
+                //with KLD-sampling, all the particles are used again as soon as the object is lost.
+                _filter.resample(_numParticlesReceived,_framesNotTracking>0); //martim
+                _stats.add(StageStats::Resample,yarp::os::Time::now()-stageStart);
             }
-            else //I can't apply a resampling with all weights equal to 0!
+            //else: I can't apply a resampling with all weights equal to 0! keep the particles as they are.
+            else if(_framesNotTracking>0)
             {
-                //TODO:CHECK that copying the whole thing creates no problems.
-                //I think I used to copy only 6 lines to make it faster.
-                //ippsCopy_32f(&_particles[0][0], &_newParticles[0][0], 6*_nParticles);
-                cvCopy(_particles,_newParticles);
+                _filter.grow();
             }
 
-            //the "good" particles now are in _newParticles
-            //******************************************
-            //APPLY THE MOTION MODEL: 1.APPLY THE MATRIX
-            //******************************************
-            cvMatMul(_A,_newParticles,_particles);
-
-            //the "good" particles now are in _particles
-            //********************************************************
-            //APPLY THE MOTION MODEL: 2.ADD THE EFFECT OF ACCELERATION
-            //********************************************************
-            mean = 0; //NEW
-            //cout<<"Noise generation parameters: mean= "<<mean<<", accelStDev= "<<_accelStDev<<endl;
-            //cout<<"_noise1 before generation: "<<((float*)(_noise1->data.ptr + _noise->step*0))[0]<<endl;
-            cvRandArr( &rngState, _noise1, CV_RAND_NORMAL, cvScalar(mean), cvScalar(_accelStDev));
-            //cout<<"_noise1 after generation: "<<((float*)(_noise1->data.ptr + _noise->step*0))[0]<<endl;
-
-            cvCopy(_noise1,_noise2);
-            cvConvertScale( _noise1, _noise1, 0.5, 0 );//influence on the position is half that on speed.
-            //cout<<"_noise1 after rescaling: "<<((float*)(_noise1->data.ptr + _noise->step*0))[0]<<endl;
-
-            //cout<<"_noise2 after generation: "<<((float*)(_noise2->data.ptr + _noise->step*0))[0]<<endl;
-            
-            //cout<<"First element of _particles before addition of noise: "<<((float*)(_particles->data.ptr + _particles->step*0))[0]<<endl;
-            cvAdd(_particles1to6,_noise,_particles1to6);//sum the influence of the noise to the previous status
-            //cout<<"First element of _particles after addition of noise: "<<((float*)(_particles->data.ptr + _particles->step*0))[0]<<endl;
-
-        //------------------------------------------------------------martim
-        // get particles from input
-        if(_numParticlesReceived > 0){
-            int topdownParticles = _nParticles - _numParticlesReceived;
-            for(count=0 ; count<_numParticlesReceived ; count++){
-                cvmSet(_particles,0,topdownParticles+count, (particleInput->get(1+count*3+0)).asFloat64());
-                cvmSet(_particles,1,topdownParticles+count, (particleInput->get(1+count*3+1)).asFloat64());
-                cvmSet(_particles,2,topdownParticles+count, (particleInput->get(1+count*3+2)).asFloat64());
-                cvmSet(_particles,3,topdownParticles+count, 0);
-                cvmSet(_particles,4,topdownParticles+count, 0);
-                cvmSet(_particles,5,topdownParticles+count, 0);
-                cvmSet(_particles,6,topdownParticles+count, 0.8); //??
-            }
-            //num_bottomup_objects=(particleInput->get(1+count*3)).asInt32();
+            //the motion model is applied once the next image has arrived: its timestamp tells how far to move the particles.
+            predict=true;
         }
-        //------------------------------------------------------------end martim
+
+        _activeParticles=_filter.nParticles();
+
+        //the other objects, on the same transformed image.
+        for(count=0;count<(int)_targets.size();count++)
+        {
+            trackTarget(*_targets[count]);
         }
 
         //************************************
         //DRAW THE SAMPLED POINTS ON THE IMAGE
         //************************************
+        stageStart=yarp::os::Time::now();
+        ImageOf<PixelRgb> *outputImage=_yarpImage;
+        if(_zeroCopy)
+        {
+            //draw directly on the buffer of the output port: the input buffer is left untouched.
+            outputImage=&_outputVideoPort.prepare();
+            outputImage->copy(*_yarpImage);
+        }
 
         if(_circleVisualizationMode==0)
         {
-            drawSampledLinesPerspectiveYARP(_model3dPointsMat, weightedMeanX,weightedMeanY,weightedMeanZ, _yarpImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 255, 255, 255, meanU, meanV);
+            drawSampledLinesPerspectiveYARP(_filter.model3dPoints(), weightedMeanX,weightedMeanY,weightedMeanZ, outputImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 255, 255, 255, meanU, meanV);
         }
         if(_circleVisualizationMode==1)
         {
             if(_seeingObject)
-                drawContourPerspectiveYARP(_visualization3dPointsMat, weightedMeanX,weightedMeanY,weightedMeanZ, _yarpImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 0, 255, 0, meanU, meanV);
+                drawContourPerspectiveYARP(_visualization3dPointsMat, weightedMeanX,weightedMeanY,weightedMeanZ, outputImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 0, 255, 0, meanU, meanV);
             else
-                drawContourPerspectiveYARP(_visualization3dPointsMat, weightedMeanX,weightedMeanY,weightedMeanZ, _yarpImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 255,255, 0, meanU, meanV);
+                drawContourPerspectiveYARP(_visualization3dPointsMat, weightedMeanX,weightedMeanY,weightedMeanZ, outputImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 255,255, 0, meanU, meanV);
+        }
+        for(count=0;count<(int)_targets.size();count++)
+        {
+            TrackedTarget &target=*_targets[count];
+            const int* colour=targetColours[count%nTargetColours];
+            if(_circleVisualizationMode==0)
+            {
+                drawSampledLinesPerspectiveYARP(_filter.model3dPoints(), target.x,target.y,target.z, outputImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, colour[0], colour[1], colour[2], target.u, target.v);
+            }
+            if(_circleVisualizationMode==1)
+            {
+                if(target.seeingObject)
+                    drawContourPerspectiveYARP(_visualization3dPointsMat, target.x,target.y,target.z, outputImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, colour[0], colour[1], colour[2], target.u, target.v);
+                else
+                    drawContourPerspectiveYARP(_visualization3dPointsMat, target.x,target.y,target.z, outputImage,_perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, 255,255, 0, target.u, target.v);
+            }
         }
+        _stats.add(StageStats::Drawing,yarp::os::Time::now()-stageStart);
 
         //******************************************
         //WRITE ESTIMATES TO THE SCREEN, SECOND PART
@@ -980,6 +1286,7 @@ bool PF3DTracker::updateModule()
             _firstFrame=false;
         }
 
+        stageStart=yarp::os::Time::now();
         Bottle& output=_outputDataPort.prepare();
         output.clear();
         output.addFloat64(weightedMeanX/1000);//millimeters to meters
@@ -1008,6 +1315,28 @@ bool PF3DTracker::updateModule()
             _outputUVDataPort.write();
         }
 
+        if(!_targets.empty())
+        {
+            //one list per object: (index X Y Z likelihood U V seeing_object), the main object is not repeated.
+            Bottle& targets=_outputTargetsPort.prepare();
+            targets.clear();
+            for(count=0;count<(int)_targets.size();count++)
+            {
+                const TrackedTarget &target=*_targets[count];
+                Bottle &item=targets.addList();
+                item.addInt32(count+1);
+                item.addFloat64(target.x/1000);//millimeters to meters
+                item.addFloat64(target.y/1000);//millimeters to meters
+                item.addFloat64(target.z/1000);//millimeters to meters
+                item.addFloat64(target.likelihood);
+                item.addFloat64(target.u);
+                item.addFloat64(target.v);
+                item.addFloat64(target.seeingObject);
+            }
+            _outputTargetsPort.setEnvelope(_yarpTimestamp);
+            _outputTargetsPort.write();
+        }
+
         Vector& tempVector=_outputAttentionPort.prepare();
         tempVector.resize(5);
         if(maxLikelihood>_likelihoodThreshold)
@@ -1036,46 +1365,122 @@ bool PF3DTracker::updateModule()
         //************************************
         //I should use the output video port, instead.
         //write image to file, openCV.
-        if(_saveImagesWithOpencv)
+        if(_saveImagesWithOpencv && !_saveInputImages)
         {
-            if(_frameCounter<1000) out << 0;
-            if(_frameCounter<100) out << 0;
-            if(_frameCounter<10) out << 0;
-            out << _frameCounter;
-            outputFileName=_saveImagesWithOpencvDir+out.str()+".jpeg";
-            toCvMat(*_yarpImage).copyTo(cv::cvarrToMat(_rawImage));
-            imwrite(outputFileName, cv::cvarrToMat(_rawImage));
+            //only a copy here: the recorder converts, encodes and writes the image in its own thread.
+            if(_zeroCopy)
+            {
+                cv::Mat rgbMat((int)outputImage->height(),(int)outputImage->width(),CV_8UC3,outputImage->getRawImage(),outputImage->getRowSize());
+                _recorder.push(rgbMat,true,_frameCounter,_yarpTimestamp.getTime());
+            }
+            else
+            {
+                _recorder.push(toCvMat(*_yarpImage),false,_frameCounter,_yarpTimestamp.getTime());
+            }
         }
 
         //write the elaborated image on the output port.
-        cv::Mat tmpMat=toCvMat(*_yarpImage);
-        cvtColor(tmpMat,tmpMat,CV_BGR2RGB);
-        _outputVideoPort.prepare() = fromCvMat<PixelRgb>(tmpMat);
+        if(!_zeroCopy)
+        {
+            cv::Mat tmpMat=toCvMat(*_yarpImage);
+            cvtColor(tmpMat,tmpMat,CV_BGR2RGB);
+            _outputVideoPort.prepare() = fromCvMat<PixelRgb>(tmpMat);
+        }
 
         //set the envelope for the output port
         _outputVideoPort.setEnvelope(_yarpTimestamp);
         _outputVideoPort.write();
+        _stats.add(StageStats::Publish,yarp::os::Time::now()-stageStart);
+
+        //the statistics are only assembled when somebody listens.
+        if(_outputStatsPort.getOutputCount()>0)
+        {
+            Bottle& stats=_outputStatsPort.prepare();
+            stats.clear();
+            writeStats(stats);
+            _outputStatsPort.setEnvelope(_yarpTimestamp);
+            _outputStatsPort.write();
+        }
 
         _frameCounter++;
 
         //*******************
         //acquire a new image
         //*******************
-        _yarpImage = _inputVideoPort.read(); //read one image from the buffer.
-        _inputVideoPort.getEnvelope(_yarpTimestamp);
-
-        toCvMat(*_yarpImage).copyTo(cv::cvarrToMat(_rawImage));
-
-        //*************************************
-        //transform the image in the YUV format
-        //*************************************
-        if(_colorTransfPolicy==0)
+        stageStart=yarp::os::Time::now();
+        if(_pipelineDepth>0)
         {
-            rgbToYuvBinImageLut(_rawImage,_transformedImage,_lut);
+            //the capture stage has already read, and transformed, the next frame.
+            _frames.release(_currentFrame);
+            int slot=_frames.pop();
+            if(slot<0)
+                return false; //the module is being closed.
+            useFrame(slot);
+            _stats.add(StageStats::Acquire,yarp::os::Time::now()-stageStart);
         }
-        // else do nothing
-    }
-    //if initialization has not finished, do nothing.
+        else
+        {
+            _yarpImage = _inputVideoPort.read(); //read one image from the buffer.
+            _inputVideoPort.getEnvelope(_yarpTimestamp);
+
+            acquireImage(*_yarpImage,_rawImage);
+            if(_stereo && !acquireRightImage())
+                return false; //the module is being closed.
+            _stats.add(StageStats::Acquire,yarp::os::Time::now()-stageStart);
+        }
+
+        //**********************************************************
+        //APPLY THE MOTION MODEL, over the time elapsed since the last image
+        //**********************************************************
+        const float periods=framePeriods();
+        if(predict)
+        {
+            stageStart=yarp::os::Time::now();
+            _filter.applyMotionModel(periods);
+            _stats.add(StageStats::MotionModel,yarp::os::Time::now()-stageStart);
+
+            //------------------------------------------------------------martim
+            // get particles from input
+            if(_numParticlesReceived > 0){
+                int nParticles = _filter.nParticles();
+                int topdownParticles = nParticles - _numParticlesReceived;
+                readParticleMessage(*particleInput,_numParticlesReceived,
+                                    particles.row(ParticleSet::X)+topdownParticles,
+                                    particles.row(ParticleSet::Y)+topdownParticles,
+                                    particles.row(ParticleSet::Z)+topdownParticles);
+                for(int r=ParticleSet::VX;r<=ParticleSet::VZ;r++)
+                    fill(particles.row(r)+topdownParticles,particles.row(r)+nParticles,0.0F);
+                fill(particles.row(ParticleSet::W)+topdownParticles,particles.row(ParticleSet::W)+nParticles,0.8F); //??
+                //num_bottomup_objects=(particleInput->get(1+count*3)).asInt32();
+            }
+            //------------------------------------------------------------end martim
+        }
+        for(count=0;count<(int)_targets.size();count++)
+        {
+            if(_targets[count]->predict)
+                _targets[count]->filter.applyMotionModel(periods);
+        }
+
+        if(_pipelineDepth==0)
+        {
+            //*************************************
+            //transform the image in the YUV format
+            //*************************************
+            if(_colorTransfPolicy==0)
+            {
+                //the particles for this image are ready: only the region their contours fall in is needed.
+                //the other objects can be anywhere in the image: then it's transformed as a whole.
+                stageStart=yarp::os::Time::now();
+                if(_targets.empty())
+                    _filter.transformImageAroundParticles(_rawImage,_transformedImage);
+                else
+                    transformImage();
+                _stats.add(StageStats::ColourTransform,yarp::os::Time::now()-stageStart);
+            }
+            // else do nothing
+        }
+    }
+    //if initialization has not finished, do nothing.
 
     return true; //continue: in this case it means everything is fine.
 }
@@ -1085,837 +1490,417 @@ double PF3DTracker::getPeriod()
     return 0.0; // sync with incoming data
 }
 
-void PF3DTracker::drawSampledLinesPerspectiveYARP(CvMat* model3dPointsMat, float x, float y, float z, ImageOf<PixelRgb> *image,float _perspectiveFx,float  _perspectiveFy ,float _perspectiveCx,float  _perspectiveCy ,int R, int G, int B, float &meanU, float &meanV)
+//member that answers the commands received on the rpc port.
+bool PF3DTracker::respond(const Bottle &command, Bottle &reply)
 {
-
-    bool failure;
-    //CvMat* uv=cvCreateMat(2,2*nPixels,CV_32FC1);
-
-    //create a copy of the 3D original points.
-    cvCopy(model3dPointsMat,_drawingMat);
-
-    //****************************
-    //ROTOTRANSLATE THE 3D POINTS.
-    //****************************
-    failure=place3dPointsPerspective(_drawingMat,x,y,z);
-    //cout<<"rototraslated points:\n";
-    //printMatrix(&model3dPointsDuplicate[0][0],2*nPixels,3);
-
-    //***********************
-    //PROJECT 3D POINTS TO 2D
-    //***********************
-    failure= perspective_projection(_drawingMat, _perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, _uv)!=0;
-    if(failure)
+    string cmd=command.get(0).asString();
+    if(cmd=="stats")
     {
-        yWarning("I had troubles projecting the points.");
+        reply.clear();
+        writeStats(reply);
+        return true;
     }
-
-    //DRAW    
-    int conta,uPosition,vPosition;
-    meanU=0;
-    meanV=0;
-    for(conta=0;conta<nPixels;conta++)
+    if(cmd=="resetStats")
     {
-        meanU=meanU+((float*)(_uv->data.ptr + _uv->step*0))[conta];
-        meanV=meanV+((float*)(_uv->data.ptr + _uv->step*1))[conta];
-
-        vPosition= (int)((float*)(_uv->data.ptr + _uv->step*1))[conta];
-        uPosition= (int)((float*)(_uv->data.ptr + _uv->step*0))[conta];
-        if((uPosition<_rawImage->width)&&(uPosition>=0)&&(vPosition<_rawImage->height)&&(vPosition>=0))
-        {
-            image->pixel(uPosition,vPosition)= PixelRgb(B,G,R);
-        }
-        vPosition= (int)((float*)(_uv->data.ptr + _uv->step*1))[conta+nPixels];
-        uPosition= (int)((float*)(_uv->data.ptr + _uv->step*0))[conta+nPixels];
-        if((uPosition<_rawImage->width)&&(uPosition>=0)&&(vPosition<_rawImage->height)&&(vPosition>=0))
-        {
-            image->pixel(uPosition,vPosition)= PixelRgb(B,G,R);
-        }
-
+        _stats.reset();
+        reply.clear();
+        reply.addString("ok");
+        return true;
     }
-
-    meanU=floor(meanU/nPixels);
-    meanV=floor(meanV/nPixels);
-    if((meanU<_rawImage->width)&&(meanU>=0)&&(meanV<_rawImage->height)&&(meanV>=0))
+    if(cmd=="help")
     {
-        image->pixel((int)meanU,(int)meanV)= PixelRgb(B,G,R);
+        reply.clear();
+        reply.addVocab32("many");
+        reply.addString("stats: latency of each stage, (name samples p50 p95 p99) in milliseconds, (dropped frames) and (particles in use)");
+        reply.addString("resetStats: forget the latencies measured so far");
+        reply.addString("quit: close the module");
+        return true;
     }
-
+    return RFModule::respond(command,reply);
 }
 
-void PF3DTracker::drawContourPerspectiveYARP(CvMat* model3dPointsMat,float x, float y, float z, ImageOf<PixelRgb> *image,float _perspectiveFx,float  _perspectiveFy ,float _perspectiveCx,float  _perspectiveCy ,int R, int G, int B, float &meanU, float &meanV)
+void PF3DTracker::writeStats(Bottle &bottle)
 {
+    _stats.write(bottle);
+    Bottle &dropped=bottle.addList();
+    dropped.addString("dropped");
+    dropped.addInt32(_frames.dropped());
+    Bottle &particles=bottle.addList();
+    particles.addString("particles");
+    particles.addInt32(_activeParticles);
+}
 
-    bool failure;
-    //CvMat* uv=cvCreateMat(2,2*nPixels,CV_32FC1);
-
-    //create a copy of the 3D original points.
-    cvCopy(model3dPointsMat,_drawingMat);
-
-    //****************************
-    //ROTOTRANSLATE THE 3D POINTS.
-    //****************************
-    failure=place3dPointsPerspective(_drawingMat,x,y,z);
-    //cout<<"rototraslated points:\n";
-    //printMatrix(&model3dPointsDuplicate[0][0],2*nPixels,3);
-
-    //***********************
-    //PROJECT 3D POINTS TO 2D
-    //***********************
-    failure= perspective_projection(_drawingMat, _perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, _uv)!=0;
-    if(failure)
-    {
-        yWarning("I had troubles projecting the points.");
-    }
-
-    //****
-    //Draw
-    //****
-    int conta,cippa,lippa,uPosition,vPosition;
-    meanU=0;
-    meanV=0;
-    for(conta=0;conta<nPixels;conta++)
+void PF3DTracker::acquireImage(ImageOf<PixelRgb> &image, IplImage *rawImage)
+{
+    if(_zeroCopy)
     {
-        meanV=meanV+((float*)(_uv->data.ptr + _uv->step*1))[conta];
-        meanU=meanU+((float*)(_uv->data.ptr + _uv->step*0))[conta];
-
-        for(lippa=-2;lippa<3;lippa++)
-            for(cippa=-2;cippa<3;cippa++)
-            {
-                vPosition= (int)(((float*)(_uv->data.ptr + _uv->step*1))[conta])+lippa-1;
-                uPosition= (int)(((float*)(_uv->data.ptr + _uv->step*0))[conta])+cippa-1;
-
-                if((uPosition<_rawImage->width)&&(uPosition>=0)&&(vPosition<_rawImage->height)&&(vPosition>=0))
-                {
-                    image->pixel(uPosition,vPosition)= PixelRgb(B,G,R);
-                }
-
-            }
+        //the image stays in its buffer: the one of the input port is valid until the next read.
+        cvSetData(rawImage,image.getRawImage(),(int)image.getRowSize());
     }
-
-    meanU=floor(meanU/nPixels);
-    meanV=floor(meanV/nPixels);
-    if((meanU<_rawImage->width)&&(meanU>=0)&&(meanV<_rawImage->height)&&(meanV>=0))
+    else
     {
-        image->pixel((int)meanU,(int)meanV)= PixelRgb(B,G,R);
+        toCvMat(image).copyTo(cv::cvarrToMat(rawImage));
     }
+}
 
+void PF3DTracker::allocateFrameSlot(FrameSlot &frame, int width, int height)
+{
+    frame.image.resize(width,height);
+    if(_zeroCopy)
+        frame.rawImage = cvCreateImageHeader(cvSize(width,height),IPL_DEPTH_8U, 3);
+    else
+        frame.rawImage = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U, 3);
+    frame.transformedImage = cvCreateImage(cvSize(width,height),IPL_DEPTH_8U, 1);
 }
 
-bool PF3DTracker::computeTemplateHistogram(string imageFileName,string dataFileName)
+void PF3DTracker::releaseFrameSlot(FrameSlot &frame)
 {
-    int u,v,a,b,c;
-    float usedPoints=0;
-    //float histogram[YBins][UBins][VBins];
-    //float* histogram;
-    //histogram = new float[YBins*UBins*VBins]
-    int dimensions;
-    dimensions=3;
-    int sizes[3]={YBins,UBins,VBins};
-    //create histogram and allocate memory for it.
-    CvMatND* histogram=cvCreateMatND(dimensions, sizes, CV_32FC1);
-    if(histogram==0)
+    if(frame.rawImage != NULL)
     {
-        yWarning("computeTemplateHistogram: I wasn\'t able to allocate memory for histogram.");
-        return true; //if I can't do it, I just quit the program.
-    }
-    //set content of the matrix to zero.
-    cvSetZero(histogram);
-    //load the image
-    auto rawImage = cv::imread(imageFileName);
-    if( ! rawImage.data) //load the image from file.
-    {
-        yWarning("I wasn't able to open the image file!");
-        return true; //if I can't do it, I just quit the program.
+        if(_zeroCopy)
+            cvReleaseImageHeader(&frame.rawImage);
+        else
+            cvReleaseImage(&frame.rawImage);
     }
-    cv::Mat transformedImage(rawImage.rows, rawImage.cols, CV_8UC3);
-
-
-    //allocate space for the transformed image
+    if(frame.transformedImage != NULL)
+        cvReleaseImage(&frame.transformedImage);
+}
 
-    //transform the image in the YUV format
-    rgbToYuvBinMatLut(rawImage,transformedImage,_lut);
-    
-    //count the frequencies of colour bins, build the histogram.
-    for(v=0;v<rawImage.rows;v++)
-        for(u=0;u<rawImage.cols;u++)
-        {
-            //discard white pixels [255,255,255].
+void PF3DTracker::prepareFrame(FrameSlot &frame, ImageOf<PixelRgb> &image, const Stamp &stamp)
+{
+    //the slot owns its copy of the image: the port buffer is reused by the next read.
+    frame.image.copy(image);
+    frame.stamp=stamp;
+    acquireImage(frame.image,frame.rawImage);
 
-            if(!(
-                    (((uchar*)(rawImage.data + rawImage.step*v))[u*3+0])==255 && (((uchar*)(rawImage.data + rawImage.step*v))[u*3+1])==255 && (((uchar*)(rawImage.data + rawImage.step*v))[u*3+2])==255)
+    if(_colorTransfPolicy==0)
+    {
+        //the worker pool belongs to the filter: the capture stage bins the image by itself.
+        //the whole image: the particles that will read it are still being computed.
+        double stageStart=yarp::os::Time::now();
+        rgbToBinImage(&_lut,(unsigned char*)frame.rawImage->imageData,frame.rawImage->widthStep,frame.rawImage->width,0,frame.rawImage->height,
+                      (unsigned char*)frame.transformedImage->imageData,frame.transformedImage->widthStep);
+        _stats.add(StageStats::ColourTransform,yarp::os::Time::now()-stageStart);
+    }
+}
 
-                )
-            {
+void PF3DTracker::useFrame(int slot)
+{
+    _currentFrame=slot;
+    _yarpImage=&_frameSlots[slot].image;
+    _rawImage=_frameSlots[slot].rawImage;
+    _transformedImage=_frameSlots[slot].transformedImage;
+    _yarpTimestamp=_frameSlots[slot].stamp;
+}
 
-                a=(((uchar*)(transformedImage.data + transformedImage.step*v))[u*3+0]);//Y bin
-                b=(((uchar*)(transformedImage.data + transformedImage.step*v))[u*3+1]);//U bin
-                c=(((uchar*)(transformedImage.data + transformedImage.step*v))[u*3+2]);//V bin
+void PF3DTracker::captureLoop()
+{
+    Stamp stamp;
+    while(true)
+    {
+        ImageOf<PixelRgb> *image=_inputVideoPort.read();
+        if(image==NULL)
+            break; //the port has been interrupted.
+        _inputVideoPort.getEnvelope(stamp);
 
-                //TEST printf("histogram->size[0].step,%d\n",histogram->dim[0].step);  256
-                //TEST printf("histogram->size[1].step,%d\n",histogram->dim[1].step);   32
-                //TEST printf("histogram->size[2].step,%d\n",histogram->dim[2].step);    4
-                *((float*)(histogram->data.ptr + a*histogram->dim[0].step + b*histogram->dim[1].step + c*histogram->dim[2].step)) +=1;
+        int slot=_frames.acquire();
+        if(slot<0)
+            break; //the module is being closed.
+        prepareFrame(_frameSlots[slot],*image,stamp);
+        _frames.push(slot);
+    }
+}
 
-                //initial pointer + Y*UBINS*VBINS*histogram->step + U*VBINS*histogram->step + V*histogram->step. RIGHT?
-                //histogram[(yuvBinsImage[u][v][0])*UBins*VBins + (yuvBinsImage[u][v][1])*VBins +  (yuvBinsImage[u][v][2]) ]+=1; //increment the correct bin counter.
-                usedPoints+=1;
-            }
-        }
+void PF3DTracker::transformImage()
+{
+    _filter.transformImage(_rawImage,_transformedImage);
+}
 
-    //normalize
-    if(usedPoints>0)  
+//the time between the last two images, in frame periods: the motion model moves the particles by this many
+//periods. 1 with framePeriod 0 or without timestamps.
+float PF3DTracker::framePeriods()
+{
+    float periods=1;
+    const double stampTime=_yarpTimestamp.getTime();
+    if(_framePeriod>0 && _yarpTimestamp.isValid() && _lastStampTime>0)
     {
-        //histogram=histogram/usedPoints
-        cvConvertScale( histogram, histogram, 1/usedPoints, 0 );
+        //after a long gap the object is lost anyway: the particles are not scattered over the whole space.
+        periods=(float)((stampTime-_lastStampTime)/_framePeriod);
+        periods=min(max(periods,0.0F),(float)maxFramePeriods);
     }
+    _lastStampTime=stampTime;
+    return periods;
+}
 
-    //write the computed histogram to a file.
-    ofstream fout(dataFileName.c_str());//open file
-    if(!fout)                           //confirm file opened
+//read the image of the right camera, in stereo: the one received last, the two streams are expected to be
+//synchronized by the cameras. the images are paired by read order: when the timestamps are further apart than
+//_stereoStampTolerance the right image is not used, see rightRawImage(). otherwise, with colorTransfPolicy 0,
+//it's transformed as a whole. false if there is no image: the module is being closed.
+bool PF3DTracker::acquireRightImage()
+{
+    _yarpImageRight = _inputVideoPortRight.read();
+    if(_yarpImageRight == NULL)
+        return false;
+
+    Stamp rightStamp;
+    _inputVideoPortRight.getEnvelope(rightStamp);
+    bool inSync=true;
+    double difference=0;
+    if(_stereoStampTolerance>0 && _yarpTimestamp.isValid() && rightStamp.isValid())
     {
-        yWarning("computeTemplateHistogram: unable to open the csv file to store the histogram.");
-        return true;
+        difference=rightStamp.getTime()-_yarpTimestamp.getTime();
+        inSync=(fabs(difference)<=_stereoStampTolerance);
     }
-    else
+    if(inSync!=_rightImageInSync)
     {
-        for(a=0;a<YBins;a++)
-        {
-            for(b=0;b<UBins;b++)
-            {
-                for(c=0;c<VBins;c++)
-                {
-                    fout<<*((float*)(histogram->data.ptr + a*histogram->dim[0].step + b*histogram->dim[1].step + c*histogram->dim[2].step))<<endl;
-                }
-            }
-        }
-        fout.close();
+        //only the changes are logged, not every image.
+        if(inSync)
+            yInfo("The images of the right camera are in sync again: stereo resumed.");
+        else
+            yWarning() << "The right image is "<<difference*1000<<"ms away from the left one: the particles are weighted with the left camera only until the two are in sync.";
     }
+    _rightImageInSync=inSync;
 
-    //clean memory up
-    if (histogram != NULL)
-        cvReleaseMatND(&histogram);
-
-    return false;
-
-}
-
-bool PF3DTracker::readModelHistogram(CvMatND* histogram,const char fileName[])
-{
-    int c1,c2,c3;
-    char line[15];
-
-    ifstream fin(fileName); //open file
-    if(!fin)                //confirm file opened
+    if(_rawImageRight == NULL)
     {
-        yWarning("unable to open the csv histogram file.");
-        return true;
+        if(_zeroCopy)
+            _rawImageRight = cvCreateImageHeader(cvSize(_yarpImageRight->width(),_yarpImageRight->height()),IPL_DEPTH_8U, 3);
+        else
+            _rawImageRight = cvCreateImage(cvSize(_yarpImageRight->width(),_yarpImageRight->height()),IPL_DEPTH_8U, 3);
+        _transformedImageRight = cvCreateImage(cvSize(_yarpImageRight->width(),_yarpImageRight->height()),IPL_DEPTH_8U, 1);
     }
-    else
+    acquireImage(*_yarpImageRight,_rawImageRight);
+
+    if(_colorTransfPolicy==0 && _rightImageInSync)
     {
-        for(c1=0;c1<YBins;c1++) 
-            for(c2=0;c2<UBins;c2++) 
-                for(c3=0;c3<VBins;c3++) 
-                {
-                    fin.getline(line, 14);
-                    *((float*)(histogram->data.ptr + c1*histogram->dim[0].step + c2*histogram->dim[1].step + c3*histogram->dim[2].step))=(float)atof(line);
-                }   
-        return false;
+        _filter.transformImage(_rawImageRight,_transformedImageRight);
     }
+    return true;
 }
 
-bool PF3DTracker::readInitialmodel3dPoints(CvMat* points, string fileName)
+//add an object to track: it gets its own particles and colour model, all the rest comes from the main one.
+//true on failure, like the loaders.
+bool PF3DTracker::addTarget(const string &colorTemplate, const string &dataFileName, const string &shapeTemplate, const string &motionModelMatrix)
 {
-    int c1,c2;
-    char line[15];
-            
-    ifstream fin(fileName.c_str()); //open file
-    if(!fin)                        //confirm file opened
+    TrackedTarget* target=new TrackedTarget;
+    _targets.push_back(target); //released by close(), whatever happens here.
+    ParticleFilter &filter=target->filter;
+
+    if(filter.setResolution(_nPixels,_yBins,_uBins,_vBins) || !filter.allocate(_nParticles,&_lut,&_workers))
     {
-        yWarning("unable to open the the 3D model file.");
+        yWarning() << "I wasn't able to allocate memory for the filter of "<<colorTemplate<<".";
         return true;
     }
-    else
+    if(_minParticles<_nParticles)
     {
-        for(c1=0;c1<3;c1++) 
-            for(c2=0;c2<2*nPixels;c2++) 
-            {
-                fin.getline(line, 14);
-                ((float*)(points->data.ptr + points->step*c1))[c2]=(float)atof(line);
-            }   
-        return false;
+        filter.setAdaptive(_minParticles,_kldError,_kldBinSize);
     }
-}
+    filter.setResamplingScheme(_resamplingScheme);
+    filter.setSeed((unsigned long long)_seed+_targets.size()); //the objects don't share their random numbers.
+    filter.setCoarseToFine(_coarsePixels,_fineFraction);
 
-bool PF3DTracker::readMotionModelMatrix(CvMat* points, string fileName)
-{
-    int c1,c2;
-    char line[15];
-            
-    ifstream fin(fileName.c_str());//open file
-    if(!fin)                           //confirm file opened
+    if(loadColorTemplate(filter,colorTemplate,dataFileName))
     {
-        yWarning("unable to open the motion model file.");
+        yWarning() << "I had troubles computing the template histogram of "<<colorTemplate<<".";
         return true;
     }
-    else
+    if(filter.readModel3dPoints(shapeTemplate) || filter.readMotionModelMatrix(motionModelMatrix))
     {
-        for(c1=0;c1<7;c1++)
-            for(c2=0;c2<7;c2++)
-            {
-                fin.getline(line, 14);
-                cvmSet(points,c1,c2,atof(line));
-            }   
-        return false;
+        yWarning() << "I had troubles reading the shape or the motion model of "<<colorTemplate<<".";
+        return true;
     }
+
+    filter.copyParameters(_filter);
+    filter.initializeParticles();
+    filter.mean(target->x,target->y,target->z);
+    return false;
 }
 
-bool PF3DTracker::evaluateHypothesisPerspective(CvMat* model3dPointsMat,float x, float y, float z, CvMatND* modelHistogramMat, IplImage* transformedImage,  float fx, float fy, float u0, float v0, float inside_outside, float &likelihood)
+//start from the template a previous run adapted, when there is one.
+void PF3DTracker::resumeAdaptedTemplate(ParticleFilter &filter, const string &fileName)
 {
-
-    bool failure;
-    float usedOuterPoints, usedInnerPoints;
-
-    //create a copy of the 3D original points.
-    cvCopy(model3dPointsMat,_drawingMat);
-
-    //****************************
-    //ROTOTRANSLATE THE 3D POINTS.
-    //****************************
-    failure=place3dPointsPerspective(_drawingMat,x,y,z);
-
-    //***********************
-    //PROJECT 3D POINTS TO 2D
-    //***********************
-    failure= perspective_projection(_drawingMat, _perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, _uv)!=0;
-    if(failure)
+    ifstream file(fileName.c_str());
+    if(!file)
     {
-        yWarning("I had troubles projecting the points.");
+        yInfo() << "There is no adapted template in "<<fileName<<": starting from the template image.";
+        return;
     }
-
-    computeHistogram(_uv, transformedImage,  _innerHistogramMat, usedInnerPoints, _outerHistogramMat, usedOuterPoints);
-    //if((usedInnerPoints<nPixels)||(usedOuterPoints<nPixels))
-    //    likelihood=0;
-    //else
-    failure=calculateLikelihood(_modelHistogramMat, _innerHistogramMat,_outerHistogramMat, inside_outside,likelihood);
-
-    likelihood=exp(20*likelihood); //no need to divide: I'm normalizing later.
-
-    //make hypotheses with pixels outside the image less likely.
-    likelihood=likelihood*((float)usedInnerPoints/nPixels)*((float)usedInnerPoints/nPixels)*((float)usedOuterPoints/nPixels)*((float)usedOuterPoints/nPixels);
-
-    return false;
+    file.close();
+    if(filter.readModelHistogram(fileName.c_str()))
+        yWarning() << "I wasn't able to read the adapted template in "<<fileName<<".";
 }
 
-bool PF3DTracker::evaluateHypothesisPerspectiveFromRgbImage(CvMat* model3dPointsMat,float x, float y, float z, CvMatND* modelHistogramMat, IplImage *image,  float fx, float fy, float u0, float v0, float inside_outside, float &likelihood)
+//the template histogram of a colour template, from the cache when the image and the bins didn't change,
+//otherwise computed, written to dataFileName, read back and cached. true on failure, like the loaders.
+bool PF3DTracker::loadColorTemplate(ParticleFilter &filter, const string &colorTemplate, const string &dataFileName)
 {
-//TODO
-
-    bool failure;
-    float usedOuterPoints, usedInnerPoints;
-
-    //create a copy of the 3D original points.
-    cvCopy(model3dPointsMat,_drawingMat);
-
-    //****************************
-    //ROTOTRANSLATE THE 3D POINTS.
-    //****************************
-    failure=place3dPointsPerspective(_drawingMat,x,y,z);
-
-    //***********************
-    //PROJECT 3D POINTS TO 2D
-    //***********************
-    failure= perspective_projection(_drawingMat, _perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, _uv)!=0;
-    if(failure)
+    vector<float> histogram;
+    unsigned long long key=0;
+    if(!_cacheDir.empty())
     {
-        yWarning("I had troubles projecting the points.");
+        key=histogramCacheKey(colorTemplate,_yBins,_uBins,_vBins,_colorLut,_zeroCopy);
+        if(!readCachedHistogram(_cacheDir,key,_yBins*_uBins*_vBins,histogram))
+            return filter.setModelHistogram(histogram);
     }
 
-    computeHistogramFromRgbImage(_uv, image,  _innerHistogramMat, usedInnerPoints, _outerHistogramMat, usedOuterPoints);
-    //if((usedInnerPoints<nPixels)||(usedOuterPoints<nPixels))
-    //    likelihood=0;
-    //else
-    failure=calculateLikelihood(_modelHistogramMat, _innerHistogramMat, _outerHistogramMat, inside_outside,likelihood);
-    
-    likelihood=exp(20*likelihood); //no need to divide: I'm normalizing later.
-    
-    //make hypotheses with pixels outside the image less likely.
-    likelihood=likelihood*((float)usedInnerPoints/nPixels)*((float)usedInnerPoints/nPixels)*((float)usedOuterPoints/nPixels)*((float)usedOuterPoints/nPixels);
-    
+    if(filter.computeTemplateHistogram(colorTemplate,dataFileName,_zeroCopy) || filter.readModelHistogram(dataFileName.c_str()))
+        return true;
+    if(key!=0)
+    {
+        filter.modelHistogram(histogram);
+        if(writeCachedHistogram(_cacheDir,key,histogram))
+            yWarning() << "I wasn't able to cache the template histogram of "<<colorTemplate<<".";
+    }
     return false;
 }
 
-bool PF3DTracker::systematic_resampling(CvMat* oldParticlesState, CvMat* oldParticlesWeights, CvMat* newParticlesState, CvMat* cumWeight)
+//one cycle of the filter of another object, on the current image: the same steps as the main object,
+//without the particles:i port. the motion model is applied by updateModule(), with the next image.
+void PF3DTracker::trackTarget(TrackedTarget &target)
 {
-    //function [newParticlesState] = systematic_resampling(oldParticlesWeight, oldParticlesState)
+    ParticleFilter &filter=target.filter;
+    float sumLikelihood=0.0;
+    float maxLikelihood=0.0;
+    int   maxIndex=-1;
 
-    double u; //random number [0,1)
-    double sum;
-    int c1;
-    int rIndex;  //index of the randomized array
-    int cIndex;  //index of the cumulative weight array. cIndex -1 indicates which particle we think of resampling.
-    int npIndex; //%new particle index, tells me how many particles have been created so far.
-    int numParticlesToGenerate = _nParticles - _numParticlesReceived; //martim
+    filter.evaluate(_rawImage,_transformedImage,sumLikelihood,maxLikelihood,maxIndex,rightRawImage(),rightTransformedImage());
 
-    //%N is the number of particles.
-    //[lines, N] = size(oldParticlesWeight);
-    //in CPP, _nParticles is the number of particles.
-
-    //%NORMALIZE THE WEIGHTS, so that sum(oldParticles)=1.
-    //oldParticlesWeight = oldParticlesWeight / sum(oldParticlesWeight);
-    sum=0;
-    for(c1=0;c1<_nParticles;c1++)
+    target.likelihood=maxLikelihood/exp((float)20.0); //normalizing likelihood
+    if(target.likelihood>_likelihoodThreshold)
     {
-        sum+=((float*)(oldParticlesWeights->data.ptr + oldParticlesWeights->step*0))[c1];
+        target.seeingObject=1;
+        target.framesNotTracking=0;
     }
-    for(c1=0;c1<_nParticles;c1++)
+    else
     {
-        ((float*)(oldParticlesWeights->data.ptr + oldParticlesWeights->step*0))[c1] = (((float*)(oldParticlesWeights->data.ptr + oldParticlesWeights->step*0))[c1])/(float)sum;
+        target.seeingObject=0;
+        target.framesNotTracking+=1;
     }
-
-    //%GENERATE N RANDOM VALUES
-    //u = rand(1)/N; %random value [0,1/N)
-    u=1/(double)numParticlesToGenerate*((double)rand()/(double)RAND_MAX); //martim
-
-    //%the randomized values are going to be u, u+1/N, u+2/N, etc.
-    //%instread of accessing this vector, the elements are computed on the fly:
-    //%randomVector(a)= (a-1)/N+u.
-
-    //%COMPUTE THE ARRAY OF CUMULATIVE WEIGHTS
-    //cumWeight=zeros(1,N+1);
-    //cumWeight[0]=0;
-    ((float*)(cumWeight->data.ptr))[0]=0;
-    for(c1=0;c1<_nParticles;c1++)
+    if(_templateAdaptationRate>0)
     {
-        //cumWeight[c1+1]=cumWeight[c1]+oldParticlesWeight[c1];
-
-        ((float*)(cumWeight->data.ptr))[c1+1]=((float*)(cumWeight->data.ptr))[c1]+((float*)(oldParticlesWeights->data.ptr + oldParticlesWeights->step*0))[c1];
-        //cout<<"cumulative at position "<<c1+1<<" = "<<((float*)(cumWeight->data.ptr))[c1+1]<<endl;
-
+        filter.adaptTemplate(); //the rate and the gate come with copyParameters().
     }
-    //CHECK IF THERE IS SOME ROUNDING ERROR IN THE END OF THE ARRAY.
-    //if(cumWeight[_nParticles]!=1)
-    if(((float*)(cumWeight->data.ptr))[_nParticles]!=1)
+
+    target.predict=false;
+    if(target.framesNotTracking==5 || sumLikelihood==0.0)
     {
-        //fprintf('rounding error?\n');
-        //printf("cumWeight[_nParticles]==%15.10e\n",((float*)(cumWeight->data.ptr))[_nParticles]);
-        ((float*)(cumWeight->data.ptr))[_nParticles]=1;
-        if( ((float*)(cumWeight->data.ptr))[_nParticles]!=1)
-        {
-            //printf("still different\n");
-        }
-        else
-        {
-            //printf("now it-s ok\n");
-        }
+        filter.initializeParticles();
+        target.framesNotTracking=0;
+        filter.mean(target.x,target.y,target.z);
+        return;
     }
 
-    //cout<<"cumulative at position "<<_nParticles-1<<" = "<<((float*)(cumWeight->data.ptr))[_nParticles-1]<<endl;
-    //cout<<"cumulative at position "<<_nParticles<<" = "<<((float*)(cumWeight->data.ptr))[_nParticles]<<endl;
-
-    //%PERFORM THE ACTUAL RESAMPLING
-    rIndex=0; //index of the randomized array
-    cIndex=1; //index of the cumulative weight array. cIndex -1 indicates which particle we think of resampling.
-    npIndex=0; //new particle index, tells me how many particles have been created so far.
-
-    while(npIndex < numParticlesToGenerate) //martim
+    filter.weightedMean(sumLikelihood,target.x,target.y,target.z);
+    int minimum_likelihood=10; //do not resample if maximum likelihood is lower than this.
+    if(maxLikelihood>minimum_likelihood)
     {
-        //siamo sicuri che deve essere >=? ??? !!! WARNING
-        if(((float*)(cumWeight->data.ptr))[cIndex]>=(double)rIndex/(double)numParticlesToGenerate+u) //martim
-        {
-            //%particle cIndex-1 should be copied.
-            //printf("replicating particle %d\n",cIndex-1);
-            //newParticlesState(npIndex)=oldParticlesState(cIndex-1);
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*0))[npIndex]=((float*)(oldParticlesState->data.ptr + oldParticlesState->step*0))[cIndex-1];
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*1))[npIndex]=((float*)(oldParticlesState->data.ptr + oldParticlesState->step*1))[cIndex-1];
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*2))[npIndex]=((float*)(oldParticlesState->data.ptr + oldParticlesState->step*2))[cIndex-1];
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*3))[npIndex]=((float*)(oldParticlesState->data.ptr + oldParticlesState->step*3))[cIndex-1];
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*4))[npIndex]=((float*)(oldParticlesState->data.ptr + oldParticlesState->step*4))[cIndex-1];
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*5))[npIndex]=((float*)(oldParticlesState->data.ptr + oldParticlesState->step*5))[cIndex-1];
-            ((float*)(newParticlesState->data.ptr + newParticlesState->step*6))[npIndex]=0; //initializing weight
-            rIndex=rIndex+1;
-            npIndex=npIndex+1;
-        }
-        else
-        {
-            //printf("not replicating particle %d\n",cIndex-1);
-            cIndex=cIndex+1;
-        }
+        filter.resample(0,target.framesNotTracking>0);
     }
-
-    return false;
+    else if(target.framesNotTracking>0)
+    {
+        filter.grow();
+    }
+    target.predict=true; //see updateModule().
 }
 
-bool PF3DTracker::systematicR(CvMat* inState, CvMat* weights, CvMat* outState)
+void PF3DTracker::drawSampledLinesPerspectiveYARP(CvMat* model3dPointsMat, float x, float y, float z, ImageOf<PixelRgb> *image,float _perspectiveFx,float  _perspectiveFy ,float _perspectiveCx,float  _perspectiveCy ,int R, int G, int B, float &meanU, float &meanV)
 {
-    float N=(float)_nParticles;
-    float s=1.0F/N;
-
-    cvZero(_nChildren);
-
-    cvCopy(_ramp,_label); //label should be like: 1,2,3,4,5,6...
 
-    float auxw=0;
-    int li=0; //label of the current point
+    //***********************************************************
+    //PLACE THE 3D POINTS IN FRONT OF THE CAMERA AND PROJECT THEM
+    //***********************************************************
+    //drawing happens after the particles have been evaluated, so the filter workspaces are free.
+    const float* u;
+    const float* v;
+    _filter.projectContour(model3dPointsMat,x,y,z,u,v);
 
-    //initialization
-    float T;
-    T=s*((float)rand()/(float)RAND_MAX); //random number between 0 and s.
-
-    int j=1;
-    float Q=0;
-    int i=0;
-
-    cvRandArr( &rngState, _u, CV_RAND_UNI, cvScalar(0), cvScalar(1));
-
-    while((T<1)  && (i<_nParticles)) //the second part of the condition is a hack:
-                                     // the loop sometimes doesn't stop without it.
+    //DRAW    
+    int conta,uPosition,vPosition;
+    PixelRgb colour=drawingColour(R,G,B);
+    meanU=0;
+    meanV=0;
+    for(conta=0;conta<_nPixels;conta++)
     {
-        if((Q>T) && (i<_nParticles))//the second part of the condition is a hack:
-                                    // the loop sometimes doesn't stop without it.
-        {
-            T=T+s;
+        meanU=meanU+u[conta];
+        meanV=meanV+v[conta];
 
-            ((float*)(_nChildren->data.ptr))[li-1]+=1;
+        vPosition= (int)v[conta];
+        uPosition= (int)u[conta];
+        if((uPosition<_rawImage->width)&&(uPosition>=0)&&(vPosition<_rawImage->height)&&(vPosition>=0))
+        {
+            image->pixel(uPosition,vPosition)= colour;
         }
-        else //the first time it passes by here.
+        vPosition= (int)v[conta+_nPixels];
+        uPosition= (int)u[conta+_nPixels];
+        if((uPosition<_rawImage->width)&&(uPosition>=0)&&(vPosition<_rawImage->height)&&(vPosition>=0))
         {
-            i=(int)(floor((N-j+1)*(((float*)(_u->data.ptr))[j-1]))+j); //De Freitas uses "fix" in matlab... I guess floor should do, in this case. MAYBE NOT?
-
-            auxw=((float*)(weights->data.ptr))[i-1];
-
-            li=(int)((float*)(_label->data.ptr))[i-1]; //C'E' QUALCOSA CHE NON VA QUI.
-            Q=Q+auxw;
-
-            ((float*)(weights->data.ptr))[i-1]=((float*)(weights->data.ptr))[j-1];
-            ((float*)(_label->data.ptr))[i-1] = ((float*)(_label->data.ptr))[j-1];
-            j=j+1;
+            image->pixel(uPosition,vPosition)= colour;
         }
+
     }
 
-    //COPY STUFF. I SHOULD COPY THE STATE OF THE PARTICLES, HERE.
-    int index=1;
-    for(i=0;i<N;i++)
+    meanU=floor(meanU/_nPixels);
+    meanV=floor(meanV/_nPixels);
+    if((meanU<_rawImage->width)&&(meanU>=0)&&(meanV<_rawImage->height)&&(meanV>=0))
     {
-        if(((float*)(_nChildren->data.ptr))[i]>0)
-        {
-            for(j=index;(j<index+((float*)(_nChildren->data.ptr))[i])&&(j<_nParticles+1);j++)  //WARNING: ??? !!! I MIGHT WELL HAVE MESSED SOMETHING UP HERE.
-            {   
-                ((float*)(outState->data.ptr + outState->step*0))[j-1]=((float*)(inState->data.ptr + inState->step*0))[i];
-                ((float*)(outState->data.ptr + outState->step*1))[j-1]=((float*)(inState->data.ptr + inState->step*1))[i];
-                ((float*)(outState->data.ptr + outState->step*2))[j-1]=((float*)(inState->data.ptr + inState->step*2))[i];
-                ((float*)(outState->data.ptr + outState->step*3))[j-1]=((float*)(inState->data.ptr + inState->step*3))[i];
-                ((float*)(outState->data.ptr + outState->step*4))[j-1]=((float*)(inState->data.ptr + inState->step*4))[i];
-                ((float*)(outState->data.ptr + outState->step*5))[j-1]=((float*)(inState->data.ptr + inState->step*5))[i];
-            }
-        }
-        index=index+(int)((float*)(_nChildren->data.ptr))[i];
+        image->pixel((int)meanU,(int)meanV)= colour;
     }
 
-    return false;
 }
 
-bool PF3DTracker::place3dPointsPerspective(CvMat* points, float x, float y, float z)
+PixelRgb PF3DTracker::drawingColour(int R, int G, int B)
 {
-    //*********************
-    // 0. Prepare some data
-    //*********************
-    float floorDistance=sqrt(x*x+y*y);      //horizontal distance from the optical center to the ball
-    float distance=sqrt(x*x+y*y+z*z);       //distance from the optical center to the ball
-
-    float cosAlpha=floorDistance/distance;  //cosine of an angle needed for a rotation
-    float sinAlpha=-z/distance;             //sine of an angle needed for a rotation
-    float cosBeta=x/floorDistance;          //cosine of an angle needed for a rotation
-    float sinBeta=y/floorDistance;          //sine of an angle needed for a rotation
-
-    //Rotation matrix Rz: [3 x 3]
-    ((float*)(_rzMat->data.ptr + _rzMat->step*0))[0]=  cosBeta;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*0))[1]= -sinBeta;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*0))[2]=        0;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*1))[0]=  sinBeta;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*1))[1]=  cosBeta;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*1))[2]=        0;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*2))[0]=        0;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*2))[1]=        0;
-    ((float*)(_rzMat->data.ptr + _rzMat->step*2))[2]=        1;
-
-    //Rotation matrix Ry: [3 x 3]
-    ((float*)(_ryMat->data.ptr + _ryMat->step*0))[0]=  cosAlpha;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*0))[1]=         0;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*0))[2]=  sinAlpha;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*1))[0]=         0;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*1))[1]=         1;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*1))[2]=         0;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*2))[0]= -sinAlpha;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*2))[1]=         0;
-    ((float*)(_ryMat->data.ptr + _ryMat->step*2))[2]=  cosAlpha;
-
-    //***********************************
-    // 1. Rotate points around the Y axis
-    //***********************************
-    //Multiply Ry by points
-    //_points2Mat=_ryMat*points     [3 x 2*nPixels]
-    cvMatMul(_ryMat,points,_points2Mat);
-
-    //*****************************************
-    // 2. Apply a vertical and horizontal shift
-    //*****************************************
-    //sum floorDistance to all the elements in the first row of "points2".
-    cvSet(_tempMat1,cvScalar(floorDistance)); //set all elements of _tempMat1 to the value of "floorDistance"
-    cvAdd(_p2Mat1,_tempMat1,_p2Mat1);         //_p2Mat1=_p2Mat1+_tempMat1.
-
-    //sum z to the third row of "points2".
-    cvSet(_tempMat3,cvScalar(z)); //set all elements of _tempMat3 to the value of "z"
-    cvAdd(_p2Mat3,_tempMat3,_p2Mat3);         //_p2Mat3=_p2Mat3+_tempMat3.
-
-    //**********************************
-    //3. Rotate points around the Z axis
-    //**********************************
-    //Multiply RZ by "points2", put the result in "points"
-    //points=_rzMat*_points2Mat     [3 x 2*nPixels]
-    cvMatMul(_rzMat,_points2Mat,points);
-
-    return false;
+    //by default the drawing goes on the image that went through toCvMat(), BGR data: the colour is written as
+    //(B,G,R), as it always was. only the zero-copy path draws on the RGB buffer of the output port, in RGB order.
+    if(!_zeroCopy)
+        return PixelRgb(B,G,R);
+    return PixelRgb(R,G,B);
 }
 
-
-int PF3DTracker::perspective_projection(CvMat* xyz, float fx, float fy, float cx, float cy, CvMat* uv)
-{
-    //fill the projection matrix with the current values.
-    ((float*)(_projectionMat->data.ptr + _projectionMat->step*0))[0]= fx;
-    ((float*)(_projectionMat->data.ptr + _projectionMat->step*0))[1]=  0;
-    ((float*)(_projectionMat->data.ptr + _projectionMat->step*0))[2]= cx;
-    ((float*)(_projectionMat->data.ptr + _projectionMat->step*1))[0]=  0;
-    ((float*)(_projectionMat->data.ptr + _projectionMat->step*1))[1]= fy;
-    ((float*)(_projectionMat->data.ptr + _projectionMat->step*1))[2]= cy;
-
-//     int a,b;
-//     for(a=0;a<2;a++)
-//     {
-//         cout<<"LINE ";
-//         for(b=0;b<3;b++)
-//         {
-//             cout<<((float*)(_projectionMat->data.ptr + _projectionMat->step*a))[b]<<",";
-//         }
-//         cout<<"\n";
-//     }
-//     cout<<"\n";
-
-//     for(a=0;a<3;a++)
-//     {
-//         cout<<"LINE ";
-//         for(b=0;b<2*nPixels;b++)
-//         {
-//             cout<<((float*)(xyz->data.ptr + xyz->step*a))[b]<<",";
-//         }
-//         cout<<"\n";
-//     }
-//     cout<<"\n";
-
-    //#####################################################
-    //For every column of XYZ, divide each element by Z(i).
-    //#####################################################
-    //setup
-
-    cvInitMatHeader( _xyzMat1, 1, 2*nPixels, CV_32FC1, xyz->data.ptr );
-    cvInitMatHeader( _xyzMat2, 1, 2*nPixels, CV_32FC1, xyz->data.ptr + xyz->step*1);
-    cvInitMatHeader( _xyzMat3, 1, 2*nPixels, CV_32FC1, xyz->data.ptr + xyz->step*2);
-
-    //divide X (the first line of xyz) by Z (the third line of xyz).
-    cvDiv( _xyzMat1, _xyzMat3, _xyzMat1, 1 );
-
-//     for(a=0;a<3;a++)
-//     {
-//         cout<<"LINE ";
-//         for(b=0;b<2*nPixels;b++)
-//         {
-//             cout<<((float*)(xyz->data.ptr + xyz->step*a))[b]<<",";
-//         }
-//         cout<<"\n";
-//     }
-//     cout<<"\n";
-
-    //divide Y (the second line of xyz) by Z (the third line of xyz).
-    cvDiv( _xyzMat2, _xyzMat3, _xyzMat2, 1 );
-
-//     for(a=0;a<3;a++)
-//     {
-//         cout<<"LINE ";
-//         for(b=0;b<2*nPixels;b++)
-//         {
-//             cout<<((float*)(xyz->data.ptr + xyz->step*a))[b]<<",";
-//         }
-//         cout<<"\n";
-//     }
-//     cout<<"\n";
-
-    //set all elements of Z to 1.
-    cvSet(_xyzMat3,(cvScalar(1)));
-
-//     for(a=0;a<3;a++)
-//     {
-//         cout<<"LINE ";
-//         for(b=0;b<2*nPixels;b++)
-//         {
-//             cout<<((float*)(xyz->data.ptr + xyz->step*a))[b]<<",";
-//         }
-//         cout<<"\n";
-//     }
-//     cout<<"\n";
-
-    //#########################
-    //UV=projectionMat*(XYZ/Z).
-    //#########################
-    cvMatMul(_projectionMat,xyz,uv);
-
-/*    for(a=0;a<2;a++)
-    {
-        cout<<"LINE ";
-        for(b=0;b<2*nPixels;b++)
-        {
-            cout<<((float*)(_uv->data.ptr + _uv->step*a))[b]<<",";
-        }
-        cout<<"\n";
-    }
-    cout<<"\n";*/
-    return 0;
-    
-}        
-
-bool PF3DTracker::computeHistogram(CvMat* uv, IplImage* transformedImage,  CvMatND* innerHistogramMat, float &usedInnerPoints, CvMatND* outerHistogramMat, float &usedOuterPoints)
+void PF3DTracker::drawContourPerspectiveYARP(CvMat* model3dPointsMat,float x, float y, float z, ImageOf<PixelRgb> *image,float _perspectiveFx,float  _perspectiveFy ,float _perspectiveCx,float  _perspectiveCy ,int R, int G, int B, float &meanU, float &meanV)
 {
-    int count;
-    int u, v, a, b, c;
 
-    usedInnerPoints=0;
-    cvSetZero(innerHistogramMat);
-    
-    for(count=0;count<nPixels;count++)
-    {
-        u=(int)((float*)(uv->data.ptr + uv->step*0))[count]; //truncating ??? !!! warning
-        v=(int)((float*)(uv->data.ptr + uv->step*1))[count]; //truncating ??? !!! warning
-        if((v<transformedImage->height)&&(v>=0)&&(u<transformedImage->width)&&(u>=0))
-        {
-            a=(((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u*3+0]);//Y bin
-            b=(((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u*3+1]);//U bin
-            c=(((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u*3+2]);//V bin
-            *((float*)(innerHistogramMat->data.ptr + a*innerHistogramMat->dim[0].step + b*innerHistogramMat->dim[1].step + c*innerHistogramMat->dim[2].step)) +=1;
-            usedInnerPoints+=1;
-        }
-    }
-
-    if(usedInnerPoints>0)
-    {
-        cvConvertScale(innerHistogramMat, innerHistogramMat, 1/usedInnerPoints, 0 );
-    }
+    //***********************************************************
+    //PLACE THE 3D POINTS IN FRONT OF THE CAMERA AND PROJECT THEM
+    //***********************************************************
+    //drawing happens after the particles have been evaluated, so the filter workspaces are free.
+    const float* u;
+    const float* v;
+    _filter.projectContour(model3dPointsMat,x,y,z,u,v);
 
-    usedOuterPoints=0;
-    cvSetZero(outerHistogramMat);
-    for(count=nPixels;count<2*nPixels;count++)
-    {
-        u=(int)((float*)(uv->data.ptr + uv->step*0))[count]; //truncating ??? !!! warning
-        v=(int)((float*)(uv->data.ptr + uv->step*1))[count]; //truncating ??? !!! warning
-        if((v<transformedImage->height)&&(v>=0)&&(u<transformedImage->width)&&(u>=0))
-        {
-            a=(((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u*3+0]);//Y bin
-            b=(((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u*3+1]);//U bin
-            c=(((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u*3+2]);//V bin
-            *((float*)(outerHistogramMat->data.ptr + a*outerHistogramMat->dim[0].step + b*outerHistogramMat->dim[1].step + c*outerHistogramMat->dim[2].step)) +=1;
-            usedOuterPoints+=1;
-        }
-    }
-    if(usedOuterPoints>0)
+    //****
+    //Draw
+    //****
+    int conta,cippa,lippa,uPosition,vPosition;
+    PixelRgb colour=drawingColour(R,G,B);
+    meanU=0;
+    meanV=0;
+    for(conta=0;conta<_nPixels;conta++)
     {
-        cvConvertScale(outerHistogramMat, outerHistogramMat, 1/usedOuterPoints, 0 );
-    }
+        meanV=meanV+v[conta];
+        meanU=meanU+u[conta];
 
-    return false;
-}
+        for(lippa=-2;lippa<3;lippa++)
+            for(cippa=-2;cippa<3;cippa++)
+            {
+                vPosition= (int)(v[conta])+lippa-1;
+                uPosition= (int)(u[conta])+cippa-1;
 
-bool PF3DTracker::computeHistogramFromRgbImage(CvMat* uv, IplImage *image,  CvMatND* innerHistogramMat, float &usedInnerPoints, CvMatND* outerHistogramMat, float &usedOuterPoints)
-{
-    int count;
-    int u,v;
-    int r,g,b;
-    int index;
-
-    ////////
-    //INNER/
-    ////////
-    usedInnerPoints=0;
-    cvZero(innerHistogramMat);
-    for(count=0;count<nPixels;count++)
-    {
-        u=(int)((float*)(uv->data.ptr + uv->step*0))[count]; //truncating ??? !!! warning
-        v=(int)((float*)(uv->data.ptr + uv->step*1))[count]; //truncating ??? !!! warning
-        if((v<image->height)&&(v>=0)&&(u<image->width)&&(u>=0))
-        {
-            //transform the color from RGB to HSI bin.
-            r=(((uchar*)(image->imageData + image->widthStep*v))[u*3+0]);
-            g=(((uchar*)(image->imageData + image->widthStep*v))[u*3+1]);
-            b=(((uchar*)(image->imageData + image->widthStep*v))[u*3+2]);
-            index=r*65536+g*256+b;
-            //increase the bin counter
-            *((float*)(innerHistogramMat->data.ptr + _lut[index].y*innerHistogramMat->dim[0].step + _lut[index].u*innerHistogramMat->dim[1].step + _lut[index].v*innerHistogramMat->dim[2].step)) +=1;
-            usedInnerPoints+=1;
-        }
-    }
+                if((uPosition<_rawImage->width)&&(uPosition>=0)&&(vPosition<_rawImage->height)&&(vPosition>=0))
+                {
+                    image->pixel(uPosition,vPosition)= colour;
+                }
 
-    //cout<<"inner points="<<usedInnerPoints<<endl;
-    if(usedInnerPoints>0)
-    {
-        cvConvertScale( innerHistogramMat, innerHistogramMat, 1/usedInnerPoints, 0 );
+            }
     }
 
-    ////////
-    //OUTER/
-    ////////
-    usedOuterPoints=0;
-    cvZero(outerHistogramMat);
-    for(count=nPixels;count<2*nPixels;count++)
-    {
-        u=(int)((float*)(uv->data.ptr + uv->step*0))[count]; //truncating ??? !!! warning
-        v=(int)((float*)(uv->data.ptr + uv->step*1))[count]; //truncating ??? !!! warning
-        if((v<image->height)&&(v>=0)&&(u<image->width)&&(u>=0))
-        {
-            //transform the color from RGB to HSI bin.
-            r=(((uchar*)(image->imageData + image->widthStep*v))[u*3+0]);
-            g=(((uchar*)(image->imageData + image->widthStep*v))[u*3+1]);
-            b=(((uchar*)(image->imageData + image->widthStep*v))[u*3+2]);
-            index=r*65536+g*256+b;
-            //increase the bin counter
-            *((float*)(outerHistogramMat->data.ptr + _lut[index].y*outerHistogramMat->dim[0].step + _lut[index].u*outerHistogramMat->dim[1].step + _lut[index].v*outerHistogramMat->dim[2].step)) +=1;
-            usedOuterPoints+=1;
-        }
-    }
-    if(usedOuterPoints>0)
+    meanU=floor(meanU/_nPixels);
+    meanV=floor(meanV/_nPixels);
+    if((meanU<_rawImage->width)&&(meanU>=0)&&(meanV<_rawImage->height)&&(meanV>=0))
     {
-        cvConvertScale( outerHistogramMat, outerHistogramMat, 1/usedOuterPoints, 0 );
+        image->pixel((int)meanU,(int)meanV)= colour;
     }
 
-    return false;
-}
-
-bool PF3DTracker::calculateLikelihood(CvMatND* templateHistogramMat, CvMatND* innerHistogramMat, CvMatND* outerHistogramMat, float inside_outside, float &likelihood)
-{
-    likelihood=0;
-    int a,b,c;
-    for(a=0;a<YBins;a++)
-        for(b=0;b<UBins;b++)
-            for(c=0;c<VBins;c++)
-            {
-                likelihood=likelihood + sqrt( 
-                *((float*)(innerHistogramMat->data.ptr + a*innerHistogramMat->dim[0].step + b*innerHistogramMat->dim[1].step + c*innerHistogramMat->dim[2].step)) *
-                *((float*)(templateHistogramMat->data.ptr + a*templateHistogramMat->dim[0].step + b*templateHistogramMat->dim[1].step + c*templateHistogramMat->dim[2].step)))
-                - _inside_outside_difference_weight*sqrt(
-                *((float*)(outerHistogramMat->data.ptr + a*outerHistogramMat->dim[0].step + b*outerHistogramMat->dim[1].step + c*outerHistogramMat->dim[2].step)) *
-                *((float*)(innerHistogramMat->data.ptr + a*innerHistogramMat->dim[0].step + b*innerHistogramMat->dim[1].step + c*innerHistogramMat->dim[2].step)));
-
-             }
-    likelihood=(likelihood+_inside_outside_difference_weight)/(1+_inside_outside_difference_weight);
-    if(likelihood<0)
-        yWarning("LIKELIHOOD<0!!!");
-    return false;
 }
 
 bool PF3DTracker::testOpenCv()
@@ -1925,12 +1910,14 @@ bool PF3DTracker::testOpenCv()
     type=CV_32FC1; //32 bits, signed, one channel.
     CvMat* points;
 
-    points = cvCreateMat( 3, 2*nPixels, type );
-    readInitialmodel3dPoints(points, "models/initial_ball_points_46mm_30percent.csv");
+    points = cvCreateMat( 3, 2*_nPixels, type );
+    failure = _filter.readInitialmodel3dPoints(points, "models/initial_ball_points_46mm_30percent.csv");
 
-    failure = place3dPointsPerspective(points,100,200,1000); //Funziona...
+    const float* u;
+    const float* v;
+    _filter.projectContour(points,100,200,1000,u,v); //Funziona...
 
-    failure = perspective_projection(points, _perspectiveFx, _perspectiveFy, _perspectiveCx, _perspectiveCy, _uv)!=0;
+    cvReleaseMat(&points);
 
     return true;
 
@@ -0,0 +1,301 @@
+/**
+*
+* Startup cache of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <sstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <yarp/os/Log.h>
+#include <yarp/os/LogStream.h>
+
+#include <iCub/pf3dTrackerCache.hpp>
+
+using namespace std;
+
+//the header of the look up table files, followed by the table.
+struct LutCacheHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int type;
+    unsigned int yBins; //the finest bins, the ones of the table.
+    unsigned int uBins;
+    unsigned int vBins;
+    unsigned int tableSize;
+};
+
+//the header of the histogram files, followed by the values.
+struct HistogramCacheHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int nValues;
+    unsigned long long key;
+};
+
+MappedFile::MappedFile() : _data(NULL), _size(0), _mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const string &fileName)
+{
+    close();
+
+#ifndef _WIN32
+    int descriptor=::open(fileName.c_str(),O_RDONLY);
+    if(descriptor<0)
+        return false;
+    struct stat status;
+    if(fstat(descriptor,&status)==0 && status.st_size>0)
+    {
+        void* mapping=mmap(NULL,(size_t)status.st_size,PROT_READ,MAP_PRIVATE,descriptor,0);
+        if(mapping!=MAP_FAILED)
+        {
+            _data=(const unsigned char*)mapping;
+            _size=(size_t)status.st_size;
+            _mapped=true;
+        }
+    }
+    ::close(descriptor); //the mapping stays valid.
+    if(_mapped)
+        return true;
+#endif
+
+    //no mapping: the whole file is read.
+    FILE* file=fopen(fileName.c_str(),"rb");
+    if(file==NULL)
+        return false;
+    fseek(file,0,SEEK_END);
+    long size=ftell(file);
+    fseek(file,0,SEEK_SET);
+    unsigned char* buffer=(size>0) ? new (std::nothrow) unsigned char[size] : NULL;
+    if(buffer!=NULL && fread(buffer,1,(size_t)size,file)==(size_t)size)
+    {
+        _data=buffer;
+        _size=(size_t)size;
+    }
+    else
+    {
+        delete[] buffer;
+    }
+    fclose(file);
+    return _data!=NULL;
+}
+
+void MappedFile::close()
+{
+    if(_data!=NULL)
+    {
+#ifndef _WIN32
+        if(_mapped)
+            munmap((void*)_data,_size);
+        else
+#endif
+            delete[] _data;
+    }
+    _data=NULL;
+    _size=0;
+    _mapped=false;
+}
+
+//write a header and a payload to fileName through a temporary file: a crash while writing leaves
+//no truncated file behind. false if the file couldn't be written.
+static bool writeAtomically(const string &fileName, const void* header, size_t headerSize, const void* payload, size_t payloadSize)
+{
+    string temporaryName=fileName+".tmp";
+    FILE* file=fopen(temporaryName.c_str(),"wb");
+    if(file==NULL)
+        return false;
+    bool ok=(fwrite(header,1,headerSize,file)==headerSize && fwrite(payload,1,payloadSize,file)==payloadSize);
+    ok=(fclose(file)==0) && ok;
+    if(ok && rename(temporaryName.c_str(),fileName.c_str())!=0)
+    {
+        //rename doesn't replace an existing file everywhere.
+        remove(fileName.c_str());
+        ok=(rename(temporaryName.c_str(),fileName.c_str())==0);
+    }
+    if(!ok)
+        remove(temporaryName.c_str());
+    return ok;
+}
+
+static size_t lutTableSize(int type)
+{
+    if(type==LUT_PACKED)
+        return 256*256*256;
+    if(type==LUT_QUANTIZED)
+        return 32*64*32;
+    return 0;
+}
+
+//a few entries of a table against the same entries computed now, as fillLut() does: a table written by a
+//build that bins the colours differently doesn't match.
+static bool lutMatches(int type, const unsigned char* table)
+{
+    int count;
+    if(type==LUT_PACKED)
+    {
+        unsigned char R[256], G[256], B[256], bins[256];
+        Lut direct={LUT_DIRECT,NULL};
+        for(count=0;count<256;count++)
+            B[count]=(unsigned char)count;
+        for(count=0;count<16;count++)
+        {
+            const int r=(count*67+13)&255;
+            const int g=(count*151+101)&255;
+            memset(R,r,256);
+            memset(G,g,256);
+            lutBins(&direct,R,G,B,256,bins);
+            if(memcmp(bins,table+r*65536+g*256,256)!=0)
+                return false;
+        }
+        return true;
+    }
+    for(count=0;count<(int)lutTableSize(type);count+=61)
+    {
+        const int r=count>>11, g=(count>>5)&63, b=count&31;
+        if(table[count]!=rgbToBin((r<<3)+4,(g<<2)+2,(b<<3)+4))
+            return false;
+    }
+    return true;
+}
+
+bool createCachedLut(Lut *lut, int type, const string &directory, MappedFile &file)
+{
+    file.close();
+    const size_t tableSize=lutTableSize(type);
+    if(directory.empty() || tableSize==0)
+        return createLut(lut,type);
+
+    stringstream fileName;
+    fileName<<directory<<"/pf3dTrackerLut"<<type<<".bin";
+    if(file.open(fileName.str()))
+    {
+        const LutCacheHeader* header=(const LutCacheHeader*)file.data();
+        if(file.size()==sizeof(LutCacheHeader)+tableSize &&
+           memcmp(header->magic,LutCacheMagic,8)==0 && header->version==CacheVersion && header->type==(unsigned int)type &&
+           header->yBins==YBins && header->uBins==UBins && header->vBins==VBins && header->tableSize==tableSize &&
+           lutMatches(type,file.data()+sizeof(LutCacheHeader)))
+        {
+            //the table is only read: it stays in the mapping, shared with the page cache.
+            lut->type=type;
+            lut->table=const_cast<unsigned char*>(file.data()+sizeof(LutCacheHeader));
+            return true;
+        }
+        file.close();
+        yWarning() << "The color look up table in "<<fileName.str()<<" is stale, it is computed again.";
+    }
+
+    if(!createLut(lut,type))
+        return false;
+    LutCacheHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,LutCacheMagic,8);
+    header.version=CacheVersion;
+    header.type=type;
+    header.yBins=YBins;
+    header.uBins=UBins;
+    header.vBins=VBins;
+    header.tableSize=(unsigned int)tableSize;
+    if(!writeAtomically(fileName.str(),&header,sizeof(header),lut->table,tableSize))
+        yWarning() << "I wasn\'t able to write the color look up table to "<<fileName.str()<<".";
+    return true;
+}
+
+void releaseCachedLut(Lut *lut, MappedFile &file)
+{
+    if(file.isOpen())
+        lut->table=NULL; //it belongs to the mapping.
+    else
+        releaseLut(lut);
+    file.close();
+}
+
+//FNV-1a, 64 bits.
+static void checksum(unsigned long long &hash, const void* data, size_t size)
+{
+    const unsigned char* bytes=(const unsigned char*)data;
+    for(size_t count=0;count<size;count++)
+    {
+        hash^=bytes[count];
+        hash*=1099511628211ULL;
+    }
+}
+
+unsigned long long histogramCacheKey(const string &imageFileName, int yBins, int uBins, int vBins, int lutType, bool rgbImages)
+{
+    unsigned long long hash=14695981039346656037ULL;
+    const int parameters[6]={CacheVersion,yBins,uBins,vBins,lutType,rgbImages ? 1 : 0};
+    checksum(hash,parameters,sizeof(parameters));
+
+    FILE* file=fopen(imageFileName.c_str(),"rb");
+    if(file==NULL)
+        return 0;
+    unsigned char buffer[65536];
+    size_t read;
+    while((read=fread(buffer,1,sizeof(buffer),file))>0)
+        checksum(hash,buffer,read);
+    fclose(file);
+    return (hash!=0) ? hash : 1;
+}
+
+static string histogramFileName(const string &directory, unsigned long long key)
+{
+    stringstream fileName;
+    fileName<<directory<<"/pf3dTrackerHistogram_"<<hex<<key<<".bin";
+    return fileName.str();
+}
+
+bool readCachedHistogram(const string &directory, unsigned long long key, int nValues, vector<float> &values)
+{
+    if(directory.empty() || key==0)
+        return true;
+
+    //the histograms are small: they are read, not mapped.
+    FILE* file=fopen(histogramFileName(directory,key).c_str(),"rb");
+    if(file==NULL)
+        return true;
+    HistogramCacheHeader header;
+    values.resize(nValues);
+    bool ok=(fread(&header,sizeof(header),1,file)==1 &&
+             memcmp(header.magic,HistogramCacheMagic,8)==0 && header.version==CacheVersion &&
+             header.nValues==(unsigned int)nValues && header.key==key &&
+             fread(&values[0],sizeof(float),nValues,file)==(size_t)nValues);
+    fclose(file);
+    return !ok;
+}
+
+bool writeCachedHistogram(const string &directory, unsigned long long key, const vector<float> &values)
+{
+    if(directory.empty() || key==0 || values.empty())
+        return true;
+
+    HistogramCacheHeader header;
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,HistogramCacheMagic,8);
+    header.version=CacheVersion;
+    header.nValues=(unsigned int)values.size();
+    header.key=key;
+    return !writeAtomically(histogramFileName(directory,key),&header,sizeof(header),&values[0],sizeof(float)*values.size());
+}
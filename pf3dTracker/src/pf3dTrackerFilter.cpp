@@ -0,0 +1,1550 @@
+/**
+*
+* Filter core of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#include <opencv2/core/core_c.h>
+
+#include <yarp/os/Log.h>
+#include <yarp/os/LogStream.h>
+
+#include <iCub/pf3dTrackerFilter.hpp>
+#include <iCub/pf3dTrackerRandom.hpp>
+
+using namespace std;
+
+//the streams of random numbers of the filter, see pf3dTrackerRandom.hpp.
+enum RandomStream
+{
+    InitialPositionStream=0,     //three streams, one per axis.
+    InitialVelocityStream=3,     //three streams.
+    AccelerationStream=6,        //three streams.
+    ResamplingStream=9
+};
+
+ParticleFilter::ParticleFilter()
+{
+    _lut=NULL;
+    _workers=NULL;
+    _seed=0;
+    _draw=0;
+    _coarseStep=1;
+    _fineFraction=1;
+    _nParticles=0;
+    _maxParticles=0;
+    _minParticles=0;
+    _kldError=0.05F;
+    _kldBinSize=20;
+    _accelStDev=150;
+    _inside_outside_difference_weight=1.5;
+    _colorTransfPolicy=1;
+    _perspectiveFx=257.34F;
+    _perspectiveFy=257.34F;
+    _perspectiveCx=160.0F;
+    _perspectiveCy=120.0F;
+    _stereo=false;
+    _initialX=0;
+    _initialY=0;
+    _initialZ=1000;
+    _A=NULL;
+    _modelHistogramMat=NULL;
+    _sqrtModelHistogram=NULL;
+    _model3dPointsMat=NULL;
+    _nPixels=50;
+    _yBins=YBins;
+    _uBins=UBins;
+    _vBins=VBins;
+    _remapBins=false;
+    for(int bin=0;bin<HistogramBins;bin++)
+        _binMap[bin]=(unsigned char)bin;
+    _uvStride=((2*_nPixels+15)/16)*16;
+    _resamplingScheme=Resampler::Systematic;
+    _uniforms=NULL;
+    _wholeImage=true;
+    _scoringMode=0;
+    _adaptationRate=0;
+    _adaptationGate=0;
+    _sphereFastPath=true;
+    _sphereModel=false;
+    _innerRadius=0;
+    _outerRadius=0;
+    _scoreImages[0]=NULL;
+    _scoreImages[1]=NULL;
+}
+
+ParticleFilter::~ParticleFilter()
+{
+    release();
+}
+
+bool ParticleFilter::allocate(int nParticles, const Lut *lut, WorkerPool *workers)
+{
+    bool ok=true;
+    int count;
+
+    release();
+    _nParticles=nParticles;
+    _maxParticles=nParticles;
+    _minParticles=nParticles; //no adaptation, unless setAdaptive() is called.
+    _lut=lut;
+    _workers=workers;
+
+    //colour histograms.
+    int dimensions;
+    dimensions=3;
+    int sizes[3]={_yBins,_uBins,_vBins};
+    _modelHistogramMat=cvCreateMatND(dimensions, sizes, CV_32FC1);
+    _sqrtModelHistogram=(float*)alignedMalloc(sizeof(float)*HistogramBins);
+    if(_sqrtModelHistogram!=NULL)
+        memset(_sqrtModelHistogram,0,sizeof(float)*HistogramBins);
+
+    //shape and motion models.
+    _uvStride=((2*_nPixels+15)/16)*16;
+    _model3dPointsMat=cvCreateMat(3, 2*_nPixels, CV_32FC1);
+    _A=cvCreateMat(7,7,CV_32FC1); //32bit floats, one channel.
+    if(_modelHistogramMat==0 || _sqrtModelHistogram==NULL || _model3dPointsMat==0 || _A==0)
+        ok=false;
+
+    //the particles and the "new" particles (the second buffer).
+    if(!_particles.allocate(_nParticles) || !_newParticles.allocate(_nParticles))
+        ok=false;
+
+    //resampling-related stuff.
+    _uniforms=(float*)alignedMalloc(sizeof(float)*_nParticles);
+    if(_uniforms==NULL || !_resampler.allocate(_nParticles))
+        ok=false;
+    _kldKeys.resize(_nParticles);
+
+    //coarse to fine evaluation.
+    _coarseLikelihood.resize(_nParticles);
+    _fineIndices.resize(_nParticles);
+
+    //every worker thread gets its own scratch matrices, so that hypotheses can be evaluated in parallel.
+    _workspaces.resize(_workers->size());
+    for(count=0;count<(int)_workspaces.size();count++)
+    {
+        if(!allocateWorkspace(_workspaces[count]))
+            ok=false;
+    }
+
+    return ok;
+}
+
+void ParticleFilter::release()
+{
+    for(size_t count=0;count<_workspaces.size();count++)
+    {
+        releaseWorkspace(_workspaces[count]);
+    }
+    _workspaces.clear();
+
+    if (_A != NULL)
+        cvReleaseMat(&_A);
+    if (_modelHistogramMat != NULL)
+        cvReleaseMatND(&_modelHistogramMat);
+    if (_model3dPointsMat != NULL)
+        cvReleaseMat(&_model3dPointsMat);
+    _resampler.release();
+
+    _particles.release();
+    _newParticles.release();
+
+    alignedFree(_uniforms);
+    _uniforms=NULL;
+
+    alignedFree(_sqrtModelHistogram);
+    _sqrtModelHistogram=NULL;
+
+    for(int camera=0;camera<2;camera++)
+    {
+        if(_scoreImages[camera]!=NULL)
+            cvReleaseImage(&_scoreImages[camera]);
+    }
+}
+
+void ParticleFilter::setCamera(float fx, float fy, float cx, float cy)
+{
+    _perspectiveFx=fx;
+    _perspectiveFy=fy;
+    _perspectiveCx=cx;
+    _perspectiveCy=cy;
+}
+
+void ParticleFilter::setSecondCamera(float fx, float fy, float cx, float cy, const double rotation[9], const double translation[3])
+{
+    _stereo=true;
+    _secondCamera[0]=fx;
+    _secondCamera[1]=fy;
+    _secondCamera[2]=cx;
+    _secondCamera[3]=cy;
+    for(int count=0;count<9;count++)
+        _secondRotation[count]=(float)rotation[count];
+    for(int count=0;count<3;count++)
+        _secondTranslation[count]=(float)translation[count];
+}
+
+void ParticleFilter::setInitialPosition(double x, double y, double z)
+{
+    _initialX=x;
+    _initialY=y;
+    _initialZ=z;
+}
+
+void ParticleFilter::copyParameters(const ParticleFilter &other)
+{
+    _colorTransfPolicy=other._colorTransfPolicy;
+    _scoringMode=other._scoringMode;
+    _adaptationRate=other._adaptationRate;
+    _adaptationGate=other._adaptationGate;
+    _sphereFastPath=other._sphereFastPath;
+    _inside_outside_difference_weight=other._inside_outside_difference_weight;
+    _accelStDev=other._accelStDev;
+    setCamera(other._perspectiveFx,other._perspectiveFy,other._perspectiveCx,other._perspectiveCy);
+    _stereo=other._stereo;
+    copy(other._secondCamera,other._secondCamera+4,_secondCamera);
+    copy(other._secondRotation,other._secondRotation+9,_secondRotation);
+    copy(other._secondTranslation,other._secondTranslation+3,_secondTranslation);
+    setInitialPosition(other._initialX,other._initialY,other._initialZ);
+}
+
+void ParticleFilter::setAdaptive(int minParticles, float kldError, float kldBinSize)
+{
+    _minParticles=min(max(minParticles,1),_maxParticles);
+    _kldError=kldError;
+    _kldBinSize=kldBinSize;
+}
+
+bool ParticleFilter::setResolution(int nPixels, int yBins, int uBins, int vBins)
+{
+    if(nPixels<1 || yBins<1 || yBins>YBins || uBins<1 || uBins>UBins || vBins<1 || vBins>VBins)
+    {
+        yWarning()<<"unsupported resolution: "<<nPixels<<" contour points, "<<yBins<<"x"<<uBins<<"x"<<vBins<<" bins.";
+        return true;
+    }
+    _nPixels=nPixels;
+    _yBins=yBins;
+    _uBins=uBins;
+    _vBins=vBins;
+
+    //the look up table gives the finest bins: each one is mapped to the coarser bin it falls in.
+    //the coarser bins are packed with binIndex() too, so the histograms keep their layout.
+    _remapBins=(_yBins!=YBins || _uBins!=UBins || _vBins!=VBins);
+    for(int bin=0;bin<HistogramBins;bin++)
+        _binMap[bin]=(unsigned char)binIndex(binY(bin)*_yBins/YBins,binU(bin)*_uBins/UBins,binV(bin)*_vBins/VBins);
+    return false;
+}
+
+void ParticleFilter::setCoarseToFine(int coarsePixels, float fineFraction)
+{
+    //the largest step that gives at least coarsePixels points per contour, and divides nPixels.
+    _coarseStep=1;
+    if(coarsePixels>0)
+    {
+        _coarseStep=max(1,_nPixels/coarsePixels);
+        while(_nPixels%_coarseStep!=0)
+            _coarseStep--;
+    }
+    _fineFraction=(_coarseStep>1) ? fineFraction : 1;
+}
+
+void ParticleFilter::setTemplateAdaptation(float rate, float gate)
+{
+    _adaptationRate=rate;
+    _adaptationGate=gate*exp((float)20.0); //the weights aren't normalized when the histograms are kept.
+}
+
+void ParticleFilter::setSeed(unsigned long long seed)
+{
+    _seed=seed;
+    _draw=0;
+}
+
+void ParticleFilter::evaluate(IplImage *rawImage, IplImage *transformedImage, float &sumLikelihood, float &maxLikelihood, int &maxIndex,
+                              IplImage *secondRawImage, IplImage *secondTransformedImage)
+{
+    int count;
+    float likelihood;
+    IplImage* image=(_colorTransfPolicy==0) ? transformedImage : rawImage;
+    IplImage* secondImage=NULL;
+    const bool stereo=_stereo && secondRawImage!=NULL;
+    if(stereo)
+        secondImage=(_colorTransfPolicy==0) ? secondTransformedImage : secondRawImage;
+    if(_scoringMode==1)
+    {
+        buildScoreImage(rawImage,transformedImage,0);
+        image=_scoreImages[0];
+        if(stereo)
+        {
+            buildScoreImage(secondRawImage,secondTransformedImage,1);
+            secondImage=_scoreImages[1];
+        }
+    }
+
+    //the particles are split among the workers, each one writes the likelihood of its own particles.
+    //coarse to fine: all the particles are scored with one contour point every _coarseStep, then only the
+    //best _fineFraction of them is scored again with all the points. the others keep their coarse
+    //estimate, on the same scale: only the top fraction is refined.
+    //adaptive template: the inner histograms are kept by the last stage only, the one that gives the weights.
+    const int step=(_fineFraction<1) ? _coarseStep : 1;
+    const bool keep=(_adaptationRate>0 && _scoringMode==0);
+    for(count=0;count<(int)_workspaces.size();count++)
+        _workspaces[count].nCandidates=0;
+    _workers->run(_nParticles,[this,image,secondImage,step,keep](int worker, int begin, int end)
+    {
+        evaluateParticles(NULL,begin,end,image,secondImage,step,keep && step==1,_workspaces[worker]);
+    });
+
+    if(step>1)
+    {
+        //the threshold is the coarse likelihood of the particle at the given quantile.
+        const float* w=_particles.row(ParticleSet::W);
+        int nFine=(int)ceil(_fineFraction*_nParticles);
+        nFine=max(1,min(nFine,_nParticles));
+        copy(w,w+_nParticles,_coarseLikelihood.begin());
+        nth_element(_coarseLikelihood.begin(),_coarseLikelihood.begin()+(_nParticles-nFine),_coarseLikelihood.begin()+_nParticles);
+        const float threshold=_coarseLikelihood[_nParticles-nFine];
+        int nSelected=0;
+        for(count=0;count<_nParticles;count++)
+        {
+            if(w[count]>=threshold)
+            {
+                _fineIndices[nSelected]=count;
+                nSelected++;
+            }
+        }
+
+        _workers->run(nSelected,[this,image,secondImage,keep](int worker, int begin, int end)
+        {
+            evaluateParticles(&_fineIndices[0],begin,end,image,secondImage,1,keep,_workspaces[worker]);
+        });
+    }
+
+    //the reduction is done serially, so that the result does not depend on the number of threads.
+    sumLikelihood=0.0;
+    maxLikelihood=0.0;
+    maxIndex=-1;
+    const float* weight=_particles.row(ParticleSet::W);
+    for(count=0;count< _nParticles;count++)
+    {
+        likelihood=weight[count];
+        sumLikelihood+=likelihood;
+        if(likelihood>maxLikelihood)
+        {
+            maxLikelihood=likelihood;
+            maxIndex=count;
+        }
+    }
+}
+
+void ParticleFilter::mean(float &meanX, float &meanY, float &meanZ) const
+{
+    int count;
+    const float* x=_particles.row(ParticleSet::X);
+    const float* y=_particles.row(ParticleSet::Y);
+    const float* z=_particles.row(ParticleSet::Z);
+    meanX=meanY=meanZ=0.0;    // UGO: they should be zeroed before accumulation
+    for(count=0;count<_nParticles;count++)
+    {
+        meanX+=x[count];
+        meanY+=y[count];
+        meanZ+=z[count];
+    }
+    meanX/=_nParticles;
+    meanY/=_nParticles;
+    meanZ/=_nParticles;
+}
+
+void ParticleFilter::weightedMean(float sumLikelihood, float &meanX, float &meanY, float &meanZ)
+{
+    int count;
+    const float* x=_particles.row(ParticleSet::X);
+    const float* y=_particles.row(ParticleSet::Y);
+    const float* z=_particles.row(ParticleSet::Z);
+    float* w=_particles.row(ParticleSet::W);
+    meanX=0.0;
+    meanY=0.0;
+    meanZ=0.0;
+    for(count=0;count<_nParticles;count++)
+    {
+        w[count]=w[count]/sumLikelihood;
+        meanX+=x[count]*w[count];
+        meanY+=y[count]*w[count];
+        meanZ+=z[count]*w[count];
+    }
+}
+
+void ParticleFilter::resample(int nParticlesReceived, bool grow)
+{
+    //the size of the new set: all the particles, or as many as KLD-sampling asks for.
+    int n=_maxParticles;
+    if(_minParticles<_maxParticles && !grow)
+    {
+        n=max(kldParticles(),_minParticles+nParticlesReceived);
+        n=min(n,_maxParticles);
+    }
+
+    //the offsets of the points that pick the ancestors: one per new particle with stratified
+    //resampling, one for all of them otherwise.
+    const int nNew=n-nParticlesReceived;
+    const int nUniforms=(_resamplingScheme==Resampler::Stratified) ? nNew : 1;
+    randomUniform(_seed,ResamplingStream,_draw++,0,nUniforms,_uniforms);
+
+    _resampler.resample(_resamplingScheme,_particles.row(ParticleSet::W),_nParticles,nNew,_uniforms,*_workers);
+    _newParticles.setSize(n);
+    _resampler.gather(_particles,_newParticles,nNew,*_workers);
+    //the "good" particles now are in _newParticles: make them the current ones.
+    _particles.swap(_newParticles);
+    _nParticles=n;
+}
+
+void ParticleFilter::grow()
+{
+    int count, r;
+    if(_nParticles>=_maxParticles)
+        return;
+
+    //the particles are repeated: the motion model spreads the copies apart.
+    for(r=0;r<ParticleSet::NRows;r++)
+    {
+        float* row=_particles.row(r);
+        for(count=_nParticles;count<_maxParticles;count++)
+            row[count]=row[count%_nParticles];
+    }
+    _nParticles=_maxParticles;
+    _particles.setSize(_nParticles);
+}
+
+int ParticleFilter::kldParticles()
+{
+    int count, k;
+    const float* x=_particles.row(ParticleSet::X);
+    const float* y=_particles.row(ParticleSet::Y);
+    const float* z=_particles.row(ParticleSet::Z);
+    const float* w=_particles.row(ParticleSet::W);
+
+    //the particles that a systematic resampling of the whole set would pick at least once,
+    //with the points in the middle of their slices.
+    double sum=0;
+    for(count=0;count<_nParticles;count++)
+        sum+=w[count];
+    if(sum<=0)
+        return _maxParticles;
+    const float half=0.5F;
+    _resampler.resample(Resampler::Systematic,w,_nParticles,_maxParticles,&half,*_workers);
+    const int* ancestors=_resampler.ancestors();
+    const float binScale=1.0F/_kldBinSize;
+    int nKeys=0;
+    for(count=0;count<_maxParticles;count++)
+    {
+        //the ancestors are sorted: each particle picked appears in one run.
+        const int i=ancestors[count];
+        if(count>0 && i==ancestors[count-1])
+            continue;
+        //the cell of the 3D grid the particle falls in, 21 bits per coordinate.
+        long long cx=(long long)floor(x[i]*binScale)&0x1FFFFF;
+        long long cy=(long long)floor(y[i]*binScale)&0x1FFFFF;
+        long long cz=(long long)floor(z[i]*binScale)&0x1FFFFF;
+        _kldKeys[nKeys]=(cx<<42)|(cy<<21)|cz;
+        nKeys++;
+    }
+
+    //k, the number of cells with support.
+    sort(_kldKeys.begin(),_kldKeys.begin()+nKeys);
+    k=(int)(unique(_kldKeys.begin(),_kldKeys.begin()+nKeys)-_kldKeys.begin());
+    if(k<2)
+        return _minParticles;
+
+    //the number of particles that bounds the KL distance between the particles and the posterior
+    //by _kldError with probability 1-delta (Fox, 2003), with the Wilson-Hilferty approximation of the chi-square quantile.
+    const double a=2.0/(9.0*(k-1));
+    const double b=1.0-a+sqrt(a)*kldQuantile;
+    const double n=(k-1)/(2.0*_kldError)*b*b*b;
+    if(n>=_maxParticles)
+        return _maxParticles;
+    return (int)ceil(n);
+}
+
+void ParticleFilter::transformImage(IplImage *rawImage, IplImage *transformedImage)
+{
+    //the rows are split among the workers.
+    _workers->run(rawImage->height,[this,rawImage,transformedImage](int worker, int begin, int end)
+    {
+        rgbToBinImage(_lut,(unsigned char*)rawImage->imageData,rawImage->widthStep,rawImage->width,begin,end,
+                      (unsigned char*)transformedImage->imageData,transformedImage->widthStep);
+    });
+}
+
+void ParticleFilter::transformImageAroundParticles(IplImage *rawImage, IplImage *transformedImage)
+{
+    int u0, v0, u1, v1;
+
+    //right after a reset, or when the particles can't be bounded, the whole image is transformed.
+    if(_wholeImage || !contourBounds(rawImage->width,rawImage->height,u0,v0,u1,v1))
+    {
+        transformImage(rawImage,transformedImage);
+        _wholeImage=false;
+        return;
+    }
+    if(u1<=u0 || v1<=v0)
+        return; //all the contours are out of the image.
+
+    //the rows of the rectangle are split among the workers.
+    _workers->run(v1-v0,[this,rawImage,transformedImage,u0,v0,u1](int worker, int begin, int end)
+    {
+        rgbToBinImage(_lut,(unsigned char*)rawImage->imageData+u0*3,rawImage->widthStep,u1-u0,v0+begin,v0+end,
+                      (unsigned char*)transformedImage->imageData+u0,transformedImage->widthStep);
+    });
+}
+
+void ParticleFilter::buildScoreImage(IplImage *rawImage, IplImage *transformedImage, int camera)
+{
+    int count, bin;
+
+    IplImage* &scoreImage=_scoreImages[camera];
+    if(scoreImage!=NULL && (scoreImage->width!=rawImage->width || scoreImage->height!=rawImage->height))
+        cvReleaseImage(&scoreImage);
+    if(scoreImage==NULL)
+        scoreImage=cvCreateImage(cvSize(rawImage->width,rawImage->height),IPL_DEPTH_8U,1);
+
+    //only the region the contours can fall in is scored. the bounds are the ones of the first camera.
+    int u0, v0, u1, v1;
+    if(camera!=0 || !contourBounds(rawImage->width,rawImage->height,u0,v0,u1,v1))
+    {
+        u0=0;
+        v0=0;
+        u1=rawImage->width;
+        v1=rawImage->height;
+    }
+    if(u1<=u0 || v1<=v0)
+        return; //all the contours are out of the image.
+
+    //1. the bins of the region, written in the score image, and their counts. with colorTransfPolicy 0 they
+    //are copied from the transformed image, otherwise they are computed here, with the look up table of the template.
+    const int nWorkers=_workers->size();
+    _regionCounts.assign((size_t)nWorkers*HistogramBins,0.0F);
+    const bool fromBins=(_colorTransfPolicy==0 && transformedImage!=NULL);
+    _workers->run(v1-v0,[this,rawImage,transformedImage,scoreImage,fromBins,u0,v0,u1](int worker, int begin, int end)
+    {
+        float* counts=&_regionCounts[(size_t)worker*HistogramBins];
+        if(!fromBins)
+            rgbToBinImage(_lut,(unsigned char*)rawImage->imageData+u0*3,rawImage->widthStep,u1-u0,v0+begin,v0+end,
+                          (unsigned char*)scoreImage->imageData+u0,scoreImage->widthStep);
+        for(int row=v0+begin;row<v0+end;row++)
+        {
+            unsigned char* bins=(unsigned char*)scoreImage->imageData+scoreImage->widthStep*row;
+            if(fromBins)
+                memcpy(bins+u0,transformedImage->imageData+transformedImage->widthStep*row+u0,u1-u0);
+            for(int column=u0;column<u1;column++)
+                counts[_binMap[bins[column]]]+=1;
+        }
+    });
+
+    //2. the score of each bin: t/(t+r), with t the share of the bin in the template and r its share in the
+    //region. the counts are summed serially, so that the scores do not depend on the number of threads.
+    float templateSum=0;
+    for(bin=0;bin<HistogramBins;bin++)
+        templateSum+=_sqrtModelHistogram[bin]*_sqrtModelHistogram[bin];
+    for(count=1;count<nWorkers;count++)
+        for(bin=0;bin<HistogramBins;bin++)
+            _regionCounts[bin]+=_regionCounts[(size_t)count*HistogramBins+bin];
+    const float regionSum=(float)(u1-u0)*(float)(v1-v0);
+    for(bin=0;bin<HistogramBins;bin++)
+    {
+        const int histogramBin=_binMap[bin];
+        const float t=(templateSum>0) ? _sqrtModelHistogram[histogramBin]*_sqrtModelHistogram[histogramBin]/templateSum : 0.0F;
+        const float r=_regionCounts[histogramBin]/regionSum;
+        _scoreTable[bin]=(t>0) ? (unsigned char)(255.0F*t/(t+r)+0.5F) : 0;
+    }
+
+    //3. the bins become scores.
+    _workers->run(v1-v0,[this,scoreImage,u0,v0,u1](int worker, int begin, int end)
+    {
+        for(int row=v0+begin;row<v0+end;row++)
+        {
+            unsigned char* scores=(unsigned char*)scoreImage->imageData+scoreImage->widthStep*row;
+            for(int column=u0;column<u1;column++)
+                scores[column]=_scoreTable[scores[column]];
+        }
+    });
+}
+
+bool ParticleFilter::contourBounds(int width, int height, int &u0, int &v0, int &u1, int &v1)
+{
+    int count;
+
+    //every point of the shape model is within radius of its centre, so every point of a contour
+    //lies in the box of side 2*radius around the particle: the box is bounded in the image instead.
+    float radius=0;
+    const float* modelX=(float*)(_model3dPointsMat->data.ptr);
+    const float* modelY=(float*)(_model3dPointsMat->data.ptr + _model3dPointsMat->step*1);
+    const float* modelZ=(float*)(_model3dPointsMat->data.ptr + _model3dPointsMat->step*2);
+    for(count=0;count<2*_nPixels;count++)
+        radius=max(radius,sqrt(modelX[count]*modelX[count]+modelY[count]*modelY[count]+modelZ[count]*modelZ[count]));
+    radius+=1.0F; //one millimeter more, for the rounding errors.
+
+    //the extremes of X/Z and Y/Z over the box of each particle, reduced per worker. the box must be in front of the camera.
+    const int nWorkers=_workers->size();
+    vector<float> bounds(4*nWorkers);
+    vector<char> bounded(nWorkers);
+    _workers->run(_nParticles,[this,radius,&bounds,&bounded](int worker, int begin, int end)
+    {
+        const float* x=_particles.row(ParticleSet::X);
+        const float* y=_particles.row(ParticleSet::Y);
+        const float* z=_particles.row(ParticleSet::Z);
+        float minU=FLT_MAX, maxU=-FLT_MAX, minV=FLT_MAX, maxV=-FLT_MAX;
+        float nearest=FLT_MAX;
+        for(int count=begin;count<end;count++)
+        {
+            const float nearZ=z[count]-radius;
+            const float farZ=z[count]+radius;
+            nearest=min(nearest,nearZ);
+            minU=min(minU,min((x[count]-radius)/nearZ,(x[count]-radius)/farZ));
+            maxU=max(maxU,max((x[count]+radius)/nearZ,(x[count]+radius)/farZ));
+            minV=min(minV,min((y[count]-radius)/nearZ,(y[count]-radius)/farZ));
+            maxV=max(maxV,max((y[count]+radius)/nearZ,(y[count]+radius)/farZ));
+        }
+        bounds[4*worker+0]=minU;
+        bounds[4*worker+1]=maxU;
+        bounds[4*worker+2]=minV;
+        bounds[4*worker+3]=maxV;
+        bounded[worker]=(nearest>1.0F);
+    });
+
+    float minU=FLT_MAX, maxU=-FLT_MAX, minV=FLT_MAX, maxV=-FLT_MAX;
+    for(count=0;count<nWorkers;count++)
+    {
+        if(!bounded[count])
+            return false;
+        minU=min(minU,bounds[4*count+0]);
+        maxU=max(maxU,bounds[4*count+1]);
+        minV=min(minV,bounds[4*count+2]);
+        maxV=max(maxV,bounds[4*count+3]);
+    }
+    if(minU>maxU)
+        return false; //no particles.
+
+    //the contours sample pixel (int)u, (int)v: one more pixel on each side covers the rounding of the projection.
+    u0=max(0,(int)floor(_perspectiveFx*minU+_perspectiveCx)-1);
+    u1=min(width,(int)floor(_perspectiveFx*maxU+_perspectiveCx)+2);
+    v0=max(0,(int)floor(_perspectiveFy*minV+_perspectiveCy)-1);
+    v1=min(height,(int)floor(_perspectiveFy*maxV+_perspectiveCy)+2);
+    return true;
+}
+
+void ParticleFilter::projectContour(CvMat* model3dPointsMat, float x, float y, float z, const float* &u, const float* &v)
+{
+    projectContours(model3dPointsMat,&x,&y,&z,1,_workspaces[0]);
+    u=_workspaces[0].u;
+    v=_workspaces[0].v;
+}
+
+bool ParticleFilter::computeTemplateHistogram(string imageFileName, string dataFileName, bool rgbImages)
+{
+    int u,v,a,b,c;
+    float usedPoints=0;
+    //float histogram[YBins][UBins][VBins];
+    //float* histogram;
+    //histogram = new float[YBins*UBins*VBins]
+    int dimensions;
+    dimensions=3;
+    int sizes[3]={_yBins,_uBins,_vBins};
+    //create histogram and allocate memory for it.
+    CvMatND* histogram=cvCreateMatND(dimensions, sizes, CV_32FC1);
+    if(histogram==0)
+    {
+        yWarning("computeTemplateHistogram: I wasn\'t able to allocate memory for histogram.");
+        return true; //if I can't do it, I just quit the program.
+    }
+    //set content of the matrix to zero.
+    cvSetZero(histogram);
+    //load the image
+    auto rawImage = cv::imread(imageFileName);
+    if( ! rawImage.data) //load the image from file.
+    {
+        yWarning("I wasn't able to open the image file!");
+        return true; //if I can't do it, I just quit the program.
+    }
+    if(rgbImages)
+    {
+        //the tracked images will be RGB, as they come from the port: the template has to match.
+        cvtColor(rawImage,rawImage,CV_BGR2RGB);
+    }
+    cv::Mat transformedImage(rawImage.rows, rawImage.cols, CV_8UC3);
+
+
+    //allocate space for the transformed image
+
+    //transform the image in the YUV format
+    rgbToYuvBinMatLut(rawImage,transformedImage,_lut);
+    
+    //count the frequencies of colour bins, build the histogram.
+    for(v=0;v<rawImage.rows;v++)
+        for(u=0;u<rawImage.cols;u++)
+        {
+            //discard white pixels [255,255,255].
+
+            if(!(
+                    (((uchar*)(rawImage.data + rawImage.step*v))[u*3+0])==255 && (((uchar*)(rawImage.data + rawImage.step*v))[u*3+1])==255 && (((uchar*)(rawImage.data + rawImage.step*v))[u*3+2])==255)
+
+                )
+            {
+
+                a=(((uchar*)(transformedImage.data + transformedImage.step*v))[u*3+0]);//Y bin
+                b=(((uchar*)(transformedImage.data + transformedImage.step*v))[u*3+1]);//U bin
+                c=(((uchar*)(transformedImage.data + transformedImage.step*v))[u*3+2]);//V bin
+                if(_remapBins)
+                {
+                    int bin=_binMap[binIndex(a,b,c)];
+                    a=binY(bin);
+                    b=binU(bin);
+                    c=binV(bin);
+                }
+
+                //TEST printf("histogram->size[0].step,%d\n",histogram->dim[0].step);  256
+                //TEST printf("histogram->size[1].step,%d\n",histogram->dim[1].step);   32
+                //TEST printf("histogram->size[2].step,%d\n",histogram->dim[2].step);    4
+                *((float*)(histogram->data.ptr + a*histogram->dim[0].step + b*histogram->dim[1].step + c*histogram->dim[2].step)) +=1;
+
+                //initial pointer + Y*UBINS*VBINS*histogram->step + U*VBINS*histogram->step + V*histogram->step. RIGHT?
+                //histogram[(yuvBinsImage[u][v][0])*UBins*VBins + (yuvBinsImage[u][v][1])*VBins +  (yuvBinsImage[u][v][2]) ]+=1; //increment the correct bin counter.
+                usedPoints+=1;
+            }
+        }
+
+    //normalize
+    if(usedPoints>0)  
+    {
+        //histogram=histogram/usedPoints
+        cvConvertScale( histogram, histogram, 1/usedPoints, 0 );
+    }
+
+    //write the computed histogram to a file.
+    ofstream fout(dataFileName.c_str());//open file
+    if(!fout)                           //confirm file opened
+    {
+        yWarning("computeTemplateHistogram: unable to open the csv file to store the histogram.");
+        return true;
+    }
+    else
+    {
+        for(a=0;a<_yBins;a++)
+        {
+            for(b=0;b<_uBins;b++)
+            {
+                for(c=0;c<_vBins;c++)
+                {
+                    fout<<*((float*)(histogram->data.ptr + a*histogram->dim[0].step + b*histogram->dim[1].step + c*histogram->dim[2].step))<<endl;
+                }
+            }
+        }
+        fout.close();
+    }
+
+    //clean memory up
+    if (histogram != NULL)
+        cvReleaseMatND(&histogram);
+
+    return false;
+
+}
+
+bool ParticleFilter::readModelHistogram(const char fileName[])
+{
+    int c1,c2,c3;
+    float value;
+    char line[15];
+    CvMatND* histogram=_modelHistogramMat;
+
+    ifstream fin(fileName); //open file
+    if(!fin)                //confirm file opened
+    {
+        yWarning("unable to open the csv histogram file.");
+        return true;
+    }
+    else
+    {
+        for(c1=0;c1<_yBins;c1++) 
+            for(c2=0;c2<_uBins;c2++) 
+                for(c3=0;c3<_vBins;c3++) 
+                {
+                    fin.getline(line, 14);
+                    value=(float)atof(line);
+                    *((float*)(histogram->data.ptr + c1*histogram->dim[0].step + c2*histogram->dim[1].step + c3*histogram->dim[2].step))=value;
+                    _sqrtModelHistogram[binIndex(c1,c2,c3)]=sqrt(value); //the likelihood only needs the square root of the template.
+                }   
+        return false;
+    }
+}
+
+void ParticleFilter::modelHistogram(vector<float> &values) const
+{
+    int c1,c2,c3;
+    const CvMatND* histogram=_modelHistogramMat;
+
+    values.clear();
+    for(c1=0;c1<_yBins;c1++)
+        for(c2=0;c2<_uBins;c2++)
+            for(c3=0;c3<_vBins;c3++)
+                values.push_back(*((float*)(histogram->data.ptr + c1*histogram->dim[0].step + c2*histogram->dim[1].step + c3*histogram->dim[2].step)));
+}
+
+bool ParticleFilter::setModelHistogram(const vector<float> &values)
+{
+    int c1,c2,c3;
+    CvMatND* histogram=_modelHistogramMat;
+
+    if((int)values.size()!=_yBins*_uBins*_vBins)
+    {
+        yWarning()<<"the template histogram should hold "<<_yBins*_uBins*_vBins<<" values.";
+        return true;
+    }
+    const float* value=&values[0];
+    for(c1=0;c1<_yBins;c1++)
+        for(c2=0;c2<_uBins;c2++)
+            for(c3=0;c3<_vBins;c3++)
+            {
+                *((float*)(histogram->data.ptr + c1*histogram->dim[0].step + c2*histogram->dim[1].step + c3*histogram->dim[2].step))=*value;
+                _sqrtModelHistogram[binIndex(c1,c2,c3)]=sqrt(*value);
+                value++;
+            }
+    return false;
+}
+
+bool ParticleFilter::writeModelHistogram(const char fileName[]) const
+{
+    vector<float> values;
+    modelHistogram(values);
+
+    ofstream fout(fileName); //open file
+    if(!fout)                //confirm file opened
+    {
+        yWarning("unable to open the csv file to store the histogram.");
+        return true;
+    }
+    for(size_t count=0;count<values.size();count++)
+        fout<<values[count]<<endl;
+    return !fout;
+}
+
+void ParticleFilter::adaptTemplate()
+{
+    int count, pick, worker;
+    int c1, c2, c3;
+
+    if(_adaptationRate<=0)
+        return;
+
+    //the best adaptationParticles of the candidates of all the workers: the lists are sorted, they are merged.
+    //the histograms are normalized, the blend of the picked ones is weighted by their likelihoods.
+    const int nWorkers=(int)_workspaces.size();
+    vector<int> next(nWorkers,0);
+    float observed[HistogramBins];
+    fill(observed,observed+HistogramBins,0.0F);
+    float sumWeights=0;
+    for(pick=0;pick<adaptationParticles;pick++)
+    {
+        int best=-1;
+        for(worker=0;worker<nWorkers;worker++)
+        {
+            const HypothesisWorkspace &workspace=_workspaces[worker];
+            if(next[worker]<workspace.nCandidates &&
+               (best==-1 || workspace.candidateWeight[next[worker]]>_workspaces[best].candidateWeight[next[best]]))
+                best=worker;
+        }
+        if(best==-1)
+            break;
+        const HypothesisWorkspace &workspace=_workspaces[best];
+        const float weight=workspace.candidateWeight[next[best]];
+        const float* histogram=workspace.candidateHistograms+workspace.candidateRow[next[best]]*HistogramBins;
+        for(count=0;count<HistogramBins;count++)
+            observed[count]+=weight*histogram[count];
+        sumWeights+=weight;
+        next[best]++;
+    }
+    if(sumWeights<=0)
+        return; //no particle above the gate.
+
+    //both are normalized, so is the blend.
+    vector<float> values;
+    modelHistogram(values);
+    count=0;
+    for(c1=0;c1<_yBins;c1++)
+        for(c2=0;c2<_uBins;c2++)
+            for(c3=0;c3<_vBins;c3++)
+            {
+                values[count]=(1-_adaptationRate)*values[count]+_adaptationRate*observed[binIndex(c1,c2,c3)]/sumWeights;
+                count++;
+            }
+    setModelHistogram(values);
+}
+
+bool ParticleFilter::readInitialmodel3dPoints(CvMat* points, string fileName)
+{
+    int c1,c2;
+    char line[15];
+            
+    ifstream fin(fileName.c_str()); //open file
+    if(!fin)                        //confirm file opened
+    {
+        yWarning("unable to open the the 3D model file.");
+        return true;
+    }
+    else
+    {
+        for(c1=0;c1<3;c1++) 
+            for(c2=0;c2<2*_nPixels;c2++) 
+            {
+                fin.getline(line, 14);
+                ((float*)(points->data.ptr + points->step*c1))[c2]=(float)atof(line);
+            }   
+        if(!fin)
+        {
+            yWarning()<<"the 3D model file should hold "<<6*_nPixels<<" values, one per line ("<<_nPixels<<" points per contour).";
+            return true;
+        }
+        return false;
+    }
+}
+
+bool ParticleFilter::readModel3dPoints(string fileName)
+{
+    int count;
+
+    _sphereModel=false;
+    if(readInitialmodel3dPoints(_model3dPointsMat,fileName))
+        return true;
+
+    //a sphere: the points lie in the X=0 plane, each contour on a circle around the origin, and the point i
+    //of the outer contour is in the direction of the point i of the inner one. the files hold a few
+    //decimals, hence the tolerance.
+    const float* modelX=(float*)(_model3dPointsMat->data.ptr);
+    const float* modelY=(float*)(_model3dPointsMat->data.ptr + _model3dPointsMat->step*1);
+    const float* modelZ=(float*)(_model3dPointsMat->data.ptr + _model3dPointsMat->step*2);
+    float innerRadius=0, outerRadius=0;
+    for(count=0;count<_nPixels;count++)
+    {
+        innerRadius+=sqrt(modelY[count]*modelY[count]+modelZ[count]*modelZ[count]);
+        outerRadius+=sqrt(modelY[_nPixels+count]*modelY[_nPixels+count]+modelZ[_nPixels+count]*modelZ[_nPixels+count]);
+    }
+    innerRadius/=_nPixels;
+    outerRadius/=_nPixels;
+    if(innerRadius<=0 || outerRadius<=0)
+        return false;
+
+    const float tolerance=0.01F; //[mm]
+    vector<float> circleCos(_nPixels), circleSin(_nPixels);
+    for(count=0;count<_nPixels;count++)
+    {
+        const float radius=sqrt(modelY[count]*modelY[count]+modelZ[count]*modelZ[count]);
+        if(radius==0)
+            return false;
+        circleCos[count]=modelY[count]/radius;
+        circleSin[count]=modelZ[count]/radius;
+        if(fabs(modelX[count])>tolerance || fabs(modelX[_nPixels+count])>tolerance ||
+           fabs(radius-innerRadius)>tolerance ||
+           fabs(outerRadius*circleCos[count]-modelY[_nPixels+count])>tolerance ||
+           fabs(outerRadius*circleSin[count]-modelZ[_nPixels+count])>tolerance)
+            return false; //another shape: the 3D points are used.
+    }
+    _circleCos.swap(circleCos);
+    _circleSin.swap(circleSin);
+    _innerRadius=innerRadius;
+    _outerRadius=outerRadius;
+    _sphereModel=true;
+    return false;
+}
+
+bool ParticleFilter::readMotionModelMatrix(string fileName)
+{
+    CvMat* points=_A;
+    int c1,c2;
+    char line[15];
+            
+    ifstream fin(fileName.c_str());//open file
+    if(!fin)                           //confirm file opened
+    {
+        yWarning("unable to open the motion model file.");
+        return true;
+    }
+    else
+    {
+        for(c1=0;c1<7;c1++)
+            for(c2=0;c2<7;c2++)
+            {
+                fin.getline(line, 14);
+                cvmSet(points,c1,c2,atof(line));
+            }   
+        return false;
+    }
+}
+
+void ParticleFilter::evaluateParticles(const int* indices, int begin, int end, IplImage *image, IplImage *secondImage, int step, bool keep, HypothesisWorkspace &workspace)
+{
+    int count;
+    const float* x=_particles.row(ParticleSet::X);
+    const float* y=_particles.row(ParticleSet::Y);
+    const float* z=_particles.row(ParticleSet::Z);
+    float* w=_particles.row(ParticleSet::W);
+    float batchX[ProjectionBatch], batchY[ProjectionBatch], batchZ[ProjectionBatch];
+    int batchIndex[ProjectionBatch];
+    const HypothesisEvaluator evaluateHypothesis=hypothesisEvaluator();
+    const float* R=_secondRotation;
+    const float* T=_secondTranslation;
+    const float stereoScale=exp(-20.0F); //the product of two likelihoods, brought back to the range of one.
+
+    //project the contours of a batch of particles in one go, then build the histograms of each one.
+    for(int batchBegin=begin;batchBegin<end;batchBegin+=ProjectionBatch)
+    {
+        int n=min(ProjectionBatch,end-batchBegin);
+        for(count=0;count<n;count++)
+        {
+            int index=(indices!=NULL) ? indices[batchBegin+count] : batchBegin+count;
+            batchIndex[count]=index;
+            batchX[count]=x[index];
+            batchY[count]=y[index];
+            batchZ[count]=z[index];
+        }
+        projectContours(_model3dPointsMat,batchX,batchY,batchZ,n,workspace);
+
+        for(count=0;count<n;count++)
+        {
+            const float* u=workspace.u+count*_uvStride;
+            const float* v=workspace.v+count*_uvStride;
+            workspace.keepRow=keep ? count : -1;
+            (this->*evaluateHypothesis)(u,v,image,step,w[batchIndex[count]],workspace);
+        }
+
+        if(secondImage!=NULL)
+        {
+            //the same particles, in the frame of the second camera: the shape model of the sphere is
+            //placed around its centre in each frame, as it looks the same from both cameras.
+            float secondX[ProjectionBatch], secondY[ProjectionBatch], secondZ[ProjectionBatch];
+            for(count=0;count<n;count++)
+            {
+                secondX[count]=R[0]*batchX[count]+R[1]*batchY[count]+R[2]*batchZ[count]+T[0];
+                secondY[count]=R[3]*batchX[count]+R[4]*batchY[count]+R[5]*batchZ[count]+T[1];
+                secondZ[count]=R[6]*batchX[count]+R[7]*batchY[count]+R[8]*batchZ[count]+T[2];
+            }
+            projectContours(_model3dPointsMat,secondX,secondY,secondZ,n,_secondCamera,workspace);
+
+            for(count=0;count<n;count++)
+            {
+                const float* u=workspace.u+count*_uvStride;
+                const float* v=workspace.v+count*_uvStride;
+                float likelihood;
+                workspace.keepRow=keep ? ProjectionBatch+count : -1;
+                (this->*evaluateHypothesis)(u,v,secondImage,step,likelihood,workspace);
+                w[batchIndex[count]]*=likelihood*stereoScale;
+            }
+        }
+        workspace.keepRow=-1;
+
+        //the weights of the batch are final: its best particles are kept, with their histograms.
+        if(keep)
+            keepCandidates(batchIndex,n,secondImage!=NULL,workspace);
+    }
+}
+
+void ParticleFilter::keepCandidates(const int* batchIndex, int n, bool stereo, HypothesisWorkspace &workspace)
+{
+    int count, camera, k, position;
+    const float* w=_particles.row(ParticleSet::W);
+    const int nCameras=stereo ? 2 : 1;
+
+    for(count=0;count<n;count++)
+    {
+        const float weight=w[batchIndex[count]];
+        if(weight<=_adaptationGate)
+            continue;
+        if(workspace.nCandidates==adaptationParticles && weight<=workspace.candidateWeight[adaptationParticles-1])
+            continue;
+        int views=0;
+        for(camera=0;camera<nCameras;camera++)
+            if(workspace.nKeptBins[camera*ProjectionBatch+count]>0)
+                views++;
+        if(views==0)
+            continue;
+
+        //the row of the worst candidate is reused once they are adaptationParticles.
+        int row;
+        if(workspace.nCandidates<adaptationParticles)
+        {
+            row=workspace.nCandidates;
+            workspace.nCandidates++;
+        }
+        else
+            row=workspace.candidateRow[adaptationParticles-1];
+        position=workspace.nCandidates-1;
+        while(position>0 && workspace.candidateWeight[position-1]<weight)
+        {
+            workspace.candidateIndex[position]=workspace.candidateIndex[position-1];
+            workspace.candidateWeight[position]=workspace.candidateWeight[position-1];
+            workspace.candidateRow[position]=workspace.candidateRow[position-1];
+            position--;
+        }
+        workspace.candidateIndex[position]=batchIndex[count];
+        workspace.candidateWeight[position]=weight;
+        workspace.candidateRow[position]=row;
+
+        //the normalized inner histogram, averaged over the cameras that see the particle.
+        float* histogram=workspace.candidateHistograms+row*HistogramBins;
+        memset(histogram,0,sizeof(float)*HistogramBins);
+        for(camera=0;camera<nCameras;camera++)
+        {
+            const int keptRow=camera*ProjectionBatch+count;
+            const int nBins=workspace.nKeptBins[keptRow];
+            const unsigned char* bins=workspace.keptBins+keptRow*_uvStride;
+            const float* counts=workspace.keptCounts+keptRow*_uvStride;
+            float points=0;
+            for(k=0;k<nBins;k++)
+                points+=counts[k];
+            for(k=0;k<nBins;k++)
+                histogram[bins[k]]+=counts[k]/(points*views);
+        }
+    }
+}
+
+void ParticleFilter::projectContours(CvMat* model3dPointsMat, const float* x, const float* y, const float* z, int n, HypothesisWorkspace &workspace)
+{
+    const float camera[4]={_perspectiveFx,_perspectiveFy,_perspectiveCx,_perspectiveCy};
+    projectContours(model3dPointsMat,x,y,z,n,camera,workspace);
+}
+
+void ParticleFilter::projectContours(CvMat* model3dPointsMat, const float* x, const float* y, const float* z, int n, const float camera[4], HypothesisWorkspace &workspace)
+{
+    if(model3dPointsMat==_model3dPointsMat && _sphereModel && _sphereFastPath)
+    {
+        projectSphereContours(&_circleCos[0],&_circleSin[0],_nPixels,_innerRadius,_outerRadius,
+                              x, y, z, n,
+                              camera[0], camera[1], camera[2], camera[3],
+                              workspace.u, workspace.v, _uvStride);
+        return;
+    }
+    projectModelPoints((float*)(model3dPointsMat->data.ptr),
+                       (float*)(model3dPointsMat->data.ptr + model3dPointsMat->step*1),
+                       (float*)(model3dPointsMat->data.ptr + model3dPointsMat->step*2),
+                       2*_nPixels, x, y, z, n,
+                       camera[0], camera[1], camera[2], camera[3],
+                       workspace.u, workspace.v, _uvStride);
+}
+
+void ParticleFilter::initializeParticles()
+{
+    float velocityStDev;
+    velocityStDev=0; //warning ??? !!! I'm setting parameters for the dynamic model here.
+    const float mean[3]={(float)_initialX,(float)_initialY,(float)_initialZ};
+    const unsigned int draw=_draw++;
+
+    //start over with all the particles.
+    _nParticles=_maxParticles;
+    _particles.setSize(_nParticles);
+    _wholeImage=true;
+
+    //X, Y and Z around the initial position, then VX, VY, VZ.
+    _workers->run(_nParticles,[this,&mean,draw,velocityStDev](int worker, int begin, int end)
+    {
+        for(int axis=0;axis<3;axis++)
+        {
+            randomNormal(_seed,InitialPositionStream+axis,draw,begin,end,mean[axis],_accelStDev,_particles.row(ParticleSet::X+axis));
+            randomNormal(_seed,InitialVelocityStream+axis,draw,begin,end,0,velocityStDev,_particles.row(ParticleSet::VX+axis));
+        }
+    });
+}
+
+void ParticleFilter::applyMotionModel(float periods)
+{
+    int r, c;
+    float a[ParticleSet::NRows][ParticleSet::NRows];
+
+    //the transition over periods frame periods, in closed form: I+periods*(_A-I). it is exact for the
+    //constant velocity model, where _A-I only moves the velocity to the position.
+    for(r=0;r<ParticleSet::NRows;r++)
+    {
+        for(c=0;c<ParticleSet::NRows;c++)
+        {
+            a[r][c]=(float)cvmGet(_A,r,c);
+            if(periods!=1)
+            {
+                const float identity=(r==c) ? 1.0F : 0.0F;
+                a[r][c]=identity+periods*(a[r][c]-identity);
+            }
+        }
+    }
+
+    //each worker moves its own particles.
+    float* const position[3]={_newParticles.row(ParticleSet::X),_newParticles.row(ParticleSet::Y),_newParticles.row(ParticleSet::Z)};
+    float* const velocity[3]={_newParticles.row(ParticleSet::VX),_newParticles.row(ParticleSet::VY),_newParticles.row(ParticleSet::VZ)};
+    const unsigned int draw=_draw++;
+    _newParticles.setSize(_particles.size());
+    _workers->run(_nParticles,[this,&a,&position,&velocity,periods,draw](int worker, int begin, int end)
+    {
+        //******************************************
+        //APPLY THE MOTION MODEL: 1.APPLY THE MATRIX
+        //******************************************
+        //_newParticles=a*_particles, one output row at a time, skipping the zero coefficients.
+        for(int r=0;r<ParticleSet::NRows;r++)
+        {
+            float* out=_newParticles.row(r);
+            fill(out+begin,out+end,0.0F);
+            for(int c=0;c<ParticleSet::NRows;c++)
+            {
+                if(a[r][c]==0)
+                    continue;
+                const float coefficient=a[r][c];
+                const float* in=_particles.row(c);
+                for(int count=begin;count<end;count++)
+                    out[count]+=coefficient*in[count];
+            }
+        }
+
+        //********************************************************
+        //APPLY THE MOTION MODEL: 2.ADD THE EFFECT OF ACCELERATION
+        //********************************************************
+        //the same acceleration acts on the speed and on the position, over the whole interval.
+        addAccelerationNoise(_seed,AccelerationStream,draw,begin,end,_accelStDev,periods,position,velocity);
+    });
+    //the "good" particles now are in _newParticles
+    _particles.swap(_newParticles);
+}
+
+bool ParticleFilter::allocateWorkspace(HypothesisWorkspace &workspace)
+{
+    workspace.u = (float*)alignedMalloc(sizeof(float)*ProjectionBatch*_uvStride);
+    workspace.v = (float*)alignedMalloc(sizeof(float)*ProjectionBatch*_uvStride);
+    workspace.colours = (unsigned char*)alignedMalloc(3*_uvStride);
+    workspace.bins = (unsigned char*)alignedMalloc(_uvStride);
+    workspace.innerHistogram = (float*)alignedMalloc(sizeof(float)*HistogramBins);
+    workspace.outerHistogram = (float*)alignedMalloc(sizeof(float)*HistogramBins);
+    workspace.hitBins = (unsigned char*)alignedMalloc(_uvStride);
+    workspace.hitCounts = (float*)alignedMalloc(sizeof(float)*3*_uvStride);
+    workspace.nHitBins = 0;
+    workspace.usedPoints = 0;
+    workspace.keptBins = (unsigned char*)alignedMalloc(2*ProjectionBatch*_uvStride);
+    workspace.keptCounts = (float*)alignedMalloc(sizeof(float)*2*ProjectionBatch*_uvStride);
+    workspace.candidateHistograms = (float*)alignedMalloc(sizeof(float)*adaptationParticles*HistogramBins);
+    workspace.keepRow = -1;
+    workspace.nCandidates = 0;
+
+    if(workspace.u==NULL || workspace.v==NULL ||
+       workspace.colours==NULL || workspace.bins==NULL ||
+       workspace.innerHistogram==NULL || workspace.outerHistogram==NULL ||
+       workspace.hitBins==NULL || workspace.hitCounts==NULL ||
+       workspace.keptBins==NULL || workspace.keptCounts==NULL || workspace.candidateHistograms==NULL)
+        return false;
+
+    //the histograms are kept empty between hypotheses.
+    memset(workspace.innerHistogram,0,sizeof(float)*HistogramBins);
+    memset(workspace.outerHistogram,0,sizeof(float)*HistogramBins);
+    return true;
+}
+
+void ParticleFilter::releaseWorkspace(HypothesisWorkspace &workspace)
+{
+    alignedFree(workspace.u);
+    workspace.u=NULL;
+    alignedFree(workspace.v);
+    workspace.v=NULL;
+    alignedFree(workspace.colours);
+    workspace.colours=NULL;
+    alignedFree(workspace.bins);
+    workspace.bins=NULL;
+    alignedFree(workspace.innerHistogram);
+    workspace.innerHistogram=NULL;
+    alignedFree(workspace.outerHistogram);
+    workspace.outerHistogram=NULL;
+    alignedFree(workspace.hitBins);
+    workspace.hitBins=NULL;
+    alignedFree(workspace.hitCounts);
+    workspace.hitCounts=NULL;
+    alignedFree(workspace.keptBins);
+    workspace.keptBins=NULL;
+    alignedFree(workspace.keptCounts);
+    workspace.keptCounts=NULL;
+    alignedFree(workspace.candidateHistograms);
+    workspace.candidateHistograms=NULL;
+}
+
+template<int NPixels, bool RemapBins>
+bool ParticleFilter::evaluateHypothesisPerspective(const float* u, const float* v, IplImage* transformedImage, int step, float &likelihood, HypothesisWorkspace &workspace)
+{
+    bool failure;
+    float usedOuterPoints, usedInnerPoints;
+
+    computeHistogram<NPixels,RemapBins>(u, v, transformedImage, step, usedInnerPoints, usedOuterPoints, workspace);
+    //if((usedInnerPoints<nPixels)||(usedOuterPoints<nPixels))
+    //    likelihood=0;
+    //else
+    failure=calculateLikelihood(usedInnerPoints, usedOuterPoints, likelihood, workspace);
+
+    likelihood=exp(20*likelihood); //no need to divide: I'm normalizing later.
+
+    //make hypotheses with pixels outside the image less likely.
+    const float samples=(float)(((NPixels>0) ? NPixels : _nPixels)/step);
+    likelihood=likelihood*((float)usedInnerPoints/samples)*((float)usedInnerPoints/samples)*((float)usedOuterPoints/samples)*((float)usedOuterPoints/samples);
+
+    return false;
+}
+
+template<int NPixels, bool RemapBins>
+bool ParticleFilter::evaluateHypothesisPerspectiveFromRgbImage(const float* u, const float* v, IplImage *image, int step, float &likelihood, HypothesisWorkspace &workspace)
+{
+//TODO
+
+    bool failure;
+    float usedOuterPoints, usedInnerPoints;
+
+    computeHistogramFromRgbImage<NPixels,RemapBins>(u, v, image, step, usedInnerPoints, usedOuterPoints, workspace);
+    //if((usedInnerPoints<nPixels)||(usedOuterPoints<nPixels))
+    //    likelihood=0;
+    //else
+    failure=calculateLikelihood(usedInnerPoints, usedOuterPoints, likelihood, workspace);
+    
+    likelihood=exp(20*likelihood); //no need to divide: I'm normalizing later.
+    
+    //make hypotheses with pixels outside the image less likely.
+    const float samples=(float)(((NPixels>0) ? NPixels : _nPixels)/step);
+    likelihood=likelihood*((float)usedInnerPoints/samples)*((float)usedInnerPoints/samples)*((float)usedOuterPoints/samples)*((float)usedOuterPoints/samples);
+    
+    return false;
+}
+
+template<int NPixels>
+bool ParticleFilter::evaluateHypothesisScore(const float* u, const float* v, IplImage* scoreImage, int step, float &likelihood, HypothesisWorkspace &workspace)
+{
+    int count;
+    int pu, pv;
+    int innerSum=0, outerSum=0;
+    int usedInnerPoints=0, usedOuterPoints=0;
+    const unsigned char* scores=(const unsigned char*)scoreImage->imageData;
+    const int widthStep=scoreImage->widthStep;
+
+    //one point every step: step divides nPixels, so the outer contour starts at count==nPixels.
+    const int pixels=(NPixels>0) ? NPixels : _nPixels;
+    for(count=0;count<pixels;count+=step)
+    {
+        pu=(int)u[count];
+        pv=(int)v[count];
+        if((pv<scoreImage->height)&&(pv>=0)&&(pu<scoreImage->width)&&(pu>=0))
+        {
+            innerSum+=scores[widthStep*pv+pu];
+            usedInnerPoints++;
+        }
+    }
+    for(;count<2*pixels;count+=step)
+    {
+        pu=(int)u[count];
+        pv=(int)v[count];
+        if((pv<scoreImage->height)&&(pv>=0)&&(pu<scoreImage->width)&&(pu>=0))
+        {
+            outerSum+=scores[widthStep*pv+pu];
+            usedOuterPoints++;
+        }
+    }
+
+    //the mean score inside minus the weighted mean score outside, in the range of calculateLikelihood().
+    float score=0;
+    if(usedInnerPoints>0)
+        score=innerSum/(255.0F*usedInnerPoints);
+    if(usedOuterPoints>0)
+        score-=_inside_outside_difference_weight*outerSum/(255.0F*usedOuterPoints);
+    score=(score+_inside_outside_difference_weight)/(1+_inside_outside_difference_weight);
+
+    likelihood=exp(20*score); //no need to divide: I'm normalizing later.
+
+    //make hypotheses with pixels outside the image less likely.
+    const float samples=(float)(pixels/step);
+    likelihood=likelihood*((float)usedInnerPoints/samples)*((float)usedInnerPoints/samples)*((float)usedOuterPoints/samples)*((float)usedOuterPoints/samples);
+
+    return false;
+}
+
+template<int NPixels, bool RemapBins>
+bool ParticleFilter::computeHistogram(const float* contourU, const float* contourV, IplImage* transformedImage, int step, float &usedInnerPoints, float &usedOuterPoints, HypothesisWorkspace &workspace)
+{
+    int count;
+    int u, v;
+    int n;
+
+    //collect the bins of the points of both contours that fall in the image.
+    n=0;
+    usedInnerPoints=0;
+    //one point every step: step divides nPixels, so the outer contour starts at count==nPixels.
+    const int pixels=(NPixels>0) ? NPixels : _nPixels;
+    for(count=0;count<2*pixels;count+=step)
+    {
+        if(count==pixels)
+            usedInnerPoints=(float)n;
+        u=(int)contourU[count]; //truncating ??? !!! warning
+        v=(int)contourV[count]; //truncating ??? !!! warning
+        if((v<transformedImage->height)&&(v>=0)&&(u<transformedImage->width)&&(u>=0))
+        {
+            unsigned char bin=((uchar*)(transformedImage->imageData + transformedImage->widthStep*v))[u]; //YUV bin
+            workspace.bins[n]=RemapBins ? _binMap[bin] : bin;
+            n++;
+        }
+    }
+    usedOuterPoints=(float)n-usedInnerPoints;
+
+    accumulateHistograms((int)usedInnerPoints,n,workspace);
+
+    return false;
+}
+
+template<int NPixels, bool RemapBins>
+bool ParticleFilter::computeHistogramFromRgbImage(const float* contourU, const float* contourV, IplImage *image, int step, float &usedInnerPoints, float &usedOuterPoints, HypothesisWorkspace &workspace)
+{
+    int count;
+    int u,v;
+    int n;
+    uchar* pixel;
+    unsigned char* R=workspace.colours;
+    unsigned char* G=workspace.colours+_uvStride;
+    unsigned char* B=workspace.colours+2*_uvStride;
+
+    //gather the colours of the points of both contours that fall in the image, then transform them all at once.
+    n=0;
+    usedInnerPoints=0;
+    //one point every step: step divides nPixels, so the outer contour starts at count==nPixels.
+    const int pixels=(NPixels>0) ? NPixels : _nPixels;
+    for(count=0;count<2*pixels;count+=step)
+    {
+        if(count==pixels)
+            usedInnerPoints=(float)n;
+        u=(int)contourU[count]; //truncating ??? !!! warning
+        v=(int)contourV[count]; //truncating ??? !!! warning
+        if((v<image->height)&&(v>=0)&&(u<image->width)&&(u>=0))
+        {
+            pixel=((uchar*)(image->imageData + image->widthStep*v))+u*3;
+            R[n]=pixel[0];
+            G[n]=pixel[1];
+            B[n]=pixel[2];
+            n++;
+        }
+    }
+    usedOuterPoints=(float)n-usedInnerPoints;
+
+    //transform the colors from RGB to YUV bins.
+    lutBins(_lut,R,G,B,n,workspace.bins);
+    if(RemapBins)
+    {
+        for(count=0;count<n;count++)
+            workspace.bins[count]=_binMap[workspace.bins[count]];
+    }
+
+    accumulateHistograms((int)usedInnerPoints,n,workspace);
+
+    return false;
+}
+
+void ParticleFilter::accumulateHistograms(int usedInnerPoints, int usedPoints, HypothesisWorkspace &workspace)
+{
+    int count;
+    unsigned char bin;
+
+    //the histograms are empty here: only the bins that are hit are touched, and the ones hit
+    //by the inner contour are listed, as they are the only ones the likelihood depends on.
+    workspace.nHitBins=0;
+    for(count=0;count<usedInnerPoints;count++)
+    {
+        bin=workspace.bins[count];
+        if(workspace.innerHistogram[bin]==0)
+        {
+            workspace.hitBins[workspace.nHitBins]=bin;
+            workspace.nHitBins++;
+        }
+        workspace.innerHistogram[bin]+=1;
+    }
+    for(;count<usedPoints;count++)
+    {
+        workspace.outerHistogram[workspace.bins[count]]+=1;
+    }
+    workspace.usedPoints=usedPoints;
+}
+
+bool ParticleFilter::calculateLikelihood(float usedInnerPoints, float usedOuterPoints, float &likelihood, HypothesisWorkspace &workspace)
+{
+    int count;
+    unsigned char bin;
+    float* inner=workspace.hitCounts;
+    float* outer=workspace.hitCounts+_uvStride;
+    float* sqrtTemplate=workspace.hitCounts+2*_uvStride;
+
+    //the histograms hold counts: the normalization is folded in the scale factors.
+    likelihood=0;
+    if(usedInnerPoints>0)
+    {
+        for(count=0;count<workspace.nHitBins;count++)
+        {
+            bin=workspace.hitBins[count];
+            inner[count]=workspace.innerHistogram[bin];
+            outer[count]=workspace.outerHistogram[bin];
+            sqrtTemplate[count]=_sqrtModelHistogram[bin];
+        }
+        float innerScale=1.0F/sqrt(usedInnerPoints);
+        float outerScale=0;
+        if(usedOuterPoints>0)
+            outerScale=_inside_outside_difference_weight/sqrt(usedInnerPoints*usedOuterPoints);
+        likelihood=histogramScore(inner,outer,sqrtTemplate,workspace.nHitBins,innerScale,outerScale);
+    }
+
+    //adaptive template: the inner histogram is kept as it is, sparse, see keepCandidates().
+    if(workspace.keepRow>=0)
+    {
+        const int nBins=(usedInnerPoints>0) ? workspace.nHitBins : 0;
+        memcpy(workspace.keptBins+workspace.keepRow*_uvStride,workspace.hitBins,nBins);
+        memcpy(workspace.keptCounts+workspace.keepRow*_uvStride,inner,sizeof(float)*nBins);
+        workspace.nKeptBins[workspace.keepRow]=nBins;
+    }
+
+    //leave the histograms empty for the next hypothesis.
+    for(count=0;count<workspace.usedPoints;count++)
+    {
+        bin=workspace.bins[count];
+        workspace.innerHistogram[bin]=0;
+        workspace.outerHistogram[bin]=0;
+    }
+
+    likelihood=(likelihood+_inside_outside_difference_weight)/(1+_inside_outside_difference_weight);
+    if(likelihood<0)
+        yWarning("LIKELIHOOD<0!!!");
+    return false;
+}
+
+template<int NPixels>
+ParticleFilter::HypothesisEvaluator ParticleFilter::evaluatorFor() const
+{
+    if(_scoringMode==1)
+        return &ParticleFilter::evaluateHypothesisScore<NPixels>; //the bins are remapped by the score table.
+    if(_colorTransfPolicy==0)
+        return _remapBins ? &ParticleFilter::evaluateHypothesisPerspective<NPixels,true> : &ParticleFilter::evaluateHypothesisPerspective<NPixels,false>;
+    return _remapBins ? &ParticleFilter::evaluateHypothesisPerspectiveFromRgbImage<NPixels,true> : &ParticleFilter::evaluateHypothesisPerspectiveFromRgbImage<NPixels,false>;
+}
+
+ParticleFilter::HypothesisEvaluator ParticleFilter::hypothesisEvaluator() const
+{
+    //the common contour densities have their own instances, with the loops of known length.
+    switch(_nPixels)
+    {
+    case 25:
+        return evaluatorFor<25>();
+    case 50:
+        return evaluatorFor<50>();
+    case 100:
+        return evaluatorFor<100>();
+    default:
+        return evaluatorFor<0>();
+    }
+}
@@ -0,0 +1,106 @@
+/**
+*
+* Frame queue of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <iCub/pf3dTrackerFrames.hpp>
+
+using namespace std;
+
+FrameQueue::FrameQueue() : _capacity(1), _dropped(0), _stopped(false), _closed(false)
+{
+}
+
+void FrameQueue::reset(int nSlots, int capacity)
+{
+    lock_guard<mutex> lock(_mutex);
+    _ready.clear();
+    _free.clear();
+    for(int slot=nSlots-1;slot>=0;slot--)
+    {
+        _free.push_back(slot);
+    }
+    _capacity=(capacity>0)?capacity:1;
+    _dropped=0;
+    _stopped=false;
+    _closed=false;
+}
+
+void FrameQueue::stop()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _stopped=true;
+    }
+    _changed.notify_all();
+}
+
+void FrameQueue::close()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _closed=true;
+    }
+    _changed.notify_all();
+}
+
+int FrameQueue::acquire()
+{
+    unique_lock<mutex> lock(_mutex);
+    _changed.wait(lock,[this]{ return _stopped || !_free.empty(); });
+    if(_stopped)
+        return -1;
+
+    int slot=_free.back();
+    _free.pop_back();
+    return slot;
+}
+
+void FrameQueue::push(int slot)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        if((int)_ready.size()>=_capacity)
+        {
+            //drop the oldest frame.
+            _free.push_back(_ready.front());
+            _ready.pop_front();
+            _dropped++;
+        }
+        _ready.push_back(slot);
+    }
+    _changed.notify_all();
+}
+
+int FrameQueue::pop()
+{
+    unique_lock<mutex> lock(_mutex);
+    _changed.wait(lock,[this]{ return _stopped || _closed || !_ready.empty(); });
+    if(_stopped || _ready.empty())
+        return -1;
+
+    int slot=_ready.front();
+    _ready.pop_front();
+    return slot;
+}
+
+void FrameQueue::release(int slot)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _free.push_back(slot);
+    }
+    _changed.notify_all();
+}
+
+int FrameQueue::dropped() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _dropped;
+}
@@ -0,0 +1,257 @@
+/**
+*
+* Hot kernels of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include <iCub/pf3dTrackerKernels.hpp>
+
+//the rotation that makes a model centred in (x,y,z) face the camera, Rz*Ry: the translation Rz*[floorDistance 0 z]'
+//is the centre itself. its third row has no Y term.
+struct Facing
+{
+    float m00, m01, m02;
+    float m10, m11, m12;
+    float m20,      m22;
+};
+
+static inline Facing facingCamera(float x, float y, float z)
+{
+    //the same angles used by place3dPointsPerspective.
+    float floorDistance=std::sqrt(x*x+y*y); //horizontal distance from the optical center to the ball
+    float distance=std::sqrt(x*x+y*y+z*z); //distance from the optical center to the ball
+    float cosAlpha=floorDistance/distance;
+    float sinAlpha=-z/distance;
+    float cosBeta=1.0F;
+    float sinBeta=0.0F;
+    if(floorDistance>0)
+    {
+        cosBeta=x/floorDistance;
+        sinBeta=y/floorDistance;
+    }
+
+    Facing m;
+    m.m00=cosBeta*cosAlpha; m.m01=-sinBeta; m.m02=cosBeta*sinAlpha;
+    m.m10=sinBeta*cosAlpha; m.m11= cosBeta; m.m12=sinBeta*sinAlpha;
+    m.m20=-sinAlpha;                        m.m22=cosAlpha;
+    return m;
+}
+
+//NPoints is the number of model points, 0 for any number: with a known number the loops over the points are unrolled.
+template<int NPoints>
+static void projectPoints(const float* modelX, const float* modelY, const float* modelZ, int nPoints,
+                          const float* x, const float* y, const float* z, int nCentres,
+                          float fx, float fy, float cx, float cy,
+                          float* u, float* v, int stride)
+{
+    if(NPoints>0)
+        nPoints=NPoints;
+    for(int k=0;k<nCentres;k++)
+    {
+        const Facing m=facingCamera(x[k],y[k],z[k]);
+        const float m00=m.m00, m01=m.m01, m02=m.m02;
+        const float m10=m.m10, m11=m.m11, m12=m.m12;
+        const float m20=m.m20,            m22=m.m22;
+        const float tx=x[k], ty=y[k], tz=z[k];
+
+        float* uk=u+k*stride;
+        float* vk=v+k*stride;
+        int i=0;
+
+#ifdef __AVX2__
+        const __m256 vm00=_mm256_set1_ps(m00), vm01=_mm256_set1_ps(m01), vm02=_mm256_set1_ps(m02);
+        const __m256 vm10=_mm256_set1_ps(m10), vm11=_mm256_set1_ps(m11), vm12=_mm256_set1_ps(m12);
+        const __m256 vm20=_mm256_set1_ps(m20), vm22=_mm256_set1_ps(m22);
+        const __m256 vtx=_mm256_set1_ps(tx), vty=_mm256_set1_ps(ty), vtz=_mm256_set1_ps(tz);
+        const __m256 vfx=_mm256_set1_ps(fx), vfy=_mm256_set1_ps(fy);
+        const __m256 vcx=_mm256_set1_ps(cx), vcy=_mm256_set1_ps(cy);
+        for(;i+8<=nPoints;i+=8)
+        {
+            __m256 px=_mm256_loadu_ps(modelX+i);
+            __m256 py=_mm256_loadu_ps(modelY+i);
+            __m256 pz=_mm256_loadu_ps(modelZ+i);
+
+            __m256 X=_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vm00,px),_mm256_mul_ps(vm01,py)),_mm256_mul_ps(vm02,pz)),vtx);
+            __m256 Y=_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vm10,px),_mm256_mul_ps(vm11,py)),_mm256_mul_ps(vm12,pz)),vty);
+            __m256 Z=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vm20,px),_mm256_mul_ps(vm22,pz)),vtz);
+
+            _mm256_storeu_ps(uk+i,_mm256_add_ps(_mm256_mul_ps(vfx,_mm256_div_ps(X,Z)),vcx));
+            _mm256_storeu_ps(vk+i,_mm256_add_ps(_mm256_mul_ps(vfy,_mm256_div_ps(Y,Z)),vcy));
+        }
+#endif
+
+        for(;i<nPoints;i++)
+        {
+            float X=m00*modelX[i]+m01*modelY[i]+m02*modelZ[i]+tx;
+            float Y=m10*modelX[i]+m11*modelY[i]+m12*modelZ[i]+ty;
+            float Z=m20*modelX[i]+m22*modelZ[i]+tz;
+
+            uk[i]=fx*(X/Z)+cx;
+            vk[i]=fy*(Y/Z)+cy;
+        }
+    }
+}
+
+void projectModelPoints(const float* modelX, const float* modelY, const float* modelZ, int nPoints,
+                        const float* x, const float* y, const float* z, int nCentres,
+                        float fx, float fy, float cx, float cy,
+                        float* u, float* v, int stride)
+{
+    //two contours of 25, 50 or 100 points have their own instances.
+    switch(nPoints)
+    {
+    case 50:
+        projectPoints<50>(modelX,modelY,modelZ,nPoints,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    case 100:
+        projectPoints<100>(modelX,modelY,modelZ,nPoints,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    case 200:
+        projectPoints<200>(modelX,modelY,modelZ,nPoints,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    default:
+        projectPoints<0>(modelX,modelY,modelZ,nPoints,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    }
+}
+
+//NPoints is the number of points of each circle, 0 for any number.
+template<int NPoints>
+static void projectCircles(const float* cosTable, const float* sinTable, int nPoints, float innerRadius, float outerRadius,
+                           const float* x, const float* y, const float* z, int nCentres,
+                           float fx, float fy, float cx, float cy,
+                           float* u, float* v, int stride)
+{
+    if(NPoints>0)
+        nPoints=NPoints;
+    for(int k=0;k<nCentres;k++)
+    {
+        //the point at angle i of the unit circle, placed in front of the camera, is the centre plus (dX,dY,dZ):
+        //the circle of radius r is the centre plus r*(dX,dY,dZ). the model has no X coordinate.
+        const Facing m=facingCamera(x[k],y[k],z[k]);
+        const float tx=x[k], ty=y[k], tz=z[k];
+
+        float* innerU=u+k*stride;
+        float* innerV=v+k*stride;
+        float* outerU=innerU+nPoints;
+        float* outerV=innerV+nPoints;
+        int i=0;
+
+#ifdef __AVX2__
+        const __m256 vm01=_mm256_set1_ps(m.m01), vm02=_mm256_set1_ps(m.m02);
+        const __m256 vm11=_mm256_set1_ps(m.m11), vm12=_mm256_set1_ps(m.m12);
+        const __m256 vm22=_mm256_set1_ps(m.m22);
+        const __m256 vtx=_mm256_set1_ps(tx), vty=_mm256_set1_ps(ty), vtz=_mm256_set1_ps(tz);
+        const __m256 vInner=_mm256_set1_ps(innerRadius), vOuter=_mm256_set1_ps(outerRadius);
+        const __m256 vfx=_mm256_set1_ps(fx), vfy=_mm256_set1_ps(fy);
+        const __m256 vcx=_mm256_set1_ps(cx), vcy=_mm256_set1_ps(cy);
+        const __m256 one=_mm256_set1_ps(1.0F);
+        for(;i+8<=nPoints;i+=8)
+        {
+            __m256 c=_mm256_loadu_ps(cosTable+i);
+            __m256 s=_mm256_loadu_ps(sinTable+i);
+            __m256 dX=_mm256_add_ps(_mm256_mul_ps(vm01,c),_mm256_mul_ps(vm02,s));
+            __m256 dY=_mm256_add_ps(_mm256_mul_ps(vm11,c),_mm256_mul_ps(vm12,s));
+            __m256 dZ=_mm256_mul_ps(vm22,s);
+
+            __m256 r=_mm256_div_ps(one,_mm256_add_ps(_mm256_mul_ps(vInner,dZ),vtz));
+            _mm256_storeu_ps(innerU+i,_mm256_add_ps(_mm256_mul_ps(vfx,_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vInner,dX),vtx),r)),vcx));
+            _mm256_storeu_ps(innerV+i,_mm256_add_ps(_mm256_mul_ps(vfy,_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vInner,dY),vty),r)),vcy));
+
+            r=_mm256_div_ps(one,_mm256_add_ps(_mm256_mul_ps(vOuter,dZ),vtz));
+            _mm256_storeu_ps(outerU+i,_mm256_add_ps(_mm256_mul_ps(vfx,_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vOuter,dX),vtx),r)),vcx));
+            _mm256_storeu_ps(outerV+i,_mm256_add_ps(_mm256_mul_ps(vfy,_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vOuter,dY),vty),r)),vcy));
+        }
+#endif
+
+        for(;i<nPoints;i++)
+        {
+            const float dX=m.m01*cosTable[i]+m.m02*sinTable[i];
+            const float dY=m.m11*cosTable[i]+m.m12*sinTable[i];
+            const float dZ=m.m22*sinTable[i];
+
+            float r=1.0F/(innerRadius*dZ+tz);
+            innerU[i]=fx*((innerRadius*dX+tx)*r)+cx;
+            innerV[i]=fy*((innerRadius*dY+ty)*r)+cy;
+
+            r=1.0F/(outerRadius*dZ+tz);
+            outerU[i]=fx*((outerRadius*dX+tx)*r)+cx;
+            outerV[i]=fy*((outerRadius*dY+ty)*r)+cy;
+        }
+    }
+}
+
+void projectSphereContours(const float* cosTable, const float* sinTable, int nPoints, float innerRadius, float outerRadius,
+                           const float* x, const float* y, const float* z, int nCentres,
+                           float fx, float fy, float cx, float cy,
+                           float* u, float* v, int stride)
+{
+    switch(nPoints)
+    {
+    case 25:
+        projectCircles<25>(cosTable,sinTable,nPoints,innerRadius,outerRadius,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    case 50:
+        projectCircles<50>(cosTable,sinTable,nPoints,innerRadius,outerRadius,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    case 100:
+        projectCircles<100>(cosTable,sinTable,nPoints,innerRadius,outerRadius,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    default:
+        projectCircles<0>(cosTable,sinTable,nPoints,innerRadius,outerRadius,x,y,z,nCentres,fx,fy,cx,cy,u,v,stride);
+        break;
+    }
+}
+
+float histogramScore(const float* inner, const float* outer, const float* sqrtTemplate, int n,
+                     float innerScale, float outerScale)
+{
+    float score=0;
+    int i=0;
+
+#if defined(__AVX2__)
+    const __m256 vInnerScale=_mm256_set1_ps(innerScale), vOuterScale=_mm256_set1_ps(outerScale);
+    __m256 sum=_mm256_setzero_ps();
+    for(;i+8<=n;i+=8)
+    {
+        __m256 term=_mm256_sub_ps(_mm256_mul_ps(vInnerScale,_mm256_loadu_ps(sqrtTemplate+i)),
+                                  _mm256_mul_ps(vOuterScale,_mm256_sqrt_ps(_mm256_loadu_ps(outer+i))));
+        sum=_mm256_add_ps(sum,_mm256_mul_ps(_mm256_sqrt_ps(_mm256_loadu_ps(inner+i)),term));
+    }
+    __m128 half=_mm_add_ps(_mm256_castps256_ps128(sum),_mm256_extractf128_ps(sum,1));
+    half=_mm_add_ps(half,_mm_movehl_ps(half,half));
+    half=_mm_add_ss(half,_mm_shuffle_ps(half,half,1));
+    score=_mm_cvtss_f32(half);
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 vInnerScale=_mm_set1_ps(innerScale), vOuterScale=_mm_set1_ps(outerScale);
+    __m128 sum=_mm_setzero_ps();
+    for(;i+4<=n;i+=4)
+    {
+        __m128 term=_mm_sub_ps(_mm_mul_ps(vInnerScale,_mm_loadu_ps(sqrtTemplate+i)),
+                               _mm_mul_ps(vOuterScale,_mm_sqrt_ps(_mm_loadu_ps(outer+i))));
+        sum=_mm_add_ps(sum,_mm_mul_ps(_mm_sqrt_ps(_mm_loadu_ps(inner+i)),term));
+    }
+    sum=_mm_add_ps(sum,_mm_movehl_ps(sum,sum));
+    sum=_mm_add_ss(sum,_mm_shuffle_ps(sum,sum,1));
+    score=_mm_cvtss_f32(sum);
+#endif
+
+    for(;i<n;i++)
+    {
+        score+=std::sqrt(inner[i])*(innerScale*sqrtTemplate[i]-outerScale*std::sqrt(outer[i]));
+    }
+    return score;
+}
@@ -44,12 +44,54 @@ an example, with comments:
  #############################
  nParticles                  900
  #nParticles                 number of particles used
+ minParticles                900
+ #minParticles               fewer than nParticles: the number of particles adapts between minParticles and nParticles (KLD-sampling) [nParticles=fixed]
+ kldError                    0.05
+ #kldError                   KLD-sampling: bound on the KL distance between the particles and the posterior
+ kldBinSize                  20
+ #kldBinSize                 KLD-sampling: side of the cells of the 3D grid the particles are counted in [mm]
+ resamplingScheme            systematic
+ #resamplingScheme           [systematic | stratified=one random offset per new particle | residual=deterministic copies, then systematic]
+ #seed                       1
+ #seed                       seed of the random numbers: the same seed replays the same particles, whatever nThreads [absent=from the clock]
+ coarsePixels                0
+ #coarsePixels               contour points per particle of a first, cheaper likelihood; only the best particles get the full one [0=single stage]
+ fineFraction                0.25
+ #fineFraction               fraction of the particles scored again with all the contour points, when coarsePixels>0
+ scoringMode                 0
+ #scoringMode                [0=colour histograms of the contours of each particle | 1=score each pixel once per image, then average the scores along the contours: faster with many particles]
+ nPixels                     50
+ #nPixels                    points on each contour, the shape model file holds 6*nPixels values [25, 50 and 100 have specialised kernels]
+ yBins                       4
+ #yBins                      colour bins of the histograms along Y [1..4]
+ uBins                       8
+ #uBins                      colour bins of the histograms along U [1..8]
+ vBins                       8
+ #vBins                      colour bins of the histograms along V [1..8]
  accelStDev                  30
  #accelStDev                 standard deviation of the acceleration noise
+ framePeriod                 0.0
+ #framePeriod                frame period of the motion model [s]: the particles move by the time between the image timestamps; 0=one period per image
  insideOutsideDiffWeight     1.5
  #insideOutsideDiffWeight    inside-outside difference weight for the likelihood function
  colorTransfPolicy           1
- #colorTransfPolicy          [0=transform the whole image | 1=only transform the pixels you need]
+ #colorTransfPolicy          [0=transform the whole image | 1=only transform the pixels you need | 2=choose based on image size and nParticles]
+ colorLut                    packed
+ #colorLut                   [packed=16 MB table | quantized=64 KB table, 5-6-5 RGB | direct=no table, computed]
+ useCache                    1
+ #useCache                   [0 | 1=keep the look up table and the template histograms on disk: a restart maps them instead of computing them]
+ #cacheDir                   directory of the cache, by default the writable directory of the context
+ zeroCopy                    false
+ #zeroCopy                   [true=read the images from the input port buffer and draw on the output port buffer | false=work on copies]
+ stereo                      false
+ #stereo                     [true=weight the particles with the images of both cameras, the likelihoods are multiplied | false=left camera only]
+ #                           the right images come from inputVideoPortRight, pipelineDepth is set to 0.
+ stereoStampTolerance        0.02
+ #stereoStampTolerance       [s] a right image whose timestamp is further than this from the left one is not used: that image is weighted with the left camera only [0=no check]
+ pipelineDepth               0
+ #pipelineDepth              frames a capture thread can read and transform in advance, the oldest is dropped when they are too many [0=no capture thread]
+ nThreads                    1
+ #nThreads                   number of threads used to evaluate the particles [0=one per core]
  
  
  #########################
@@ -57,6 +99,8 @@ an example, with comments:
  #########################
  inputVideoPort              /pf3dTracker/video:i
  #inputVideoPort             receives images from the grabber or the rectifying program.
+ inputVideoPortRight         /pf3dTracker/videoRight:i
+ #inputVideoPortRight        receives the images of the right camera, in stereo. the two streams should be synchronized.
  outputVideoPort             /pf3dTracker/video:o
  #outputVideoPort            produces images in which the contour of the estimated ball is highlighted.
  outputDataPort              /pf3dTracker/data:o
@@ -64,9 +108,17 @@ an example, with comments:
  inputParticlePort           /pf3dTracker/particles:i
  #inputParticlePort          receives hypotheses on the position of the ball from the bottom up module
  outputParticlePort          /pf3dTracker/particles:o
- #outputParticlePort         produces data for the plotter. it is usually not active for performance reasons.
+ #outputParticlePort         produces the particles and their likelihoods, as one binary block, when it is connected.
+ particleDecimation          1
+ #particleDecimation         outputParticlePort sends one particle every particleDecimation.
  outputAttentionPort         /pf3dTracker/attention:o
  #outputAttentionPort        produces data for the attention system, in terms of a peak of saliency.
+ outputStatsPort             /pf3dTracker/stats:o
+ #outputStatsPort            produces the latency of each stage of the cycle: (name samples p50 p95 p99) [milliseconds], then (dropped frames) and (particles in use).
+ outputTargetsPort           /pf3dTracker/targets:o
+ #outputTargetsPort          produces, when extraColorTemplates is set, one list per other object: (index X Y Z likelihood U V seeing_object).
+ rpcPort                     /pf3dTracker/rpc
+ #rpcPort                    accepts the commands: stats, resetStats, help, quit.
  
  
  #################################
@@ -78,6 +130,10 @@ an example, with comments:
  cameraContext  cameraCalibration
  cameraFile     icubEyes.ini
  cameraGroup    CAMERA_CALIBRATION_LEFT
+ cameraGroupRight    CAMERA_CALIBRATION_RIGHT
+ #cameraGroupRight           calibration of the right camera, in stereo.
+ #rightCameraTransform       (1 0 0 -0.068  0 1 0 0  0 0 1 0)
+ #rightCameraTransform       [R T] row major, T in meters: a point p of the left camera frame is R*p+T in the right one. by default the cameras are parallel, 68mm apart.
  
  #######################
  #tracked object models#
@@ -86,9 +142,14 @@ an example, with comments:
  trackedObjectType           sphere
  trackedObjectColorTemplate  models/red_smiley_2009_07_02.bmp
  trackedObjectShapeTemplate  models/initial_ball_points_smiley_31mm_20percent.csv
+ #sphereFastPath             [0=project the 3D points of the shape model | 1=project a sphere model from tables of the unit circle, faster]
+ sphereFastPath              1
  
  motionModelMatrix           models/motion_model_matrix.csv
  trackedObjectTemp           current_histogram.csv
+ #extraColorTemplates        (models/green_ball.bmp models/blue_ball.bmp)
+ #extraColorTemplates        colour templates of other objects of the same shape, tracked on the same images: see outputTargetsPort.
+ #                           their histograms are written to trackedObjectTemp with the suffix _target1, _target2...
  
  
  #######################
@@ -120,6 +181,15 @@ an example, with comments:
  #assumes it's not seeing the right object and is reinitialized.
  #
  likelihoodThreshold         0.005
+ #
+ #the template histogram can follow slow lighting changes: at each image, the inner histograms of the best particles (at most 5)
+ #more likely than templateAdaptationGate, weighted by their likelihoods, are blended in with weight templateAdaptationRate [0=fixed template].
+ #the histograms are the ones the particles were weighted with, of both cameras in stereo. scoringMode 1 builds none: the template stays fixed.
+ templateAdaptationRate      0.0
+ templateAdaptationGate      0.1
+ #the adapted template is written to adaptedTemplateFile on close (default: adapted_histogram.csv in the writable context directory);
+ #resumeAdaptedTemplate 1 starts from it.
+ resumeAdaptedTemplate       0
 
 \endcode 
 
@@ -129,16 +199,24 @@ The tracker need to be connected to a port that streams images, at the very leas
 \section portsc_sec Ports Created 
 - /pf3dTracker/video:i receives the image stream given which the ball has to be tracked.
 
+- /pf3dTracker/videoRight:i receives the images of the right camera, when stereo is true. Each particle is projected in both images, with the intrinsics of each camera and the pose of the right camera given by rightCameraTransform, and its weight is the product of the two likelihoods: the depth of the ball is then constrained by the disparity, not just by its apparent size.
+
 - /pf3dTracker/video:o produces images in which the contour of the estimated ball is highlighted. When the tracker is confident that it's tracking a ball, it draws the contour in green, when it is not confident (it's looking for a ball, but does not yet have a good estimate), it draws the contour in yellow.
 
 - /pf3dTracker/data:o produces a stream of data in the format: X, Y, Z [meters], likelihood, U, V [pixels], seeing_object. <br>
 X, Y and Z are the estimated coordinates of the tracked ball in the eye reference frame (they can be transformed to the root reference frame by module \ref eye2RootFrameTransformer "eye2RootFrameTransformer". The likelihood value indicates how confident the tracker is that the object it's tracking is the right ball (the lower the likelihood, the lower the confidence, but beware that even a perfect match will result in a value pretty far from 1). U and V are the estimated coordinates of the centre of the ball in the image plane, U is horizontal and V vertical, the origin is on the top left corner of the image. Seeing_object is a flag, it is set 1 when the likelihood is higher than a threshold specified in the initialization file, it is set to 0 otherwise. When the tracker experiences 5 consecutive images with seeing_object==0, the estimate is reset. This prevents the tracker from getting stuck on an unlikely target.
 
-- /pf3dTracker/particles:i receives hypotheses on 3D poses of a ball, normally produced by the \ref icub_pf3dBottomup "pf3dBottomup" detection module. If the tracker does not receive anything on this port, it behaves normally, i.e., it needs more time to find a ball and start tracking it, after initialization.
+- /pf3dTracker/particles:i receives hypotheses on 3D poses of a ball, normally produced by the \ref icub_pf3dBottomup "pf3dBottomup" detection module. If the tracker does not receive anything on this port, it behaves normally, i.e., it needs more time to find a ball and start tracking it, after initialization. The hypotheses are either a message in the format of /pf3dTracker/particles:o with at least the rows X, Y and Z, or the number of hypotheses followed by X, Y and Z of each one [mm].
 
-- /pf3dTracker/particles:o produces data for the plotter. it is usually not active for performance reasons.
+- /pf3dTracker/particles:o produces the particles, for the plotter, when it is connected: a bottle with the tag pf3dParticles, the number of particles n, the number of rows (7), the decimation (see particleDecimation) and a blob of 7*n floats, one row after the other: X, Y, Z [mm], VX, VY, VZ [mm/frame] and the likelihood of each particle, in the byte order of the tracker.
 
 - /pf3dTracker/attention:o produces data for the attention system, in terms of a peak of saliency.
+
+- /pf3dTracker/stats:o produces the latency of each stage of the cycle (acquire, colourTransform, likelihood, resample, motionModel, drawing, publish and the whole cycle), as one list per stage: name, number of samples, 50th, 95th and 99th percentile [milliseconds] over the last 500 cycles. Two last lists report the number of frames dropped by the capture stage and the number of particles in use (it changes with KLD-sampling, see minParticles). The statistics are only computed when the port is connected.
+
+- /pf3dTracker/targets:o produces, when other objects are tracked (see extraColorTemplates), one list per object in the format: index, X, Y, Z [meters], likelihood, U, V [pixels], seeing_object, with the same meaning as on /pf3dTracker/data:o. The objects are numbered from 1, in the order of extraColorTemplates, and drawn on /pf3dTracker/video:o in their own colours.
+
+- /pf3dTracker/rpc accepts the commands: stats (replies with the same content as /pf3dTracker/stats:o), resetStats, help and quit.
  
 
  
@@ -0,0 +1,91 @@
+/**
+*
+* Particle messages of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cstring>
+
+#include <iCub/pf3dTrackerParticleMessage.hpp>
+
+using namespace std;
+using namespace yarp::os;
+
+void writeParticleMessage(Bottle &message, const ParticleSet &particles, int n, int decimation,
+                          vector<float> &buffer)
+{
+    if(decimation<1)
+        decimation=1;
+    const int nSent=(n+decimation-1)/decimation;
+
+    //the rows are gathered in one block: a single blob, a single copy into the message.
+    buffer.resize((size_t)ParticleSet::NRows*nSent);
+    for(int r=0;r<ParticleSet::NRows;r++)
+    {
+        const float* in=particles.row(r);
+        float* out=&buffer[0]+(size_t)r*nSent;
+        if(decimation==1)
+            memcpy(out,in,sizeof(float)*nSent);
+        else
+            for(int count=0;count<nSent;count++)
+                out[count]=in[count*decimation];
+    }
+
+    message.clear();
+    message.addString(ParticleMessageTag);
+    message.addInt32(nSent);
+    message.addInt32(ParticleSet::NRows);
+    message.addInt32(decimation);
+    message.add(Value::makeBlob(buffer.empty() ? NULL : &buffer[0],(int)(sizeof(float)*buffer.size())));
+}
+
+int particleMessageSize(const Bottle &message)
+{
+    if(message.size()==0)
+        return -1;
+
+    if(!message.get(0).isString())
+    {
+        //the old text message: n, then X Y Z of each particle.
+        int n=message.get(0).asInt32();
+        if(n<0 || (int)message.size()<1+3*n)
+            return -1;
+        return n;
+    }
+
+    if(message.get(0).asString()!=ParticleMessageTag || message.size()<5 || !message.get(4).isBlob())
+        return -1;
+    int n=message.get(1).asInt32();
+    int nRows=message.get(2).asInt32();
+    if(n<0 || nRows<3 || message.get(4).asBlobLength()<sizeof(float)*(size_t)nRows*(size_t)n)
+        return -1;
+    return n;
+}
+
+void readParticleMessage(const Bottle &message, int n, float* x, float* y, float* z)
+{
+    int count;
+
+    if(!message.get(0).isString())
+    {
+        for(count=0;count<n;count++)
+        {
+            x[count]=(float)message.get(1+count*3+0).asFloat64();
+            y[count]=(float)message.get(1+count*3+1).asFloat64();
+            z[count]=(float)message.get(1+count*3+2).asFloat64();
+        }
+        return;
+    }
+
+    //the blob has no alignment guarantee: the rows are copied bytewise.
+    const int nSent=message.get(1).asInt32();
+    const char* block=message.get(4).asBlob();
+    float* const position[3]={x,y,z};
+    for(int r=0;r<3;r++)
+        memcpy(position[r],block+sizeof(float)*(size_t)r*nSent,sizeof(float)*n);
+}
@@ -0,0 +1,82 @@
+/**
+*
+* Particle storage of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <algorithm>
+#include <cstring>
+
+#include <iCub/pf3dTrackerSupport.hpp>
+#include <iCub/pf3dTrackerParticles.hpp>
+
+using namespace std;
+
+ParticleSet::ParticleSet() : _data(NULL), _capacity(0), _size(0), _stride(0)
+{
+}
+
+ParticleSet::~ParticleSet()
+{
+    release();
+}
+
+bool ParticleSet::allocate(int capacity)
+{
+    release();
+
+    _stride=((capacity+15)/16)*16;
+    _data=(float*)alignedMalloc(sizeof(float)*NRows*_stride,64);
+    if(_data==NULL)
+    {
+        _stride=0;
+        return false;
+    }
+
+    _capacity=capacity;
+    _size=capacity;
+    setZero(); //fill the memory with zeros, so that valgrind won't complain.
+    return true;
+}
+
+void ParticleSet::release()
+{
+    alignedFree(_data);
+    _data=NULL;
+    _capacity=0;
+    _size=0;
+    _stride=0;
+}
+
+void ParticleSet::setSize(int size)
+{
+    _size=min(max(size,0),_capacity);
+}
+
+void ParticleSet::setZero()
+{
+    if(_data!=NULL)
+        memset(_data,0,sizeof(float)*NRows*_stride);
+}
+
+void ParticleSet::copyFrom(const ParticleSet &other)
+{
+    setSize(other.size());
+    for(int r=0;r<NRows;r++)
+    {
+        memcpy(row(r),other.row(r),sizeof(float)*_size);
+    }
+}
+
+void ParticleSet::swap(ParticleSet &other)
+{
+    std::swap(_data,other._data);
+    std::swap(_capacity,other._capacity);
+    std::swap(_size,other._size);
+    std::swap(_stride,other._stride);
+}
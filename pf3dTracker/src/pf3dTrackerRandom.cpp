@@ -0,0 +1,136 @@
+/**
+*
+* Random numbers of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include <iCub/pf3dTrackerRandom.hpp>
+
+using namespace std;
+
+//elements of a stream produced by one call of philox4x32().
+#define PhiloxElements (4*PhiloxLanes)
+
+void philox4x32(unsigned long long key, unsigned int first, unsigned int stream, unsigned int draw,
+                unsigned int out[4][PhiloxLanes])
+{
+    int lane, round;
+    unsigned int c0[PhiloxLanes], c1[PhiloxLanes], c2[PhiloxLanes], c3[PhiloxLanes];
+    unsigned int k0=(unsigned int)key;
+    unsigned int k1=(unsigned int)(key>>32);
+
+    for(lane=0;lane<PhiloxLanes;lane++)
+    {
+        c0[lane]=first+(unsigned int)lane;
+        c1[lane]=stream;
+        c2[lane]=draw;
+        c3[lane]=0;
+    }
+    for(round=0;round<10;round++)
+    {
+        for(lane=0;lane<PhiloxLanes;lane++)
+        {
+            unsigned long long p0=(unsigned long long)0xD2511F53U*c0[lane];
+            unsigned long long p1=(unsigned long long)0xCD9E8D57U*c2[lane];
+            unsigned int n0=(unsigned int)(p1>>32)^c1[lane]^k0;
+            unsigned int n2=(unsigned int)(p0>>32)^c3[lane]^k1;
+            c1[lane]=(unsigned int)p1;
+            c3[lane]=(unsigned int)p0;
+            c0[lane]=n0;
+            c2[lane]=n2;
+        }
+        k0+=0x9E3779B9U;
+        k1+=0xBB67AE85U;
+    }
+    for(lane=0;lane<PhiloxLanes;lane++)
+    {
+        out[0][lane]=c0[lane];
+        out[1][lane]=c1[lane];
+        out[2][lane]=c2[lane];
+        out[3][lane]=c3[lane];
+    }
+}
+
+//PhiloxElements uniform numbers in [0,1): the elements 4*group..4*group+PhiloxElements-1 of a stream.
+static void uniforms(unsigned long long key, unsigned int stream, unsigned int draw, unsigned int group, float* values)
+{
+    unsigned int words[4][PhiloxLanes];
+    philox4x32(key,group,stream,draw,words);
+    for(int lane=0;lane<PhiloxLanes;lane++)
+        for(int k=0;k<4;k++)
+            values[4*lane+k]=(float)(words[k][lane]>>8)*(1.0F/16777216.0F); //24 bits: exact in a float.
+}
+
+//the same, normal numbers: each pair of words gives two of them with the Box-Muller transform.
+static void normals(unsigned long long key, unsigned int stream, unsigned int draw, unsigned int group, float* values)
+{
+    const double pi=3.14159265358979323846; //M_PI is not standard, MSVC lacks it.
+    unsigned int words[4][PhiloxLanes];
+    philox4x32(key,group,stream,draw,words);
+    for(int lane=0;lane<PhiloxLanes;lane++)
+    {
+        for(int k=0;k<4;k+=2)
+        {
+            const float u=((float)(words[k][lane]>>8)+1.0F)*(1.0F/16777216.0F); //(0,1]: the logarithm is finite.
+            const float theta=(float)(words[k+1][lane]>>8)*(float)(2.0*pi/16777216.0);
+            const float r=sqrt(-2.0F*log(u));
+            values[4*lane+k]=r*cos(theta);
+            values[4*lane+k+1]=r*sin(theta);
+        }
+    }
+}
+
+void randomUniform(unsigned long long key, unsigned int stream, unsigned int draw, int begin, int end, float* out)
+{
+    float values[PhiloxElements];
+    for(int base=(begin/PhiloxElements)*PhiloxElements;base<end;base+=PhiloxElements)
+    {
+        uniforms(key,stream,draw,(unsigned int)(base/4),values);
+        for(int count=max(base,begin);count<min(base+PhiloxElements,end);count++)
+            out[count]=values[count-base];
+    }
+}
+
+void randomNormal(unsigned long long key, unsigned int stream, unsigned int draw, int begin, int end,
+                  float mean, float stDev, float* out)
+{
+    float values[PhiloxElements];
+    for(int base=(begin/PhiloxElements)*PhiloxElements;base<end;base+=PhiloxElements)
+    {
+        normals(key,stream,draw,(unsigned int)(base/4),values);
+        for(int count=max(base,begin);count<min(base+PhiloxElements,end);count++)
+            out[count]=mean+stDev*values[count-base];
+    }
+}
+
+void addAccelerationNoise(unsigned long long key, unsigned int firstStream, unsigned int draw, int begin, int end,
+                          float stDev, float periods, float* const position[3], float* const velocity[3])
+{
+    float values[PhiloxElements];
+    const float positionGain=0.5F*periods*periods;
+    for(int base=(begin/PhiloxElements)*PhiloxElements;base<end;base+=PhiloxElements)
+    {
+        const int first=max(base,begin);
+        const int last=min(base+PhiloxElements,end);
+        for(int axis=0;axis<3;axis++)
+        {
+            normals(key,firstStream+(unsigned int)axis,draw,(unsigned int)(base/4),values);
+            float* p=position[axis];
+            float* v=velocity[axis];
+            for(int count=first;count<last;count++)
+            {
+                const float acceleration=stDev*values[count-base];
+                p[count]+=positionGain*acceleration;
+                v[count]+=periods*acceleration;
+            }
+        }
+    }
+}
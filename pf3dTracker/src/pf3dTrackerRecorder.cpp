@@ -0,0 +1,171 @@
+/**
+*
+* Image recorder of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+#include <opencv2/opencv.hpp>
+
+#include <yarp/os/Log.h>
+#include <yarp/os/LogStream.h>
+
+#include <iCub/pf3dTrackerRecorder.hpp>
+
+using namespace std;
+
+ImageRecorder::ImageRecorder() : _encoding(Jpeg), _jpegQuality(95), _rawFile(NULL)
+{
+}
+
+ImageRecorder::~ImageRecorder()
+{
+    stop();
+}
+
+bool ImageRecorder::start(const string &prefix, Encoding encoding, int jpegQuality, int queueLength)
+{
+    stop();
+
+    _prefix=prefix;
+    _encoding=encoding;
+    _jpegQuality=jpegQuality;
+    if(_encoding==Raw)
+    {
+        string fileName=_prefix+"frames.pf3draw";
+        _rawFile=fopen(fileName.c_str(),"wb");
+        if(_rawFile==NULL)
+        {
+            yWarning() << "I wasn\'t able to open "<<fileName<<".";
+            return false;
+        }
+        fwrite(RawFramesMagic,1,strlen(RawFramesMagic),_rawFile);
+    }
+
+    //one image is being written, one is being copied, the others wait.
+    if(queueLength<1)
+        queueLength=1;
+    _slots.resize(queueLength+2);
+    _queue.reset((int)_slots.size(),queueLength);
+    _thread=std::thread(&ImageRecorder::writeLoop,this);
+    return true;
+}
+
+void ImageRecorder::stop()
+{
+    if(_thread.joinable())
+    {
+        _queue.close();
+        _thread.join();
+        if(_queue.dropped()>0)
+            yWarning() << "The recorder dropped "<<_queue.dropped()<<" images: the disk was too slow.";
+    }
+    if(_rawFile!=NULL)
+    {
+        fclose(_rawFile);
+        _rawFile=NULL;
+    }
+    _slots.clear();
+}
+
+void ImageRecorder::push(const cv::Mat &image, bool rgb, int frameNumber, double timestamp)
+{
+    int slot=_queue.acquire();
+    if(slot<0)
+        return;
+    Slot &frame=_slots[slot];
+    image.copyTo(frame.image); //the buffer of the slot is reused when the size doesn't change.
+    frame.rgb=rgb;
+    frame.frameNumber=frameNumber;
+    frame.timestamp=timestamp;
+    _queue.push(slot);
+}
+
+void ImageRecorder::writeLoop()
+{
+    int slot;
+    while((slot=_queue.pop())>=0)
+    {
+        write(_slots[slot]);
+        _queue.release(slot);
+    }
+}
+
+void ImageRecorder::write(Slot &slot)
+{
+    //the conversion is done here, not in the tracking loop.
+    if(slot.rgb)
+    {
+        cv::cvtColor(slot.image,slot.image,CV_RGB2BGR);
+        slot.rgb=false;
+    }
+
+    if(_encoding==Raw)
+    {
+        int header[4]={slot.frameNumber,slot.image.cols,slot.image.rows,0};
+        fwrite(header,sizeof(int),4,_rawFile);
+        fwrite(&slot.timestamp,sizeof(double),1,_rawFile);
+        for(int row=0;row<slot.image.rows;row++)
+            fwrite(slot.image.ptr(row),3,slot.image.cols,_rawFile);
+        return;
+    }
+
+    stringstream fileName;
+    fileName<<_prefix<<setfill('0')<<setw(4)<<slot.frameNumber;
+    vector<int> parameters;
+    if(_encoding==Jpeg)
+    {
+        fileName<<".jpeg";
+        parameters.push_back(cv::IMWRITE_JPEG_QUALITY);
+        parameters.push_back(_jpegQuality);
+    }
+    else
+    {
+        fileName<<".png";
+    }
+    if(!cv::imwrite(fileName.str(),slot.image,parameters))
+        yWarning() << "I wasn\'t able to write "<<fileName.str()<<".";
+}
+
+bool readRawFrames(const string &fileName, vector<cv::Mat> &frames, vector<double> &timestamps)
+{
+    frames.clear();
+    timestamps.clear();
+
+    FILE* file=fopen(fileName.c_str(),"rb");
+    if(file==NULL)
+        return false;
+
+    char magic[8];
+    bool ok=(fread(magic,1,sizeof(magic),file)==sizeof(magic) && memcmp(magic,RawFramesMagic,sizeof(magic))==0);
+    while(ok)
+    {
+        int header[4];
+        double timestamp;
+        if(fread(header,sizeof(int),4,file)!=4)
+            break; //the end of the file.
+        if(header[1]<=0 || header[2]<=0 || fread(&timestamp,sizeof(double),1,file)!=1)
+        {
+            ok=false;
+            break;
+        }
+        cv::Mat frame(header[2],header[1],CV_8UC3);
+        if(fread(frame.data,3*header[1],header[2],file)!=(size_t)header[2])
+        {
+            ok=false;
+            break;
+        }
+        frames.push_back(frame);
+        timestamps.push_back(timestamp);
+    }
+    fclose(file);
+    return ok;
+}
@@ -0,0 +1,176 @@
+/**
+*
+* Resampling of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include <iCub/pf3dTrackerSupport.hpp>
+#include <iCub/pf3dTrackerResampling.hpp>
+
+using namespace std;
+
+Resampler::Resampler() : _cumWeight(NULL), _residual(NULL), _ancestors(NULL), _capacity(0)
+{
+}
+
+Resampler::~Resampler()
+{
+    release();
+}
+
+bool Resampler::allocate(int capacity)
+{
+    release();
+
+    _cumWeight=(float*)alignedMalloc(sizeof(float)*capacity);
+    _residual=(float*)alignedMalloc(sizeof(float)*capacity);
+    _ancestors=(int*)alignedMalloc(sizeof(int)*capacity);
+    _blockSums.resize((capacity+ResamplingBlock-1)/ResamplingBlock+1);
+    if(_cumWeight==NULL || _residual==NULL || _ancestors==NULL)
+    {
+        release();
+        return false;
+    }
+    _capacity=capacity;
+    return true;
+}
+
+void Resampler::release()
+{
+    alignedFree(_cumWeight);
+    _cumWeight=NULL;
+    alignedFree(_residual);
+    _residual=NULL;
+    alignedFree(_ancestors);
+    _ancestors=NULL;
+    _capacity=0;
+}
+
+float Resampler::cumulate(const float* weight, int n, WorkerPool &workers)
+{
+    int block;
+    const int nBlocks=(n+ResamplingBlock-1)/ResamplingBlock;
+
+    //1. the prefix sum of each block, in parallel.
+    workers.run(nBlocks,[this,weight,n](int worker, int begin, int end)
+    {
+        for(int block=begin;block<end;block++)
+        {
+            int first=block*ResamplingBlock;
+            int last=min(first+ResamplingBlock,n);
+            float sum=0;
+            for(int count=first;count<last;count++)
+            {
+                sum+=weight[count];
+                _cumWeight[count]=sum;
+            }
+            _blockSums[block]=sum;
+        }
+    });
+
+    //2. the offset of each block, serially: there are only a few of them.
+    float offset=0;
+    for(block=0;block<nBlocks;block++)
+    {
+        float sum=_blockSums[block];
+        _blockSums[block]=offset;
+        offset+=sum;
+    }
+
+    //3. add the offsets, in parallel. the first block has none.
+    if(nBlocks>1)
+    {
+        workers.run(nBlocks-1,[this,n](int worker, int begin, int end)
+        {
+            for(int block=begin+1;block<end+1;block++)
+            {
+                int first=block*ResamplingBlock;
+                int last=min(first+ResamplingBlock,n);
+                const float blockOffset=_blockSums[block];
+                for(int count=first;count<last;count++)
+                    _cumWeight[count]+=blockOffset;
+            }
+        });
+    }
+
+    return offset;
+}
+
+void Resampler::draw(int n, int nNew, const float* uniforms, bool stratified, int* ancestors, WorkerPool &workers)
+{
+    if(n<=0 || nNew<=0)
+        return;
+    const float* cumWeight=_cumWeight;
+    const float step=cumWeight[n-1]/(float)nNew;
+
+    //the points grow with j, so are their ancestors: each chunk looks for the ancestor of its
+    //first point, then walks along the cumulative weights.
+    workers.run(nNew,[=](int worker, int begin, int end)
+    {
+        float point=(begin+(stratified ? uniforms[begin] : uniforms[0]))*step;
+        int ancestor=(int)(lower_bound(cumWeight,cumWeight+n,point)-cumWeight);
+        for(int count=begin;count<end;count++)
+        {
+            point=(count+(stratified ? uniforms[count] : uniforms[0]))*step;
+            while(ancestor<n-1 && cumWeight[ancestor]<point)
+                ancestor++;
+            ancestors[count]=min(ancestor,n-1); //the last point can overshoot the sum by a rounding error.
+        }
+    });
+}
+
+void Resampler::resample(Scheme scheme, const float* weight, int n, int nNew, const float* uniforms, WorkerPool &workers)
+{
+    int count;
+
+    if(scheme!=Residual)
+    {
+        cumulate(weight,n,workers);
+        draw(n,nNew,uniforms,scheme==Stratified,_ancestors,workers);
+        return;
+    }
+
+    //residual: particle i is copied floor(nNew*w_i) times, the rest are drawn systematically from the remainders.
+    float sum=cumulate(weight,n,workers);
+    const float scale=(sum>0) ? (float)nNew/sum : 0;
+    int nCopies=0;
+    for(count=0;count<n;count++)
+    {
+        float expected=weight[count]*scale;
+        int copies=min((int)expected,nNew-nCopies);
+        _residual[count]=expected-(float)copies;
+        for(int copy=0;copy<copies;copy++)
+            _ancestors[nCopies+copy]=count;
+        nCopies+=copies;
+    }
+    if(nCopies<nNew)
+    {
+        cumulate(_residual,n,workers);
+        draw(n,nNew-nCopies,uniforms,false,_ancestors+nCopies,workers);
+    }
+}
+
+void Resampler::gather(const ParticleSet &oldParticles, ParticleSet &newParticles, int nNew, WorkerPool &workers) const
+{
+    const int* ancestors=_ancestors;
+    workers.run(nNew,[&oldParticles,&newParticles,ancestors](int worker, int begin, int end)
+    {
+        for(int r=ParticleSet::X;r<=ParticleSet::VZ;r++)
+        {
+            const float* in=oldParticles.row(r);
+            float* out=newParticles.row(r);
+            for(int count=begin;count<end;count++)
+                out[count]=in[ancestors[count]];
+        }
+    });
+    float* w=newParticles.row(ParticleSet::W);
+    fill(w,w+newParticles.size(),0.0F);
+}
@@ -0,0 +1,91 @@
+/**
+*
+* Latency statistics of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <algorithm>
+
+#include <iCub/pf3dTrackerStats.hpp>
+
+using namespace std;
+using namespace yarp::os;
+
+StageStats::StageStats(int window) : _window((window>0)?window:1)
+{
+    for(int stage=0;stage<NStages;stage++)
+    {
+        _samples[stage].resize(_window);
+    }
+    reset();
+}
+
+void StageStats::add(Stage stage, double seconds)
+{
+    lock_guard<mutex> lock(_mutex);
+    _samples[stage][_next[stage]]=seconds;
+    _next[stage]=(_next[stage]+1)%_window;
+    if(_count[stage]<_window)
+        _count[stage]++;
+}
+
+void StageStats::reset()
+{
+    lock_guard<mutex> lock(_mutex);
+    for(int stage=0;stage<NStages;stage++)
+    {
+        _next[stage]=0;
+        _count[stage]=0;
+    }
+}
+
+bool StageStats::percentiles(Stage stage, double &p50, double &p95, double &p99, int &samples) const
+{
+    vector<double> sorted;
+    {
+        lock_guard<mutex> lock(_mutex);
+        samples=_count[stage];
+        sorted.assign(_samples[stage].begin(),_samples[stage].begin()+samples);
+    }
+    if(samples==0)
+    {
+        p50=p95=p99=0;
+        return false;
+    }
+
+    //nearest rank.
+    sort(sorted.begin(),sorted.end());
+    p50=sorted[(samples*50-1)/100];
+    p95=sorted[(samples*95-1)/100];
+    p99=sorted[(samples*99-1)/100];
+    return true;
+}
+
+void StageStats::write(Bottle &bottle) const
+{
+    double p50, p95, p99;
+    int samples;
+    for(int stage=0;stage<NStages;stage++)
+    {
+        percentiles((Stage)stage,p50,p95,p99,samples);
+        Bottle &list=bottle.addList();
+        list.addString(name(stage));
+        list.addInt32(samples);
+        list.addFloat64(p50*1000); //seconds to milliseconds
+        list.addFloat64(p95*1000);
+        list.addFloat64(p99*1000);
+    }
+}
+
+const char* StageStats::name(int stage)
+{
+    static const char* names[NStages]={"acquire","colourTransform","likelihood","resample","motionModel","drawing","publish","cycle"};
+    if(stage<0 || stage>=NStages)
+        return "unknown";
+    return names[stage];
+}
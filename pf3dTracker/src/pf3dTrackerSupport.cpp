@@ -11,7 +11,17 @@
 *
 */
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <new>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 #include <iCub/pf3dTrackerSupport.hpp>
 
 using namespace std;
@@ -38,6 +48,13 @@ void rgbToYuvBin(int &R, int &G, int &B, int &YBin, int &UBin, int &VBin)
         yWarning()<<"something's wrong with V: "<<VBin<<" "<<V<<" R= "<<R<<" G= "<<G<<" B= "<<B;
 }
 
+unsigned char rgbToBin(int R, int G, int B)
+{
+    int YBin, UBin, VBin;
+    rgbToYuvBin(R,G,B,YBin,UBin,VBin);
+    return (unsigned char)binIndex(YBin,UBin,VBin);
+}
+
 void rgbToYuvBinImage(IplImage *image,IplImage* transformedImage)
 {
     int a1,a2,r,g,b, s,t,u;
@@ -66,60 +83,228 @@ void setPixel(int u, int v, int r, int g, int b, IplImage *image)
     }
 }      
 
+bool createLut(Lut *lut, int type)
+{
+    lut->type=type;
+    lut->table=NULL;
+    if(type==LUT_PACKED)
+        lut->table=new (std::nothrow) unsigned char[256*256*256];
+    else if(type==LUT_QUANTIZED)
+        lut->table=new (std::nothrow) unsigned char[32*64*32];
+    else if(type!=LUT_DIRECT)
+        return false;
+
+    if((type!=LUT_DIRECT) && (lut->table==NULL))
+        return false;
+
+    fillLut(lut);
+    return true;
+}
+
+void releaseLut(Lut *lut)
+{
+    delete[] lut->table;
+    lut->table=NULL;
+}
+
 void fillLut(Lut *lut)
 {
-    int r,g,b, y,u,v;
+    int r,g,b;
     int index;
-    for(r=0;r<256;r++)
-        for(g=0;g<256;g++)
-            for(b=0;b<256;b++)
+    if(lut->type==LUT_PACKED)
+    {
+        unsigned char R[256], G[256], B[256];
+        for(b=0;b<256;b++)
+            B[b]=(unsigned char)b;
+        for(r=0;r<256;r++)
+            for(g=0;g<256;g++)
             {
-                rgbToYuvBin(r,g,b, y,u,v);
-                index=r*65536+g*256+b;
-                lut[index].y=y;
-                lut[index].u=u;
-                lut[index].v=v;
+                //one row of 256 blue values at a time, with the vectorized arithmetic.
+                memset(R,r,256);
+                memset(G,g,256);
+                index=r*65536+g*256;
+                Lut direct={LUT_DIRECT,NULL};
+                lutBins(&direct,R,G,B,256,lut->table+index);
             }
+    }
+    else if(lut->type==LUT_QUANTIZED)
+    {
+        //each cell of the 5-6-5 quantized colour space gets the bin of its central colour.
+        for(r=0;r<32;r++)
+            for(g=0;g<64;g++)
+                for(b=0;b<32;b++)
+                {
+                    index=(r<<11)|(g<<5)|b;
+                    lut->table[index]=rgbToBin((r<<3)+4,(g<<2)+2,(b<<3)+4);
+                }
+    }
 }
 
-void rgbToYuvBinMatLut(const cv::Mat& image, cv::Mat& transformedImage, Lut *lut)
+void lutBins(const Lut *lut, const unsigned char* R, const unsigned char* G, const unsigned char* B, int n, unsigned char* bins)
+{
+    int count=0;
+    if(lut->type==LUT_PACKED)
+    {
+        for(;count<n;count++)
+            bins[count]=lut->table[(R[count]<<16)|(G[count]<<8)|B[count]];
+        return;
+    }
+    if(lut->type==LUT_QUANTIZED)
+    {
+        for(;count<n;count++)
+            bins[count]=lut->table[((R[count]>>3)<<11)|((G[count]>>2)<<5)|(B[count]>>3)];
+        return;
+    }
+
+    //LUT_DIRECT: the same operations of rgbToYuvBin, in the same order, so that the bins are identical.
+#if defined(__AVX2__)
+    const __m256 yr=_mm256_set1_ps(0.299F),  yg=_mm256_set1_ps(0.587F),  yb=_mm256_set1_ps(0.114F);
+    const __m256 ur=_mm256_set1_ps(-0.147F), ug=_mm256_set1_ps(0.289F),  ub=_mm256_set1_ps(0.436F);
+    const __m256 vr=_mm256_set1_ps(0.615F),  vg=_mm256_set1_ps(0.515F),  vb=_mm256_set1_ps(0.100F);
+    const __m256 uOffset=_mm256_set1_ps(0.436F*255.0F), uScale=_mm256_set1_ps(2.0F*0.436F);
+    const __m256 vOffset=_mm256_set1_ps(0.615F*255.0F), vScale=_mm256_set1_ps(2.0F*0.615F+0.1F);
+    for(;count+8<=n;count+=8)
+    {
+        __m256 r=_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(R+count))));
+        __m256 g=_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(G+count))));
+        __m256 b=_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(B+count))));
+
+        __m256 Y=_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(yr,r),_mm256_mul_ps(yg,g)),_mm256_mul_ps(yb,b));
+        __m256 U=_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ur,r),_mm256_mul_ps(ug,g)),_mm256_mul_ps(ub,b));
+        U=_mm256_div_ps(_mm256_add_ps(U,uOffset),uScale);
+        __m256 V=_mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(vr,r),_mm256_mul_ps(vg,g)),_mm256_mul_ps(vb,b));
+        V=_mm256_div_ps(_mm256_add_ps(V,vOffset),vScale);
+
+        __m256i index=_mm256_or_si256(_mm256_or_si256(
+                      _mm256_slli_epi32(_mm256_srli_epi32(_mm256_cvttps_epi32(Y),6),6),
+                      _mm256_slli_epi32(_mm256_srli_epi32(_mm256_cvttps_epi32(U),5),3)),
+                      _mm256_srli_epi32(_mm256_cvttps_epi32(V),5));
+        __m128i packed=_mm_packus_epi32(_mm256_castsi256_si128(index),_mm256_extracti128_si256(index,1));
+        _mm_storel_epi64((__m128i*)(bins+count),_mm_packus_epi16(packed,packed));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128 yr=_mm_set1_ps(0.299F),  yg=_mm_set1_ps(0.587F),  yb=_mm_set1_ps(0.114F);
+    const __m128 ur=_mm_set1_ps(-0.147F), ug=_mm_set1_ps(0.289F),  ub=_mm_set1_ps(0.436F);
+    const __m128 vr=_mm_set1_ps(0.615F),  vg=_mm_set1_ps(0.515F),  vb=_mm_set1_ps(0.100F);
+    const __m128 uOffset=_mm_set1_ps(0.436F*255.0F), uScale=_mm_set1_ps(2.0F*0.436F);
+    const __m128 vOffset=_mm_set1_ps(0.615F*255.0F), vScale=_mm_set1_ps(2.0F*0.615F+0.1F);
+    const __m128i zero=_mm_setzero_si128();
+    for(;count+4<=n;count+=4)
+    {
+        int r4, g4, b4;
+        memcpy(&r4,R+count,4);
+        memcpy(&g4,G+count,4);
+        memcpy(&b4,B+count,4);
+        __m128 r=_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(r4),zero),zero));
+        __m128 g=_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(g4),zero),zero));
+        __m128 b=_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(b4),zero),zero));
+
+        __m128 Y=_mm_add_ps(_mm_add_ps(_mm_mul_ps(yr,r),_mm_mul_ps(yg,g)),_mm_mul_ps(yb,b));
+        __m128 U=_mm_add_ps(_mm_sub_ps(_mm_mul_ps(ur,r),_mm_mul_ps(ug,g)),_mm_mul_ps(ub,b));
+        U=_mm_div_ps(_mm_add_ps(U,uOffset),uScale);
+        __m128 V=_mm_add_ps(_mm_sub_ps(_mm_mul_ps(vr,r),_mm_mul_ps(vg,g)),_mm_mul_ps(vb,b));
+        V=_mm_div_ps(_mm_add_ps(V,vOffset),vScale);
+
+        __m128i index=_mm_or_si128(_mm_or_si128(
+                      _mm_slli_epi32(_mm_srli_epi32(_mm_cvttps_epi32(Y),6),6),
+                      _mm_slli_epi32(_mm_srli_epi32(_mm_cvttps_epi32(U),5),3)),
+                      _mm_srli_epi32(_mm_cvttps_epi32(V),5));
+        __m128i packed=_mm_packs_epi32(index,index);
+        int result=_mm_cvtsi128_si32(_mm_packus_epi16(packed,packed));
+        memcpy(bins+count,&result,4);
+    }
+#endif
+    for(;count<n;count++)
+        bins[count]=rgbToBin(R[count],G[count],B[count]);
+}
+
+void rgbToYuvBinMatLut(const cv::Mat& image, cv::Mat& transformedImage, const Lut *lut)
 {
     int a1,a2,r,g,b;
     int index;
 
-    for(a1=0;a1<image.cols;a1++)
-        for(a2=0;a2<image.rows;a2++)
+    //row by row, so that both images are read sequentially.
+    for(a2=0;a2<image.rows;a2++)
     {
-        r=(((uchar*)(image.data + image.step*a2))[a1*3+0]);
-        g=(((uchar*)(image.data + image.step*a2))[a1*3+1]);
-        b=(((uchar*)(image.data + image.step*a2))[a1*3+2]);
-        index=r*65536+g*256+b;
-        (((uchar*)(transformedImage.data + transformedImage.step*a2))[a1*3+0])=lut[index].y;
-        (((uchar*)(transformedImage.data + transformedImage.step*a2))[a1*3+1])=lut[index].u;
-        (((uchar*)(transformedImage.data + transformedImage.step*a2))[a1*3+2])=lut[index].v;
-        //rgbToYuvBin(r,g,b, yuvBinsImage[a1][a2][0], yuvBinsImage[a1][a2][1], yuvBinsImage[a1][a2][2]);
+        const uchar* pixel=(const uchar*)(image.data + image.step*a2);
+        uchar* transformedPixel=(uchar*)(transformedImage.data + transformedImage.step*a2);
+        for(a1=0;a1<image.cols;a1++)
+        {
+            r=pixel[a1*3+0];
+            g=pixel[a1*3+1];
+            b=pixel[a1*3+2];
+            index=lutBin(lut,r,g,b);
+            transformedPixel[a1*3+0]=binY(index);
+            transformedPixel[a1*3+1]=binU(index);
+            transformedPixel[a1*3+2]=binV(index);
+        }
     }
-
 }
 
-void rgbToYuvBinImageLut(IplImage *image,IplImage *transformedImage, Lut *lut)
+void rgbToYuvBinImageLut(IplImage *image,IplImage *transformedImage, const Lut *lut)
 {
     int a1,a2,r,g,b;
     int index;
 
-    for(a1=0;a1<image->width;a1++)
-        for(a2=0;a2<image->height;a2++)
+    //row by row, so that both images are read sequentially.
+    for(a2=0;a2<image->height;a2++)
+    {
+        const uchar* pixel=(const uchar*)(image->imageData + image->widthStep*a2);
+        uchar* transformedPixel=(uchar*)(transformedImage->imageData + transformedImage->widthStep*a2);
+        for(a1=0;a1<image->width;a1++)
+        {
+            r=pixel[a1*3+0];
+            g=pixel[a1*3+1];
+            b=pixel[a1*3+2];
+            index=lutBin(lut,r,g,b);
+            transformedPixel[a1*3+0]=binY(index);
+            transformedPixel[a1*3+1]=binU(index);
+            transformedPixel[a1*3+2]=binV(index);
+        }
+    }
+}
+
+void rgbToBinImage(const Lut *lut, const unsigned char* image, int imageStep, int width, int rowBegin, int rowEnd, unsigned char* bins, int binsStep)
+{
+    //the pixels are deinterleaved a chunk at a time, then binned with the table or the vectorized arithmetic.
+    const int chunk=256;
+    unsigned char R[chunk], G[chunk], B[chunk];
+    int row, column, count, n;
+
+    for(row=rowBegin;row<rowEnd;row++)
+    {
+        const unsigned char* pixel=image+(size_t)row*imageStep;
+        unsigned char* bin=bins+(size_t)row*binsStep;
+        for(column=0;column<width;column+=chunk)
         {
-            r=(((uchar*)(image->imageData + image->widthStep*a2))[a1*3+0]);
-            g=(((uchar*)(image->imageData + image->widthStep*a2))[a1*3+1]);
-            b=(((uchar*)(image->imageData + image->widthStep*a2))[a1*3+2]);
-            index=r*65536+g*256+b;
-            (((uchar*)(transformedImage->imageData + transformedImage->widthStep*a2))[a1*3+0])=lut[index].y;
-            (((uchar*)(transformedImage->imageData + transformedImage->widthStep*a2))[a1*3+1])=lut[index].u;
-            (((uchar*)(transformedImage->imageData + transformedImage->widthStep*a2))[a1*3+2])=lut[index].v;
-            //rgbToYuvBin(r,g,b, yuvBinsImage[a1][a2][0], yuvBinsImage[a1][a2][1], yuvBinsImage[a1][a2][2]);
+            n=(width-column<chunk)?(width-column):chunk;
+            for(count=0;count<n;count++)
+            {
+                R[count]=pixel[(column+count)*3+0];
+                G[count]=pixel[(column+count)*3+1];
+                B[count]=pixel[(column+count)*3+2];
+            }
+            lutBins(lut,R,G,B,n,bin+column);
         }
+    }
+}
+
+void* alignedMalloc(size_t size, size_t alignment)
+{
+    //over-allocate, align the pointer and store the original one just before it.
+    unsigned char* raw=(unsigned char*)malloc(size+alignment+sizeof(void*));
+    if(raw==NULL)
+        return NULL;
+    size_t address=(size_t)(raw+sizeof(void*));
+    unsigned char* aligned=(unsigned char*)((address+alignment-1)&~(alignment-1));
+    ((void**)aligned)[-1]=raw;
+    return aligned;
+}
 
+void alignedFree(void* ptr)
+{
+    if(ptr!=NULL)
+        free(((void**)ptr)[-1]);
 }
 
 void rgbToYuvBinLut(int &R, int &G, int &B, int &YBin, int &UBin, int &VBin, Lut *lut)
@@ -0,0 +1,132 @@
+/**
+*
+* Worker pool of the 3d position tracker implementing the particle filter.
+* See \ref icub_pf3dtracker \endref
+*
+* Copyright (C) 2026 iCub Tech Facility - Istituto Italiano di Tecnologia
+*
+* CopyPolicy: Released under the terms of the GNU GPL v2.0.
+*
+*/
+
+#include <iCub/pf3dTrackerWorkers.hpp>
+
+using namespace std;
+
+WorkerPool::WorkerPool() : _job(NULL), _nItems(0), _nWorkers(1), _pending(0), _generation(0), _quit(false)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::start(int nWorkers)
+{
+    stop();
+
+    if(nWorkers<=0)
+    {
+        nWorkers=(int)thread::hardware_concurrency();
+        if(nWorkers<=0)
+            nWorkers=1;
+    }
+
+    _nWorkers=nWorkers;
+    _quit=false;
+    for(int worker=1;worker<_nWorkers;worker++)
+    {
+        _threads.push_back(thread(&WorkerPool::loop,this,worker,_generation));
+    }
+}
+
+void WorkerPool::stop()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _quit=true;
+    }
+    _wakeUp.notify_all();
+
+    for(size_t count=0;count<_threads.size();count++)
+    {
+        _threads[count].join();
+    }
+    _threads.clear();
+    _nWorkers=1;
+}
+
+int WorkerPool::size() const
+{
+    return _nWorkers;
+}
+
+void WorkerPool::chunk(int worker, int nItems, int &begin, int &end) const
+{
+    //the first (nItems % _nWorkers) workers get one item more than the others.
+    int base=nItems/_nWorkers;
+    int extra=nItems%_nWorkers;
+    begin=worker*base+(worker<extra ? worker : extra);
+    end=begin+base+(worker<extra ? 1 : 0);
+}
+
+void WorkerPool::run(int nItems, const Job &job)
+{
+    int begin, end;
+
+    if(_threads.empty())
+    {
+        job(0,0,nItems);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _job=&job;
+        _nItems=nItems;
+        _pending=(int)_threads.size();
+        _generation++;
+    }
+    _wakeUp.notify_all();
+
+    chunk(0,nItems,begin,end);
+    if(begin<end)
+        job(0,begin,end);
+
+    unique_lock<mutex> lock(_mutex);
+    while(_pending>0)
+        _allDone.wait(lock);
+    _job=NULL;
+}
+
+void WorkerPool::loop(int worker, unsigned int seenGeneration)
+{
+    int begin, end;
+
+    while(true)
+    {
+        const Job *job;
+        int nItems;
+        {
+            unique_lock<mutex> lock(_mutex);
+            while(!_quit && _generation==seenGeneration)
+                _wakeUp.wait(lock);
+            if(_quit)
+                return;
+            seenGeneration=_generation;
+            job=_job;
+            nItems=_nItems;
+        }
+
+        chunk(worker,nItems,begin,end);
+        if(begin<end)
+            (*job)(worker,begin,end);
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _pending--;
+        }
+        _allDone.notify_one();
+    }
+}